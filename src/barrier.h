@@ -31,6 +31,12 @@
  *
  * PARALLELISM CONTROL: The barrier limits the number of threads that run at the same time.
  *
+ * WAKE-UP FAN-OUT: By default, the thread that starts a phase wakes every thread that runs in it, one
+ * futex wake at a time, under the scheduler lock. With fanout > 0, it just picks the threads to run,
+ * and they wake each other up in a tree: the first fanout threads are woken by the thread that picked
+ * them, and each woken thread then wakes its own fanout children, so wake-ups proceed in parallel
+ * and mostly outside the scheduler lock.
+ *
  * Author: Daniel Sanchez <sanchezd@stanford.edu>
  * Date: Apr 2011
  */
@@ -54,6 +60,8 @@
 #define TIMEOUT_LENGTH 20 //seconds
 #define MAX_TIMEOUTS 10
 
+#define MAX_BARRIER_FANOUT 16
+
 //#define DEBUG_BARRIER(args...) info(args)
 #define DEBUG_BARRIER(args...)
 
@@ -66,14 +74,23 @@ class Callee {
 class Barrier : public GlobAlloc {
     private:
         uint32_t parallelThreads;
+        uint32_t fanout; //0 for serial wake-ups
 
         enum State {OFFLINE, WAITING, RUNNING, LEFT};
 
+        //Threads that a thread must wake up, in fan-out mode
+        struct WakeList {
+            uint32_t tids[MAX_BARRIER_FANOUT];
+            uint32_t size;
+        };
+
         struct ThreadSyncInfo {
             volatile State state;
             volatile uint32_t futexWord;
             uint32_t lastIdx;
             uint32_t pad;
+            WakeList picked; //woken by this thread because it picked them to run
+            WakeList children; //woken by this thread once it wakes up, as a node of another thread's wake tree
         };
 
         ThreadSyncInfo threadList[MAX_THREADS];
@@ -88,6 +105,10 @@ class Barrier : public GlobAlloc {
 
         uint32_t phaseCount; //INTERNAL, for LEFT->OFFLINE bookkeeping overhead reduction purposes
 
+        //Wake tree of the current tryWakeNext() call, in fan-out mode
+        uint32_t* wakeTree;
+        uint32_t wakeTreeSize;
+
         uint32_t pad[16];
 
         /* NOTE(dsm): I was initially misled that having a single lock protecting the barrier was a performance hog, and coded a lock-free version.
@@ -102,10 +123,13 @@ class Barrier : public GlobAlloc {
         Callee* sched; //FIXME: I don't like this organization, but don't have time to refactor the barrier code, this is used for a callback when the phase is done
 
     public:
-        Barrier(uint32_t _parallelThreads, Callee* _sched) : parallelThreads(_parallelThreads), rnd(0xBA77137), sched(_sched) {
+        Barrier(uint32_t _parallelThreads, uint32_t _fanout, Callee* _sched) : parallelThreads(_parallelThreads), fanout(_fanout), rnd(0xBA77137), sched(_sched) {
+            if (fanout > MAX_BARRIER_FANOUT) panic("Barrier fan-out %d exceeds the maximum (%d)", fanout, MAX_BARRIER_FANOUT);
             for (uint32_t t = 0; t < MAX_THREADS; t++) {
                 threadList[t].state = OFFLINE;
                 threadList[t].futexWord = 0;
+                threadList[t].picked.size = 0;
+                threadList[t].children.size = 0;
             }
 
             runList = gm_calloc<uint32_t>(MAX_THREADS);
@@ -115,6 +139,8 @@ class Barrier : public GlobAlloc {
             runningThreads = 0;
             leftThreads = 0;
             phaseCount = 0;
+            wakeTree = gm_calloc<uint32_t>(MAX_THREADS);
+            wakeTreeSize = 0;
             //barrierLock = 0;
         }
 
@@ -150,16 +176,8 @@ class Barrier : public GlobAlloc {
             threadList[tid].futexWord = 1;
             tryWakeNext(tid); //NOTE: You can't cause a phase to end here.
             futex_unlock(schedLock);
-
-            if (threadList[tid].state == WAITING) {
-                DEBUG_BARRIER("[%d] Waiting on join", tid);
-                while (true) {
-                    int futex_res = syscall(SYS_futex, &threadList[tid].futexWord, FUTEX_WAIT, 1 /*a racing thread waking us up will change value to 0, and we won't block*/, nullptr, nullptr, 0);
-                    if (futex_res == 0 || threadList[tid].futexWord != 1) break;
-                }
-                //The thread that wakes us up changes this
-                assert(threadList[tid].state == RUNNING);
-            }
+            wakeAll(threadList[tid].picked);
+            waitTurn(tid);
         }
 
         //Must be called with schedLock held
@@ -170,6 +188,7 @@ class Barrier : public GlobAlloc {
                 leftThreads++;
                 runningThreads--;
                 tryWakeNext(tid); //can trigger phase end
+                wakeAll(threadList[tid].picked); //our caller holds schedLock, so we can't defer this
             } else {
                 assert_msg(threadList[tid].state == WAITING, "leave, tid %d, incorrect state %d", tid, threadList[tid].state);
                 threadList[tid].state = LEFT;
@@ -186,8 +205,22 @@ class Barrier : public GlobAlloc {
             runningThreads--;
             tryWakeNext(tid); //can trigger phase end
             futex_unlock(schedLock);
+            wakeAll(threadList[tid].picked);
+            waitTurn(tid);
+        }
 
-            if (threadList[tid].state == WAITING) {
+    private:
+        //Called without schedLock held, blocks until the thread can run
+        void waitTurn(uint32_t tid) {
+            if (fanout) {
+                //Our state may already be RUNNING, but we must wait until our parent in the wake tree wakes us up
+                while (threadList[tid].futexWord == 1) {
+                    syscall(SYS_futex, &threadList[tid].futexWord, FUTEX_WAIT, 1, nullptr, nullptr, 0);
+                }
+                assert(threadList[tid].state == RUNNING);
+                wakeAll(threadList[tid].children);
+            } else if (threadList[tid].state == WAITING) {
+                DEBUG_BARRIER("[%d] Waiting", tid);
                 while (true) {
                     int futex_res = syscall(SYS_futex, &threadList[tid].futexWord, FUTEX_WAIT, 1 /*a racing thread waking us up will change value to 0, and we won't block*/, nullptr, nullptr, 0);
                     if (futex_res == 0 || threadList[tid].futexWord != 1) break;
@@ -197,7 +230,32 @@ class Barrier : public GlobAlloc {
             }
         }
 
-    private:
+        //Wakes the threads in wl, which are all RUNNING already, and empties it
+        void wakeAll(WakeList& wl) {
+            for (uint32_t i = 0; i < wl.size; i++) {
+                uint32_t wtid = wl.tids[i];
+                bool succ = __sync_bool_compare_and_swap(&threadList[wtid].futexWord, 1, 0);
+                if (!succ) panic("Wakeup race in barrier?");
+                syscall(SYS_futex, &threadList[wtid].futexWord, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+            }
+            wl.size = 0;
+        }
+
+        //Adds wtid, which the caller (tid) picked to run, to the current wake tree
+        inline void addToWakeTree(uint32_t tid, uint32_t wtid) {
+            if (wtid == tid) {
+                //We picked ourselves (e.g., on a new phase), no need to wake up
+                threadList[tid].futexWord = 0;
+                return;
+            }
+            uint32_t pos = wakeTreeSize++;
+            wakeTree[pos] = wtid;
+            threadList[wtid].children.size = 0;
+            WakeList& wl = (pos < fanout)? threadList[tid].picked : threadList[wakeTree[pos/fanout - 1]].children;
+            assert(wl.size < fanout);
+            wl.tids[wl.size++] = wtid;
+        }
+
         inline void checkEndPhase(uint32_t tid) {
             if (curThreadIdx == runListSize && runningThreads == 0) {
                 if (leftThreads == runListSize) {
@@ -262,9 +320,13 @@ class Barrier : public GlobAlloc {
                     DEBUG_BARRIER("[%d] Waking %d runningThreads %d", tid, wtid, runningThreads);
                     threadList[wtid].state = RUNNING; //must be set before writing to futexWord to avoid wakeup race
                     threadList[wtid].lastIdx = idx;
-                    bool succ = __sync_bool_compare_and_swap(&threadList[wtid].futexWord, 1, 0);
-                    if (!succ) panic("Wakeup race in barrier?");
-                    syscall(SYS_futex, &threadList[wtid].futexWord, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+                    if (fanout) {
+                        addToWakeTree(tid, wtid);
+                    } else {
+                        bool succ = __sync_bool_compare_and_swap(&threadList[wtid].futexWord, 1, 0);
+                        if (!succ) panic("Wakeup race in barrier?");
+                        syscall(SYS_futex, &threadList[wtid].futexWord, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+                    }
                     runningThreads++;
                 } else {
                     DEBUG_BARRIER("[%d] Skipping %d state %d", tid, wtid, threadList[wtid].state);
@@ -273,6 +335,7 @@ class Barrier : public GlobAlloc {
         }
 
         void tryWakeNext(uint32_t tid) {
+            wakeTreeSize = 0;
             checkRunList(tid); //wake up threads on this phase, may reach EOP
             checkEndPhase(tid); //see if we've reached EOP, execute if if so
             checkRunList(tid); //if we started a new phase, wake up threads
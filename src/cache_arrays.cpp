@@ -34,24 +34,24 @@
 
 /* Set-associative array implementation */
 
-SetAssocArray::SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf) : rp(_rp), hf(_hf), numLines(_numLines), assoc(_assoc)  {
+SetAssocArray::SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf, bool wideTagMatch) : rp(_rp), hf(_hf), numLines(_numLines), assoc(_assoc)  {
     array = gm_calloc<Address>(numLines);
     numSets = numLines/assoc;
     setMask = numSets - 1;
-    info("Set Assoc Array: %i lines and %i sets", numLines, numSets);
+    const char* matchName;
+    matcher = SelectTagMatcher(assoc, wideTagMatch, &matchName);
+    info("Set Assoc Array: %i lines and %i sets, %s tag match", numLines, numSets, matchName);
     assert_msg(isPow2(numSets), "must have a power of 2 # sets, but you specified %d", numSets);
 }
 
 int32_t SetAssocArray::lookup(const Address lineAddr, const MemReq* req, bool updateReplacement) {
     uint32_t set = hf->hash(0, lineAddr) & setMask;
     uint32_t first = set*assoc;
-    for (uint32_t id = first; id < first + assoc; id++) {
-        if (array[id] ==  lineAddr) {
-            if (updateReplacement) rp->update(id, req);
-            return id;
-        }
-    }
-    return -1;
+    int32_t way = MatchTag(matcher, &array[first], assoc, lineAddr);
+    if (way < 0) return -1;
+    uint32_t id = first + way;
+    if (updateReplacement) rp->update(id, req);
+    return id;
 }
 
 uint32_t SetAssocArray::preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr) { //TODO: Give out valid bit of wb cand?
@@ -70,7 +70,7 @@ void SetAssocArray::postinsert(const Address lineAddr, const MemReq* req, uint32
     rp->update(candidate, req);
 }
 
-SparseTagArray::SparseTagArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf) : rp(_rp), hf(_hf), numLines(_numLines), assoc(_assoc) {
+SparseTagArray::SparseTagArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf, bool wideTagMatch) : rp(_rp), hf(_hf), numLines(_numLines), assoc(_assoc) {
     tagArray = gm_calloc<Address>(numLines);
     prePtrArray = gm_calloc<int32_t>(numLines);
     nextPtrArray = gm_calloc<int32_t>(numLines);
@@ -85,7 +85,9 @@ SparseTagArray::SparseTagArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy*
     numSets = numLines/assoc;
     setMask = numSets - 1;
     validLines = 0;
-    info("Sparse Tag Array: %i lines and %i sets", numLines, numSets);
+    const char* matchName;
+    matcher = SelectTagMatcher(assoc, wideTagMatch, &matchName);
+    info("Sparse Tag Array: %i lines and %i sets, %s tag match", numLines, numSets, matchName);
     assert_msg(isPow2(numSets), "must have a power of 2 # sets, but you specified %d", numSets);
 }
 
@@ -100,13 +102,11 @@ SparseTagArray::~SparseTagArray() {
 int32_t SparseTagArray::lookup(const Address lineAddr, const MemReq* req, bool updateReplacement) {
     uint32_t set = hf->hash(0, lineAddr) & setMask;
     uint32_t first = set*assoc;
-    for (uint32_t id = first; id < first + assoc; id++) {
-        if (tagArray[id] == lineAddr) {
-            if (updateReplacement) rp->update(id, req);
-            return id;
-        }
-    }
-    return -1;
+    int32_t way = MatchTag(matcher, &tagArray[first], assoc, lineAddr);
+    if (way < 0) return -1;
+    uint32_t id = first + way;
+    if (updateReplacement) rp->update(id, req);
+    return id;
 }
 
 uint32_t SparseTagArray::preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr) {
@@ -574,8 +574,10 @@ int32_t ZArray::lookup(const Address lineAddr, const MemReq* req, bool updateRep
      */
     if (unlikely(!lineAddr)) panic("ZArray::lookup called with lineAddr==0 -- your app just segfaulted");
 
+    uint64_t hashes[ways];
+    hf->hashAll(lineAddr, ways, hashes);
     for (uint32_t w = 0; w < ways; w++) {
-        uint32_t lineId = lookupArray[w*numSets + (hf->hash(w, lineAddr) & setMask)];
+        uint32_t lineId = lookupArray[w*numSets + (hashes[w] & setMask)];
         if (array[lineId] == lineAddr) {
             if (updateReplacement) {
                 rp->update(lineId, req);
@@ -596,8 +598,10 @@ uint32_t ZArray::preinsert(const Address lineAddr, const MemReq* req, Address* w
     //info("Replacement for incoming 0x%lx", lineAddr);
 
     //Seeds
+    uint64_t hashes[ways];  // all ways are hashed at once, see HashFamily::hashAll()
+    hf->hashAll(lineAddr, ways, hashes);
     for (uint32_t w = 0; w < ways; w++) {
-        uint32_t pos = w*numSets + (hf->hash(w, lineAddr) & setMask);
+        uint32_t pos = w*numSets + (hashes[w] & setMask);
         uint32_t lineId = lookupArray[pos];
         candidates[w].set(pos, lineId, -1);
         all_valid &= (array[lineId] != 0);
@@ -609,8 +613,9 @@ uint32_t ZArray::preinsert(const Address lineAddr, const MemReq* req, Address* w
         uint32_t fringeId = candidates[fringeStart].lineId;
         Address fringeAddr = array[fringeId];
         assert(fringeAddr);
+        hf->hashAll(fringeAddr, ways, hashes);
         for (uint32_t w = 0; w < ways; w++) {
-            uint32_t hval = hf->hash(w, fringeAddr) & setMask;
+            uint32_t hval = hashes[w] & setMask;
             uint32_t pos = w*numSets + hval;
             uint32_t lineId = lookupArray[pos];
 
@@ -731,8 +736,10 @@ int32_t ZArray_Par::lookup(const Address lineAddr, const MemReq* req, bool updat
      */
     if (unlikely(!lineAddr)) panic("ZArray::lookup called with lineAddr==0 -- your app just segfaulted");
 
+    uint64_t hashes[ways];
+    hf->hashAll(lineAddr, ways, hashes);
     for (uint32_t w = 0; w < ways; w++) {
-        uint32_t lineId = lookupArray[w*numSets + (hf->hash(w, lineAddr) & setMask)];
+        uint32_t lineId = lookupArray[w*numSets + (hashes[w] & setMask)];
         if (array[lineId] == lineAddr) {
             if (updateReplacement) {
                 rp->update(lineId, req);
@@ -754,8 +761,10 @@ uint32_t ZArray_Par::preinsert(const Address lineAddr, const MemReq* req, Addres
     //info("Replacement for incoming 0x%lx", lineAddr);
 
     //Seeds
+    uint64_t hashes[ways];  // all ways are hashed at once, see HashFamily::hashAll()
+    hf->hashAll(lineAddr, ways, hashes);
     for (uint32_t w = 0; w < ways; w++) {
-        uint32_t pos = w*numSets + (hf->hash(w, lineAddr) & setMask);
+        uint32_t pos = w*numSets + (hashes[w] & setMask);
         uint32_t lineId = lookupArray[pos];
         candidates[w].set(pos, lineId, -1, domain_ID[lineId]);
         if (domain_ID[lineId] == req->srcId || domain_ID[lineId] == uint32_t(-1)) actual_numCands++;
@@ -768,8 +777,9 @@ uint32_t ZArray_Par::preinsert(const Address lineAddr, const MemReq* req, Addres
         uint32_t fringeId = candidates[fringeStart].lineId;
         Address fringeAddr = array[fringeId];
         assert(fringeAddr);
+        hf->hashAll(fringeAddr, ways, hashes);
         for (uint32_t w = 0; w < ways; w++) {
-            uint32_t hval = hf->hash(w, fringeAddr) & setMask;
+            uint32_t hval = hashes[w] & setMask;
             uint32_t pos = w*numSets + hval;
             uint32_t lineId = lookupArray[pos];
 
@@ -28,6 +28,7 @@
 
 #include "memory_hierarchy.h"
 #include "stats.h"
+#include "tag_match.h"
 
 /* General interface of a cache array. The array is a fixed-size associative container that
  * translates addresses to line IDs. A line ID represents the position of the tag. The other
@@ -64,9 +65,10 @@ class SetAssocArray : public CacheArray {
         uint32_t numSets;
         uint32_t assoc;
         uint32_t setMask;
+        TagMatcher matcher;
 
     public:
-        SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf);
+        SetAssocArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf, bool wideTagMatch = false);
         SetAssocArray() {};
 
         int32_t lookup(const Address lineAddr, const MemReq* req, bool updateReplacement);
@@ -88,9 +90,10 @@ class SparseTagArray {
         uint32_t assoc;
         uint32_t setMask;
         uint32_t validLines;
+        TagMatcher matcher;
 
     public:
-        SparseTagArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf);
+        SparseTagArray(uint32_t _numLines, uint32_t _assoc, ReplPolicy* _rp, HashFamily* _hf, bool wideTagMatch = false);
         ~SparseTagArray();
 
         int32_t lookup(const Address lineAddr, const MemReq* req, bool updateReplacement);
@@ -31,8 +31,10 @@
 #include <typeinfo>
 #include <unordered_map>
 #include <vector>
+#include "domain_tuner.h"
 #include "log.h"
 #include "ooo_core.h"
+#include "phase_controller.h"
 #include "timing_core.h"
 #include "timing_event.h"
 #include "zsim.h"
@@ -65,6 +67,14 @@ ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
     limit = 0;
     lastLimit = 0;
     inCSim = false;
+    lastPhaseMaxSkew = 0;
+    weaveSamplePeriod = 1;
+    skewAlpha = 0.5;
+    skipWeave = false;
+    tuneDomains = 0;
+    curTask = nullptr;
+    curTaskItems = 0;
+    nextTaskItem = 0;
 
     domains = gm_calloc<DomainData>(numDomains);
     simThreads = gm_calloc<SimThreadData>(numSimThreads);
@@ -73,8 +83,18 @@ ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
         new (&domains[i].pq) PrioQueue<TimingEvent, PQ_BLOCKS>();
         domains[i].curCycle = 0;
         futex_init(&domains[i].pqLock);
+        domains[i].crossingsFrom = gm_calloc<uint64_t>(numDomains);
     }
 
+#if RECORD_EVENT_STREAMS
+    for (uint32_t i = 0; i < numDomains; i++) {
+        std::stringstream ss;
+        ss << zinfo->outputDir << "/evstream-" << i << ".bin";
+        domains[i].streamFile = fopen(ss.str().c_str(), "w");
+        if (!domains[i].streamFile) panic("Could not open %s", ss.str().c_str());
+    }
+#endif
+
     if ((numDomains % numSimThreads) != 0) panic("numDomains(%d) must be a multiple of numSimThreads(%d) for now", numDomains, numSimThreads);
 
     for (uint32_t i = 0; i < numSimThreads; i++) {
@@ -116,6 +136,21 @@ void ContentionSim::postInit() {
     skipContention = true;
 }
 
+void ContentionSim::setWeaveSampling(uint32_t period, double alpha) {
+    if (period == 0) panic("sim.weaveSamplePeriod must be >= 1");
+    if (alpha <= 0.0 || alpha > 1.0) panic("sim.weaveSampleAlpha must be in (0, 1], is %f", alpha);
+    weaveSamplePeriod = period;
+    skewAlpha = alpha;
+}
+
+void ContentionSim::setDomainTuning(uint32_t domains, const std::vector<uint32_t>& slots) {
+    if (domains == 0 || domains % numSimThreads != 0) {
+        panic("sim.tuneDomains (%d) must be a multiple of sim.contentionThreads (%d)", domains, numSimThreads);
+    }
+    tuneDomains = domains;
+    slotDomains.assign(slots.begin(), slots.end());
+}
+
 void ContentionSim::initStats(AggregateStat* parentStat) {
     AggregateStat* objStat = new AggregateStat(false);
     objStat->init("contention", "Contention simulation stats");
@@ -138,14 +173,45 @@ void ContentionSim::initStats(AggregateStat* parentStat) {
         new (&domains[i].profTime) ClockStat();
         domains[i].profTime.init("time", "Weave simulation time");
         domStat->append(&domains[i].profTime);
+        DomainData* dom = &domains[i];
+        auto evStat = makeLambdaStat([dom]() {return dom->events;});
+        evStat->init("events", "Events simulated, including crossing retries");
+        domStat->append(evStat);
+        auto xStat = makeLambdaStat([dom]() {return dom->crossings;});
+        xStat->init("crossings", "Incoming crossings");
+        domStat->append(xStat);
         objStat->append(domStat);
     }
+
+    if (weaveSamplePeriod > 1) {
+        AggregateStat* sampStat = new AggregateStat();
+        sampStat->init("sampling", "Weave sampling stats");
+        profSampledPhases.init("sampled", "Phases that ran the weave");
+        profSkippedPhases.init("skipped", "Phases that skipped the weave");
+        profSkewCycles.init("skew", "Skew cycles measured on sampled phases");
+        profPredSkewCycles.init("predSkew", "Skew cycles predicted for sampled phases, before training on them");
+        profPredErrorCycles.init("predError", "Absolute prediction error on sampled phases, in cycles; divide by skew for the relative error");
+        profCorrectionCycles.init("correction", "Predicted skew cycles applied on skipped phases");
+        sampStat->append(&profSampledPhases);
+        sampStat->append(&profSkippedPhases);
+        sampStat->append(&profSkewCycles);
+        sampStat->append(&profPredSkewCycles);
+        sampStat->append(&profPredErrorCycles);
+        sampStat->append(&profCorrectionCycles);
+        objStat->append(sampStat);
+    }
     parentStat->append(objStat);
 }
 
 void ContentionSim::simulatePhase(uint64_t limit) {
     if (skipContention) return; //fastpath when there are no cores to simulate
 
+    if (skipWeave) {
+        skipPhase();
+        updateWeaveSampling();
+        return;
+    }
+
     this->limit = limit;
     assert(limit >= lastLimit);
 
@@ -171,15 +237,59 @@ void ContentionSim::simulatePhase(uint64_t limit) {
     inCSim = false;
     __sync_synchronize();
 
+    uint64_t maxSkew = 0;
     for (uint32_t i = 0; i < zinfo->numCores; i++) {
+        uint64_t startCycles = zinfo->cores[i]->getCycles();
         TimingCore* tcore = dynamic_cast<TimingCore*>(zinfo->cores[i]);
         if (tcore) tcore->cSimEnd();
         OOOCore* ocore = dynamic_cast<OOOCore*>(zinfo->cores[i]);
         if (ocore) ocore->cSimEnd();
+        uint64_t endCycles = zinfo->cores[i]->getCycles();
+        if (endCycles > startCycles) maxSkew = MAX(maxSkew, endCycles - startCycles);
     }
+    lastPhaseMaxSkew = maxSkew;
 
     lastLimit = limit;
     __sync_synchronize();
+
+    profSampledPhases.inc();
+    updateWeaveSampling();
+}
+
+/* Nothing was recorded this phase, so the event queues hold at most the events that cores produced on joins
+ * and leaves; they run on the next sampled phase, which simulates from lastLimit on. lastLimit stays put so
+ * that those events and their children are not behind it.
+ */
+void ContentionSim::skipPhase() {
+    uint64_t maxSkew = 0;
+    for (uint32_t i = 0; i < zinfo->numCores; i++) {
+        uint64_t startCycles = zinfo->cores[i]->getCycles();
+        TimingCore* tcore = dynamic_cast<TimingCore*>(zinfo->cores[i]);
+        if (tcore) tcore->cSimSkip();
+        OOOCore* ocore = dynamic_cast<OOOCore*>(zinfo->cores[i]);
+        if (ocore) ocore->cSimSkip();
+        uint64_t endCycles = zinfo->cores[i]->getCycles();
+        if (endCycles > startCycles) maxSkew = MAX(maxSkew, endCycles - startCycles);
+    }
+    lastPhaseMaxSkew = maxSkew;
+    profSkippedPhases.inc();
+}
+
+/* Decides whether the next phase runs the weave, and connects or disconnects the cores' event recorders
+ * accordingly. Components that see a null recorder only compute bound-phase latencies. Bound-phase threads
+ * are all blocked on the barrier, so it is safe to swap them here.
+ */
+void ContentionSim::updateWeaveSampling() {
+    if (weaveSamplePeriod == 1) return;
+    bool nextSkipWeave = ((zinfo->numPhases + 1) % weaveSamplePeriod) != 0;
+    if (nextSkipWeave == skipWeave) return;
+    for (uint32_t i = 0; i < zinfo->numCores; i++) {
+        TimingCore* tcore = dynamic_cast<TimingCore*>(zinfo->cores[i]);
+        if (tcore) zinfo->eventRecorders[i] = nextSkipWeave? nullptr : tcore->getEventRecorder();
+        OOOCore* ocore = dynamic_cast<OOOCore*>(zinfo->cores[i]);
+        if (ocore) zinfo->eventRecorders[i] = nextSkipWeave? nullptr : ocore->getEventRecorder();
+    }
+    skipWeave = nextSkipWeave;
 }
 
 void ContentionSim::enqueue(TimingEvent* ev, uint64_t cycle) {
@@ -187,7 +297,7 @@ void ContentionSim::enqueue(TimingEvent* ev, uint64_t cycle) {
     assert(ev);
     assert_msg(cycle >= lastLimit, "Enqueued event before last limit! cycle %ld min %ld", cycle, lastLimit);
     //Hacky, but helpful to chase events scheduled too far ahead due to bugs (e.g., cycle -1). We should probably formalize this a bit more
-    assert_msg(cycle < lastLimit+10*zinfo->phaseLength+1000000, "Queued event too far into the future, cycle %ld lastLimit %ld", cycle, lastLimit);
+    assert_msg(cycle < lastLimit+10*weaveSamplePeriod*MaxPhaseLength()+1000000, "Queued event too far into the future, cycle %ld lastLimit %ld", cycle, lastLimit);
 
     assert_msg(cycle >= domains[ev->domain].curCycle, "Queued event goes back in time, cycle %ld curCycle %ld", cycle, domains[ev->domain].curCycle);
     ev->privCycle = cycle;
@@ -196,6 +306,32 @@ void ContentionSim::enqueue(TimingEvent* ev, uint64_t cycle) {
     assert(ev->domain < (int32_t)numDomains);
 
     domains[ev->domain].pq.enqueue(ev, cycle);
+    recordStream(ev->domain, cycle, false);
+}
+
+/* Fused version of the children walk in TimingEvent::done(). Most children
+ * use the default parentDone(), so it is inlined here, and only children that
+ * override it pay for the virtual call. Children that become ready are
+ * enqueued directly.
+ */
+void ContentionSim::wakeChildren(TimingEvent* ev, uint64_t startCycle) {
+    assert(inCSim);
+    auto wLambda = [this, ev, startCycle](TimingEvent** childPtr) {
+        TimingEvent* child = *childPtr;
+        ev->checkDomain(child);
+        if (unlikely(child->customParentDone)) {
+            child->parentDone(startCycle);
+            return;
+        }
+        child->cycle = MAX(child->cycle, startCycle);
+        assert(child->numParents);
+        if (--child->numParents == 0) {
+            assert(child->state == EV_NONE);
+            child->state = EV_QUEUED;
+            enqueue(child, child->cycle + child->preDelay);
+        }
+    };
+    ev->visitChildren< decltype(wLambda) >(wLambda);
 }
 
 void ContentionSim::enqueueSynced(TimingEvent* ev, uint64_t cycle) {
@@ -208,10 +344,11 @@ void ContentionSim::enqueueSynced(TimingEvent* ev, uint64_t cycle) {
 
     assert_msg(cycle >= lastLimit, "Enqueued (synced) event before last limit! cycle %ld min %ld", cycle, lastLimit);
     //Hacky, but helpful to chase events scheduled too far ahead due to bugs (e.g., cycle -1). We should probably formalize this a bit more
-    assert_msg(cycle < lastLimit+10*zinfo->phaseLength+10000, "Queued  (synced) event too far into the future, cycle %ld lastLimit %ld", cycle, lastLimit);
+    assert_msg(cycle < lastLimit+10*weaveSamplePeriod*MaxPhaseLength()+10000, "Queued  (synced) event too far into the future, cycle %ld lastLimit %ld", cycle, lastLimit);
     ev->privCycle = cycle;
     assert(ev->numParents == 0);
     domains[ev->domain].pq.enqueue(ev, cycle);
+    recordStream(domain, cycle, false);
 
     futex_unlock(&domains[domain].pqLock);
 }
@@ -275,9 +412,13 @@ void ContentionSim::simThreadLoop(uint32_t thid) {
             break;
         }
 
-        //info("%d --- phase start", domain);
-        simulatePhaseThread(thid);
-        //info("%d --- phase end", domain);
+        if (curTask) {
+            runTaskItems();
+        } else {
+            //info("%d --- phase start", domain);
+            simulatePhaseThread(thid);
+            //info("%d --- phase end", domain);
+        }
 
         uint32_t val = __sync_add_and_fetch(&threadsDone, 1);
         if (val == numSimThreads) {
@@ -300,6 +441,8 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
             uint64_t domCycle = domain.curCycle;
             uint64_t cycle;
             TimingEvent* te = pq.dequeue(cycle);
+            recordStream(simThreads[thid].firstDomain, cycle, true);
+            domain.events++;
             assert(cycle >= domCycle);
             if (cycle != domCycle) {
                 domCycle = cycle;
@@ -371,6 +514,8 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
                     //info("YYY %d %ld %ld %d", numFinished, domPq.size(), domain->curCycle, domain->prio);
                     uint64_t cycle;
                     TimingEvent* te = pq.dequeue(cycle);
+                    recordStream(domain - domains, cycle, true);
+                    domain->events++;
                     //uint64_t nextCycle = pq.size()? pq.firstCycle() : cycle;
                     if (cycle != domain->curCycle) domain->curCycle = cycle;
                     te->run(cycle);
@@ -392,6 +537,8 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
                     //info("SSS %d %ld %ld", numFinished, stalledQueue.size(), domain->curCycle);
                     uint64_t cycle;
                     TimingEvent* te = pq.dequeue(cycle);
+                    recordStream(domain - domains, cycle, true);
+                    domain->events++;
                     if (cycle != domain->curCycle) domain->curCycle = cycle;
                     te->state = EV_RUNNING;
                     te->simulate(cycle);
@@ -410,9 +557,107 @@ void ContentionSim::simulatePhaseThread(uint32_t thid) {
     __sync_synchronize();
 }
 
+uint64_t ContentionSim::getCrossings() const {
+    uint64_t crossings = 0;
+    for (uint32_t i = 0; i < numDomains; i++) crossings += domains[i].crossings;
+    return crossings;
+}
+
+uint64_t ContentionSim::getCrossingRetries() const {
+    uint64_t retries = 0;
+    for (uint32_t i = 0; i < numDomains; i++) retries += domains[i].crossingRetries;
+    return retries;
+}
+
+uint64_t ContentionSim::getQueuedRequests() const {
+    uint64_t requests = 0;
+    for (uint32_t i = 0; i < numDomains; i++) requests += domains[i].queuedRequests;
+    return requests;
+}
+
+uint64_t ContentionSim::getQueueDelayCycles() const {
+    uint64_t cycles = 0;
+    for (uint32_t i = 0; i < numDomains; i++) cycles += domains[i].queueDelayCycles;
+    return cycles;
+}
+
+void ContentionSim::runParallel(ParallelTask* task, uint32_t numItems) {
+    assert(!inCSim);
+    assert(!curTask);
+    if (numItems <= 1 || numSimThreads == 1) {
+        //Not worth waking up the sim threads
+        for (uint32_t i = 0; i < numItems; i++) task->run(i);
+        return;
+    }
+
+    curTaskItems = numItems;
+    nextTaskItem = 0;
+    curTask = task;
+    __sync_synchronize();
+
+    for (uint32_t i = 0; i < numSimThreads; i++) {
+        futex_unlock(&simThreads[i].wakeLock);
+    }
+
+    runTaskItems(); //caller helps too
+    futex_lock_nospin(&waitLock);
+
+    curTask = nullptr;
+    __sync_synchronize();
+}
+
+void ContentionSim::runTaskItems() {
+    while (true) {
+        uint32_t item = __sync_fetch_and_add(&nextTaskItem, 1);
+        if (item >= curTaskItems) break;
+        curTask->run(item);
+    }
+}
+
+void ContentionSim::proposeDomainMap() {
+    if (!tuneDomains) return;
+    std::vector<uint64_t> events(numDomains);
+    std::vector<uint64_t> crossings(numDomains*numDomains);
+    std::vector<uint64_t> retries(numDomains);
+    for (uint32_t d = 0; d < numDomains; d++) {
+        events[d] = domains[d].events;
+        retries[d] = domains[d].crossingRetries;
+        for (uint32_t s = 0; s < numDomains; s++) crossings[s*numDomains + d] = domains[d].crossingsFrom[s];
+    }
+
+    DomainTuner tuner(events, crossings, retries);
+    std::vector<uint32_t> evenMap = tuner.evenMap(tuneDomains);
+    std::vector<uint32_t> map = tuner.tune(tuneDomains, numSimThreads);
+    double evenTime = tuner.estimateTime(evenMap, tuneDomains, numSimThreads);
+    double time = tuner.estimateTime(map, tuneDomains, numSimThreads);
+
+    //The proposal maps this run's domains; compose it with this run's slots so that it can be used as is
+    std::stringstream ms;
+    for (uint32_t s = 0; s < slotDomains.size(); s++) ms << (s? " " : "") << map[slotDomains[s]];
+
+    info("Domain tuning: %d domains -> %d domains on %d threads, %ld -> %ld crossings, estimated weave speedup %.2fx over the even placement",
+            numDomains, tuneDomains, numSimThreads, tuner.countCrossings(evenMap), tuner.countCrossings(map), (time > 0.0)? evenTime/time : 1.0);
+    info("Domain tuning: sim.domainMap = \"%s\"", ms.str().c_str());
+
+    std::stringstream ss;
+    ss << zinfo->outputDir << "/domainMap.cfg";
+    FILE* f = fopen(ss.str().c_str(), "w");
+    if (!f) {
+        warn("Could not open %s, domain map not written", ss.str().c_str());
+        return;
+    }
+    fprintf(f, "// Weave domain placement tuned from a %d-domain run, estimated weave speedup %.2fx over the even placement\n",
+            numDomains, (time > 0.0)? evenTime/time : 1.0);
+    fprintf(f, "sim = {\n    domains = %d;\n    contentionThreads = %d;\n    domainMap = \"%s\";\n};\n", tuneDomains, numSimThreads, ms.str().c_str());
+    fclose(f);
+}
+
 void ContentionSim::finish() {
     assert(!terminate);
     terminate = true;
     __sync_synchronize();
+#if RECORD_EVENT_STREAMS
+    for (uint32_t i = 0; i < numDomains; i++) fclose(domains[i].streamFile);
+#endif
 }
 
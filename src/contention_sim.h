@@ -43,12 +43,26 @@
 #define PROFILE_CROSSINGS 0
 //#define PROFILE_CROSSINGS 1
 
+//Set to 1 to write every domain's event queue operations to evstream-<domain>.bin in the output dir, for pqbench to replay
+#define RECORD_EVENT_STREAMS 0
+//#define RECORD_EVENT_STREAMS 1
+
 class TimingEvent;
 class DelayEvent;
 class CrossingEvent;
 
 #define PQ_BLOCKS 1024
 
+/* Work split in independent items that ContentionSim::runParallel() spreads
+ * across the contention simulation threads. Must be globally allocated, as
+ * the sim threads live in the first process.
+ */
+class ParallelTask : public GlobAlloc {
+    public:
+        virtual void run(uint32_t item) = 0;
+        virtual ~ParallelTask() {}
+};
+
 class ContentionSim : public GlobAlloc {
     private:
         struct CompareEvents : public std::binary_function<TimingEvent*, TimingEvent*, bool> {
@@ -78,6 +92,18 @@ class ContentionSim : public GlobAlloc {
 
             ClockStat profTime;
 
+            //Written only by the domain's sim thread; read between phases (adaptive phase length, domain tuning)
+            uint64_t events; //dequeued, including crossing retries
+            uint64_t crossings;
+            uint64_t crossingRetries;
+            uint64_t* crossingsFrom; //per source domain
+            uint64_t queuedRequests; //requests reported by components that model queues
+            uint64_t queueDelayCycles;
+
+#if RECORD_EVENT_STREAMS
+            FILE* streamFile;
+#endif
+
 #if PROFILE_CROSSINGS
             VectorCounter profIncomingCrossingSims;
             VectorCounter profIncomingCrossings;
@@ -120,6 +146,31 @@ class ContentionSim : public GlobAlloc {
 
         volatile bool inCSim; //true when inside contention simulation
 
+        uint64_t lastPhaseMaxSkew; //largest delay added to a core by the last weave phase
+
+        //Weave sampling (sim.weaveSamplePeriod): only one in every weaveSamplePeriod phases records events
+        //and runs the weave; the others skew cores by the delay their SkewPredictor expects
+        uint32_t weaveSamplePeriod;
+        double skewAlpha;
+        bool skipWeave; //true if the current phase records no events
+
+        Counter profSampledPhases;
+        Counter profSkippedPhases;
+        Counter profSkewCycles;
+        Counter profPredSkewCycles;
+        Counter profPredErrorCycles;
+        Counter profCorrectionCycles;
+
+        //Domain tuning (sim.tuneDomains): at the end of the simulation, propose a placement of this run's
+        //domains on tuneDomains domains (see DomainTuner)
+        uint32_t tuneDomains;
+        g_vector<uint32_t> slotDomains; //domain of each placement slot (see PlaceDomain() in init.cpp)
+
+        //runParallel() state; the sim threads run curTask's items instead of a weave phase when it is set
+        ParallelTask* volatile curTask;
+        volatile uint32_t curTaskItems;
+        volatile uint32_t nextTaskItem;
+
         PAD();
 
         //lock_t testLock;
@@ -128,6 +179,8 @@ class ContentionSim : public GlobAlloc {
     public:
         ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads);
 
+        void setWeaveSampling(uint32_t period, double alpha); //must be called before initStats
+        void setDomainTuning(uint32_t domains, const std::vector<uint32_t>& slots);
         void initStats(AggregateStat* parentStat);
 
         void postInit(); //must be called after the simulator is initialized
@@ -136,10 +189,23 @@ class ContentionSim : public GlobAlloc {
         void enqueueSynced(TimingEvent* ev, uint64_t cycle);
         void enqueueCrossing(CrossingEvent* ev, uint64_t cycle, uint32_t srcId, uint32_t srcDomain, uint32_t dstDomain, EventRecorder* evRec);
 
+        // Calls parentDone(startCycle) on all children of a finished event (weave phase only)
+        void wakeChildren(TimingEvent* ev, uint64_t startCycle);
+
         void simulatePhase(uint64_t limit);
 
+        /* Runs task->run(i) for every i in [0, numItems) on the sim threads and
+         * the caller, and returns when all items are done. Items must be
+         * independent. Only valid outside the weave phase (e.g., from
+         * end-of-phase events), when the sim threads are idle.
+         */
+        void runParallel(ParallelTask* task, uint32_t numItems);
+
         void finish();
 
+        //Called at the end of the simulation; writes the proposed placement if domain tuning is on
+        void proposeDomainMap();
+
         uint64_t getLastLimit() {return lastLimit;}
 
         uint64_t getCurCycle(uint32_t domain) {
@@ -151,6 +217,41 @@ class ContentionSim : public GlobAlloc {
 
         void setPrio(uint32_t domain, uint32_t prio) {domains[domain].prio = prio;}
 
+        //Use a timing wheel instead of a map for the domain's far-future events. Must be called before simulation starts.
+        void setFarWheel(uint32_t domain) {
+            assert(domain < numDomains);
+            domains[domain].pq.setFarWheel(true);
+        }
+
+        //Called by crossings on their destination domain, as they complete or are retried because the source lags
+        void recordCrossing(uint32_t srcDomain, uint32_t domain) {
+            domains[domain].crossings++;
+            domains[domain].crossingsFrom[srcDomain]++;
+        }
+        void recordCrossingRetry(uint32_t domain) {domains[domain].crossingRetries++;}
+
+        //Called by components that model request queues (e.g., DDRMemory) from their domain's sim thread, as requests complete
+        void recordQueueDelay(uint32_t domain, uint64_t cycles) {
+            domains[domain].queuedRequests++;
+            domains[domain].queueDelayCycles += cycles;
+        }
+
+        //Weave-phase measurements, only valid between phases
+        uint64_t getCrossings() const;
+        uint64_t getCrossingRetries() const;
+        uint64_t getQueuedRequests() const;
+        uint64_t getQueueDelayCycles() const;
+        uint64_t getLastPhaseMaxSkew() const {return lastPhaseMaxSkew;}
+
+        //Weave sampling, called by core recorders between phases
+        double getSkewAlpha() const {return skewAlpha;}
+        void reportSkewSample(uint64_t predicted, uint64_t measured) {
+            profSkewCycles.inc(measured);
+            profPredSkewCycles.inc(predicted);
+            profPredErrorCycles.inc((predicted > measured)? predicted - measured : measured - predicted);
+        }
+        void reportSkewCorrection(uint64_t cycles) {profCorrectionCycles.inc(cycles);}
+
 #if PROFILE_CROSSINGS
         void profileCrossing(uint32_t srcDomain, uint32_t dstDomain, uint32_t count) {
             domains[dstDomain].profIncomingCrossings.inc(srcDomain);
@@ -160,8 +261,18 @@ class ContentionSim : public GlobAlloc {
 #endif
 
     private:
+        inline void recordStream(uint32_t domain, uint64_t cycle, bool dequeue) {
+#if RECORD_EVENT_STREAMS
+            uint64_t rec = cycle | (dequeue? PQ_STREAM_DEQUEUE : 0);
+            fwrite(&rec, sizeof(rec), 1, domains[domain].streamFile);
+#endif
+        }
+
         void simThreadLoop(uint32_t thid);
         void simulatePhaseThread(uint32_t thid);
+        void runTaskItems();
+        void skipPhase();
+        void updateWeaveSampling();
 
         static void SimThreadTrampoline(void* arg);
 };
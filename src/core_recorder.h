@@ -28,6 +28,7 @@
 
 #include "event_recorder.h"
 #include "g_std/g_string.h"
+#include "skew_predictor.h"
 
 class TimingCoreEvent;
 
@@ -63,6 +64,8 @@ class CoreRecorder {
         uint64_t totalHaltedCycles; //does not include cycles since last transition to HALTED
         uint64_t lastUnhaltedCycle; //set on transition to HALTED
 
+        SkewPredictor skewPredictor; //used only with weave sampling
+
         uint32_t domain;
         g_string name;
 
@@ -81,6 +84,7 @@ class CoreRecorder {
         //Methods called between the bound and weave phases
         uint64_t cSimStart(uint64_t curCycle); //returns updated curCycle
         uint64_t cSimEnd(uint64_t curCycle); //returns updated curCycle
+        uint64_t cSimSkip(uint64_t curCycle); //instead of cSimStart/cSimEnd on phases that skip the weave; returns updated curCycle
 
         //Methods called in the weave phase
         inline void reportEventSimulated(TimingCoreEvent* ev);
@@ -56,34 +56,6 @@ class DDRMemoryAccEvent : public TimingEvent {
         }
 };
 
-// Globally allocated event that calls us every tREFI cycles
-class RefreshEvent : public TimingEvent, public GlobAlloc {
-    private:
-        DDRMemory* mem;
-        uint32_t refInterval;  // in sysCycles
-
-    public:
-        RefreshEvent(DDRMemory* _mem, uint32_t _refInterval, int32_t domain) :
-            TimingEvent(0, 0, domain), mem(_mem), refInterval(_refInterval)
-        {
-            setMinStartCycle(0);
-            zinfo->contentionSim->enqueueSynced(this, 0);
-        }
-
-        void parentDone(uint64_t startCycle) {
-            panic("This is queued directly");
-        }
-
-        void simulate(uint64_t startCycle) {
-            mem->refresh(startCycle);
-            requeue(startCycle + refInterval);
-        }
-
-        // Use glob mem
-        using GlobAlloc::operator new;
-        using GlobAlloc::operator delete;
-};
-
 /* Globally allocated event for scheduling
  *
  * NOTE: This event plus the bit of logic in DDRMemory that deals with event
@@ -101,6 +73,7 @@ class SchedEvent : public TimingEvent, public GlobAlloc {
 
         SchedEvent(DDRMemory* _mem, int32_t domain) : TimingEvent(0, 0, domain), mem(_mem) {
             setMinStartCycle(0);
+            setCustomParentDone();
             setRunning();
             hold();
             state = IDLE;
@@ -153,10 +126,10 @@ class SchedEvent : public TimingEvent, public GlobAlloc {
 DDRMemory::DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerChannel, uint32_t _banksPerRank,
         uint32_t _sysFreqMHz, const char* tech, const char* addrMapping, uint32_t _controllerSysLatency,
         uint32_t _queueDepth, uint32_t _rowHitLimit, bool _deferredWrites, bool _closedPage,
-        uint32_t _domain, g_string& _name)
+        bool _bankXor, uint32_t _domain, g_string& _name)
     : lineSize(_lineSize), ranksPerChannel(_ranksPerChannel), banksPerRank(_banksPerRank),
       controllerSysLatency(_controllerSysLatency), queueDepth(_queueDepth), rowHitLimit(_rowHitLimit),
-      deferredWrites(_deferredWrites), closedPage(_closedPage), domain(_domain), name(_name)
+      deferredWrites(_deferredWrites), closedPage(_closedPage), bankXor(_bankXor), domain(_domain), name(_name)
 {
     sysFreqKHz = 1000 * _sysFreqMHz;
     initTech(tech);  // sets all tXX and memFreqKHz
@@ -213,12 +186,16 @@ DDRMemory::DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerCh
     }
     rowShift = startBit;  // row has no mask
 
-    info("%s: Address mapping %s row %d:%ld col %d:%d rank %d:%d bank %d:%d",
+    info("%s: Address mapping %s row %d:%ld col %d:%d rank %d:%d bank %d:%d%s",
             name.c_str(), addrMapping, 63, rowShift, ilog2(colMask << colShift), colShift,
-            ilog2(rankMask << rankShift), rankShift, ilog2(bankMask << bankShift), bankShift);
+            ilog2(rankMask << rankShift), rankShift, ilog2(bankMask << bankShift), bankShift,
+            bankXor? " (bank XOR row)" : "");
 
-    // Weave phase events
-    new RefreshEvent(this, memToSysCycle(tREFI), domain);
+    // Refreshes are applied lazily (see catchUpRefreshes()), so they need no weave events
+    refInterval = memToSysCycle(tREFI);
+    nextRefreshSysCycle = 0;
+    // Folding idle refreshes relies on a refresh finishing before the next one is due
+    assert(tREFI > tRFC);
 
     nextSchedCycle = -1ul;
     nextSchedEvent = nullptr;
@@ -235,6 +212,8 @@ void DDRMemory::initStats(AggregateStat* parentStat) {
     profReadHits.init("rdhits", "Read row hits"); memStats->append(&profReadHits);
     profWriteHits.init("wrhits", "Write row hits"); memStats->append(&profWriteHits);
     latencyHist.init("mlh", "latency histogram for memory requests", NUMBINS); memStats->append(&latencyHist);
+    profRefreshes.init("refs", "Refreshes, all applied lazily instead of through weave events"); memStats->append(&profRefreshes);
+    profFoldedRefreshes.init("refsFolded", "Refreshes during idle intervals folded in closed form"); memStats->append(&profFoldedRefreshes);
     parentStat->append(memStats);
 }
 
@@ -285,6 +264,9 @@ DDRMemory::AddrLoc DDRMemory::mapLineAddr(Address lineAddr) {
     l.rank = (lineAddr >> rankShift) & rankMask;
     l.bank = (lineAddr >> bankShift) & bankMask;
     l.row  = lineAddr >> rowShift;
+    // XOR-ing with the row is a permutation of banks within each row, so the
+    // mapping stays 1:1, but rows that conflict on a bank get spread out
+    if (bankXor) l.bank ^= l.row & bankMask;
 
     //info("0x%lx r%ld:c%d b%d:r%d", lineAddr, l.row, l.col, l.bank, l.rank);
     assert(l.rank < ranksPerChannel);
@@ -294,6 +276,7 @@ DDRMemory::AddrLoc DDRMemory::mapLineAddr(Address lineAddr) {
 }
 
 void DDRMemory::enqueue(DDRMemoryAccEvent* ev, uint64_t sysCycle) {
+    catchUpRefreshes(sysCycle);
     uint64_t memCycle = sysToMemCycle(sysCycle);
     DEBUG("%ld: enqueue() addr 0x%lx wr %d", memCycle, ev->getAddr(), ev->isWrite());
 
@@ -424,6 +407,7 @@ void DDRMemory::queue(Request* req, uint64_t memCycle) {
 
 // For external ticks
 uint64_t DDRMemory::tick(uint64_t sysCycle) {
+    catchUpRefreshes(sysCycle);
     uint64_t memCycle = sysToMemCycle(sysCycle);
     assert_msg(memCycle == nextSchedCycle, "%ld != %ld", memCycle, nextSchedCycle);
 
@@ -612,6 +596,7 @@ uint64_t DDRMemory::trySchedule(uint64_t curCycle, uint64_t sysCycle) {
         uint32_t scDelay = doneSysCycle - r->startSysCycle;
         profReads.inc();
         profTotalRdLat.inc(scDelay);
+        zinfo->contentionSim->recordQueueDelay(domain, (scDelay > minRdLatency)? scDelay - minRdLatency : 0);
         if (rowHit) profReadHits.inc();
         uint32_t bucket = std::min(NUMBINS-1, scDelay/BINSIZE);
         latencyHist.inc(bucket, 1);
@@ -655,6 +640,41 @@ void DDRMemory::refresh(uint64_t sysCycle) {
     DEBUG("Refresh %ld start %ld done %ld", memCycle, minRefreshCycle, refreshDoneCycle);
 }
 
+/* Refreshes happen every refInterval sysCycles, but instead of waking up
+ * for each one, we apply the ones due by sysCycle whenever we next do work,
+ * so idle controllers generate no events. This is equivalent because
+ * refreshes only touch bank state, which we don't read between wakeups.
+ *
+ * Refreshes in an idle interval are analytically known: once a refresh
+ * starts at its due cycle (i.e., it's not delayed by earlier commands),
+ * every later one does too, since tREFI > tRFC, and each overwrites the
+ * bank state left by the previous one. So we apply the first due refresh,
+ * and if the next one is not delayed, skip straight to the last one.
+ */
+void DDRMemory::catchUpRefreshes(uint64_t sysCycle) {
+    while (nextRefreshSysCycle <= sysCycle) {
+        refresh(nextRefreshSysCycle);
+        profRefreshes.inc();
+        nextRefreshSysCycle += refInterval;
+
+        uint64_t pending = (nextRefreshSysCycle <= sysCycle)? (sysCycle - nextRefreshSysCycle)/refInterval + 1 : 0;
+        if (pending >= 2) {
+            uint64_t maxBankCycle = 0;
+            for (auto& rankBanks : banks) {
+                for (auto& bank : rankBanks) {
+                    maxBankCycle = std::max(maxBankCycle, std::max(bank.minPreCycle, bank.lastCmdCycle));
+                }
+            }
+            if (sysToMemCycle(nextRefreshSysCycle) >= maxBankCycle) {
+                uint64_t folded = pending - 1;
+                nextRefreshSysCycle += folded*refInterval;
+                profRefreshes.inc(folded);
+                profFoldedRefreshes.inc(folded);
+            }
+        }
+    }
+}
+
 
 /* Tech/Device timing parameters */
 
@@ -732,3 +752,54 @@ void DDRMemory::initTech(const char* techName) {
     memFreqKHz = (uint64_t)(1e9/tCK/1e3);
 }
 
+
+
+/* Multi-channel controller */
+
+MultiChannelDDRMemory::MultiChannelDDRMemory(const g_vector<DDRMemory*>& _channels, uint32_t interleaveLines, bool _xorHash, const g_string& _name)
+    : channels(_channels), name(_name), interleaveShift(ilog2(interleaveLines)), xorHash(_xorHash), pow2Channels(isPow2(_channels.size()))
+{
+    assert(channels.size() > 1);
+    if (!isPow2(interleaveLines)) panic("%s: channel interleaving (%d lines) must be a power of 2", name.c_str(), interleaveLines);
+    if (xorHash && !pow2Channels) panic("%s: XOR channel hashing needs a power-of-2 number of channels, have %ld", name.c_str(), channels.size());
+    chBits = pow2Channels? ilog2((uint32_t)channels.size()) : 0;
+    chMask = pow2Channels? channels.size() - 1 : 0;
+    info("%s: %ld channels, interleaved every %d lines, %s channel selection",
+            name.c_str(), channels.size(), interleaveLines, xorHash? "XOR-hashed" : "direct");
+}
+
+uint32_t MultiChannelDDRMemory::mapChannel(Address lineAddr, Address& chAddr) const {
+    Address low = lineAddr & ((1ul << interleaveShift) - 1);
+    Address chunk = lineAddr >> interleaveShift;
+    uint32_t ch;
+    Address upper;
+    if (pow2Channels) {
+        ch = chunk & chMask;
+        upper = chunk >> chBits;
+        if (xorHash) {
+            // Fold all upper bits onto the channel bits. Given upper, this is
+            // a permutation of channels, so chAddr stays unique per channel
+            for (Address u = upper; u; u >>= chBits) ch ^= u & chMask;
+        }
+    } else {
+        // Non-power-of-2 channels, same as SplitAddrMemory
+        ch = chunk % channels.size();
+        upper = chunk / channels.size();
+    }
+    chAddr = (upper << interleaveShift) | low;
+    return ch;
+}
+
+uint64_t MultiChannelDDRMemory::access(MemReq& req) {
+    Address addr = req.lineAddr;
+    Address chAddr;
+    uint32_t ch = mapChannel(addr, chAddr);
+    req.lineAddr = chAddr;
+    uint64_t respCycle = channels[ch]->access(req);
+    req.lineAddr = addr;
+    return respCycle;
+}
+
+void MultiChannelDDRMemory::initStats(AggregateStat* parentStat) {
+    for (auto ch : channels) ch->initStats(parentStat);
+}
@@ -192,6 +192,7 @@ class DDRMemory : public MemObject {
         const uint32_t rowHitLimit; // row hits not prioritized in FR-FCFS beyond this point
         const bool deferredWrites;
         const bool closedPage;
+        const bool bankXor;  // permutation-based interleaving: XOR bank bits with low row bits
         const uint32_t domain;
 
         // DRAM timing parameters -- initialized in initTech()
@@ -225,6 +226,10 @@ class DDRMemory : public MemObject {
         g_vector< g_vector<Bank> > banks; // indexed by rank, bank
         g_vector<ActWindow> rankActWindows;
 
+        // Lazy refreshes
+        uint64_t refInterval;  // in sysCycles
+        uint64_t nextRefreshSysCycle;
+
         // Event scheduling
         SchedEvent* nextSchedEvent;
         uint64_t nextSchedCycle;
@@ -237,6 +242,7 @@ class DDRMemory : public MemObject {
         Counter profReads, profWrites;
         Counter profTotalRdLat, profTotalWrLat;
         Counter profReadHits, profWriteHits;  // row buffer hits
+        Counter profRefreshes, profFoldedRefreshes;
         VectorCounter latencyHist;
         static const uint32_t BINSIZE = 10, NUMBINS = 100;
         PAD();
@@ -261,7 +267,7 @@ class DDRMemory : public MemObject {
         DDRMemory(uint32_t _lineSize, uint32_t _colSize, uint32_t _ranksPerChannel, uint32_t _banksPerRank,
             uint32_t _sysFreqMHz, const char* tech, const char* addrMapping, uint32_t _controllerSysLatency,
             uint32_t _queueDepth, uint32_t _rowHitLimit, bool _deferredWrites, bool _closedPage,
-            uint32_t _domain, g_string& _name);
+            bool _bankXor, uint32_t _domain, g_string& _name);
 
         void initStats(AggregateStat* parentStat);
         const char* getName() {return name.c_str();}
@@ -271,7 +277,6 @@ class DDRMemory : public MemObject {
 
         // Weave phase interface
         void enqueue(DDRMemoryAccEvent* ev, uint64_t cycle);
-        void refresh(uint64_t sysCycle);
 
         // Scheduling event interface
         uint64_t tick(uint64_t sysCycle);
@@ -282,11 +287,40 @@ class DDRMemory : public MemObject {
 
         void queue(Request* req, uint64_t memCycle);
 
+        void refresh(uint64_t sysCycle);
+        void catchUpRefreshes(uint64_t sysCycle);
+
         inline uint64_t trySchedule(uint64_t curCycle, uint64_t sysCycle);
         uint64_t findMinCmdCycle(const Request& r) const;
 
         void initTech(const char* tech);
 };
 
+/* Multi-channel controller. Each channel is a full DDRMemory with its own
+ * weave domain, so channels are simulated in parallel by the contention
+ * threads. Lines are interleaved across channels in chunks of
+ * interleaveLines; with xorHash, the channel index is XOR-folded with all the
+ * upper address bits to spread power-of-2 strides across channels. Each
+ * channel sees a dense address space, with the channel bits removed.
+ */
+class MultiChannelDDRMemory : public MemObject {
+    private:
+        const g_vector<DDRMemory*> channels;
+        const g_string name;
+        const uint32_t interleaveShift;  // log2(interleaveLines)
+        const bool xorHash;
+        const bool pow2Channels;
+        uint32_t chBits, chMask;
+
+    public:
+        MultiChannelDDRMemory(const g_vector<DDRMemory*>& _channels, uint32_t interleaveLines, bool _xorHash, const g_string& _name);
+
+        uint64_t access(MemReq& req);
+        const char* getName() {return name.c_str();}
+        void initStats(AggregateStat* parentStat);
+
+        // Returns the channel and the address within that channel for lineAddr
+        uint32_t mapChannel(Address lineAddr, Address& chAddr) const;
+};
 
 #endif  // DDR_MEM_H_
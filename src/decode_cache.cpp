@@ -0,0 +1,345 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decode_cache.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <stdio.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bithacks.h"
+#include "core.h"
+#include "decoder.h"
+#include "log.h"
+#include "profile_stats.h"
+#include "version.h" //autogenerated, in build dir, see SConstruct
+#include "zsim.h"
+
+/* On-disk format: a FileHeader followed by FileEntry records, each followed by objBytes of BblInfo padded to
+ * 8 bytes. BblInfo and DynBbl are POD, so they are stored raw. Decoding depends on the decoder and Pin's register
+ * numbering, so files are only valid for the zsim build that wrote them.
+ */
+
+#define DECODE_CACHE_MAGIC 0x4c42424345445a53L  // "SZDECBBL"
+
+struct FileHeader {
+    uint64_t magic;
+    uint64_t buildHash;
+    uint32_t oooDecode;
+    uint32_t pad;
+    uint64_t entries;
+};
+
+struct FileEntry {
+    uint64_t imgId;
+    uint64_t offset;
+    uint32_t bytes;
+    uint32_t objBytes;
+};
+
+static inline uint32_t paddedBytes(uint32_t bytes) {
+    return (bytes + 7) & ~7;
+}
+
+static uint64_t buildHash() {
+    const char* version = ZSIM_BUILDVERSION;
+    return _Fnv_hash_bytes(version, strlen(version), 0xDEC0DE);
+}
+
+/* Process-local image tracking */
+
+struct ImageRange {
+    uint64_t low;
+    uint64_t high;  // inclusive
+    uint64_t id;  // 0 if we could not identify the image
+};
+
+static std::map<uint64_t, ImageRange> images;  // low addr -> range; accessed only under Pin's client lock
+
+// Returns 0 if the image can't be identified (e.g., it's not backed by a file)
+static uint64_t ComputeImageId(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = st.st_size;
+    const char* base = static_cast<const char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (base == MAP_FAILED) return 0;
+
+    // Look for the GNU build-id note
+    uint64_t id = 0;
+    const Elf64_Ehdr* eh = reinterpret_cast<const Elf64_Ehdr*>(base);
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 && eh->e_ident[EI_CLASS] == ELFCLASS64 &&
+            eh->e_shoff + eh->e_shnum*sizeof(Elf64_Shdr) <= size) {
+        const Elf64_Shdr* sh = reinterpret_cast<const Elf64_Shdr*>(base + eh->e_shoff);
+        for (uint32_t i = 0; i < eh->e_shnum && !id; i++) {
+            if (sh[i].sh_type != SHT_NOTE || sh[i].sh_offset + sh[i].sh_size > size) continue;
+            const char* p = base + sh[i].sh_offset;
+            const char* end = p + sh[i].sh_size;
+            while (p + sizeof(Elf64_Nhdr) <= end) {
+                const Elf64_Nhdr* nh = reinterpret_cast<const Elf64_Nhdr*>(p);
+                const char* name = p + sizeof(Elf64_Nhdr);
+                const char* desc = name + ((nh->n_namesz + 3) & ~3);
+                const char* next = desc + ((nh->n_descsz + 3) & ~3);
+                if (next > end) break;
+                if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+                    id = _Fnv_hash_bytes(desc, nh->n_descsz, 0xB1D);
+                    break;
+                }
+                p = next;
+            }
+        }
+    }
+    munmap(const_cast<char*>(base), size);
+
+    if (!id) {
+        // No build-id, fall back to path, size and mtime
+        id = _Fnv_hash_bytes(path, strlen(path), 0xF11E);
+        id = _Fnv_hash_bytes(&st.st_size, sizeof(st.st_size), id);
+        id = _Fnv_hash_bytes(&st.st_mtime, sizeof(st.st_mtime), id);
+    }
+    return id? id : 1;  // 0 is reserved
+}
+
+VOID DecodeCache::imageLoad(IMG img, VOID* v) {
+    ImageRange r;
+    r.low = IMG_LowAddress(img);
+    r.high = IMG_HighAddress(img);
+    r.id = ComputeImageId(IMG_Name(img).c_str());
+    if (!r.id) info("Decode cache: can't identify image %s, its BBLs will not be cached", IMG_Name(img).c_str());
+    images[r.low] = r;
+}
+
+VOID DecodeCache::imageUnload(IMG img, VOID* v) {
+    images.erase(IMG_LowAddress(img));
+}
+
+/* DecodeCache */
+
+DecodeCache::DecodeCache(const char* _file, bool _oooDecode, uint32_t _numBuckets)
+    : numBuckets(_numBuckets), file(_file? gm_strdup(_file) : nullptr), oooDecode(_oooDecode)
+{
+    if (!isPow2(numBuckets)) panic("Decode cache buckets (%d) must be a power of 2", numBuckets);
+    buckets = gm_calloc<Entry*>(numBuckets);
+}
+
+void DecodeCache::initStats(AggregateStat* parentStat) {
+    AggregateStat* dcStats = new AggregateStat();
+    dcStats->init("decodeCache", "Decoded BBL cache stats");
+    profHits.init("hits", "BBLs found decoded"); dcStats->append(&profHits);
+    profSharedHits.init("sharedHits", "BBLs found decoded by another process"); dcStats->append(&profSharedHits);
+    profMisses.init("misses", "BBLs decoded and inserted"); dcStats->append(&profMisses);
+    profUncacheable.init("uncacheable", "BBLs decoded outside of any identifiable image"); dcStats->append(&profUncacheable);
+    profLoaded.init("loaded", "Decoded BBLs loaded from file"); dcStats->append(&profLoaded);
+    profDecodeNs.init("decodeNs", "Time spent decoding cacheable BBLs (ns)"); dcStats->append(&profDecodeNs);
+    profLoadNs.init("loadNs", "Time spent loading the cache file (ns)"); dcStats->append(&profLoadNs);
+    parentStat->append(dcStats);
+
+    // Done here so that stats are initialized
+    if (file) load();
+}
+
+DecodeCache::Entry* DecodeCache::find(Entry* head, Entry* stop, uint64_t imgId, uint64_t offset, uint32_t bytes) {
+    for (Entry* e = head; e != stop; e = e->next) {
+        if (e->imgId == imgId && e->offset == offset && e->bytes == bytes) return e;
+    }
+    return nullptr;
+}
+
+/* Entries are fully initialized before being published by the CAS (which is a full barrier), and are never
+ * modified or removed afterwards, so readers can walk chains without synchronization. If the CAS fails, only the
+ * entries prepended since our last look need to be checked for a racing insertion of the same key.
+ */
+BblInfo* DecodeCache::insert(uint64_t imgId, uint64_t offset, uint32_t bytes, uint32_t objBytes, uint32_t procIdx, BblInfo* bblInfo) {
+    Entry* e = gm_malloc<Entry>();
+    e->imgId = imgId;
+    e->offset = offset;
+    e->bytes = bytes;
+    e->objBytes = objBytes;
+    e->procIdx = procIdx;
+    e->bblInfo = bblInfo;
+
+    Entry* volatile* bucket = &buckets[bucketIdx(imgId, offset, bytes)];
+    Entry* head = *bucket;
+    Entry* checked = nullptr;
+    while (true) {
+        Entry* other = find(head, checked, imgId, offset, bytes);
+        if (other) {
+            // Another process decoded it first; use theirs
+            gm_free(e);
+            gm_free(bblInfo);
+            return other->bblInfo;
+        }
+        e->next = head;
+        Entry* prev = __sync_val_compare_and_swap(bucket, head, e);
+        if (prev == head) return bblInfo;
+        checked = head;
+        head = prev;
+    }
+}
+
+BblInfo* DecodeCache::get(BBL bbl) {
+    uint64_t addr = BBL_Address(bbl);
+    uint32_t bytes = BBL_Size(bbl);
+
+    uint64_t imgId = 0;
+    uint64_t offset = 0;
+    std::map<uint64_t, ImageRange>::iterator it = images.upper_bound(addr);
+    if (it != images.begin()) {
+        it--;
+        const ImageRange& r = it->second;
+        if (addr + bytes - 1 <= r.high) {
+            imgId = r.id;
+            offset = addr - r.low;
+        }
+    }
+
+#ifdef BBL_PROFILING
+    imgId = 0;  // profiling needs a bblIdx per decoding, don't cache
+#endif
+
+    if (!imgId) {
+        profUncacheable.atomicInc();
+        return Decoder::decodeBbl(bbl, oooDecode);
+    }
+
+    Entry* e = find(buckets[bucketIdx(imgId, offset, bytes)], nullptr, imgId, offset, bytes);
+    if (e && e->bblInfo->instrs == BBL_NumIns(bbl)) {
+        profHits.atomicInc();
+        if (e->procIdx != procIdx) profSharedHits.atomicInc();
+        return e->bblInfo;
+    }
+
+    uint64_t startNs = getNs();
+    BblInfo* bblInfo = Decoder::decodeBbl(bbl, oooDecode);
+    profDecodeNs.atomicInc(getNs() - startNs);
+    profMisses.atomicInc();
+    if (e) return bblInfo;  // key collision with different instrs (should not happen), don't cache
+
+    uint32_t objBytes = oooDecode? offsetof(BblInfo, oooBbl) + DynBbl::bytes(bblInfo->oooBbl[0].uops) : sizeof(BblInfo);
+    return insert(imgId, offset, bytes, objBytes, procIdx, bblInfo);
+}
+
+void DecodeCache::load() {
+    uint64_t startNs = getNs();
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        info("Decode cache file %s not found, will write it at the end of the simulation", file);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+        warn("Decode cache file %s is truncated, ignoring it", file);
+        close(fd);
+        return;
+    }
+
+    size_t size = st.st_size;
+    const char* base = static_cast<const char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (base == MAP_FAILED) {
+        warn("Could not mmap decode cache file %s, ignoring it", file);
+        return;
+    }
+
+    const FileHeader* hdr = reinterpret_cast<const FileHeader*>(base);
+    if (hdr->magic != DECODE_CACHE_MAGIC || hdr->buildHash != buildHash() || hdr->oooDecode != oooDecode) {
+        warn("Decode cache file %s was written by a different zsim build or configuration, ignoring it", file);
+        munmap(const_cast<char*>(base), size);
+        return;
+    }
+
+    const char* p = base + sizeof(FileHeader);
+    const char* end = base + size;
+    uint64_t loaded = 0;
+    for (uint64_t i = 0; i < hdr->entries; i++) {
+        const FileEntry* fe = reinterpret_cast<const FileEntry*>(p);
+        if (p + sizeof(FileEntry) > end || p + sizeof(FileEntry) + fe->objBytes > end) {
+            warn("Decode cache file %s is truncated, loaded %ld/%ld entries", file, loaded, hdr->entries);
+            break;
+        }
+        BblInfo* bblInfo = static_cast<BblInfo*>(gm_malloc(fe->objBytes));
+        memcpy(bblInfo, p + sizeof(FileEntry), fe->objBytes);
+        insert(fe->imgId, fe->offset, fe->bytes, fe->objBytes, (uint32_t)-1, bblInfo);
+        p += sizeof(FileEntry) + paddedBytes(fe->objBytes);
+        loaded++;
+    }
+    munmap(const_cast<char*>(base), size);
+
+    profLoaded.inc(loaded);
+    profLoadNs.inc(getNs() - startNs);
+    info("Loaded %ld decoded BBLs from %s in %ld ms", loaded, file, (getNs() - startNs)/1000000);
+}
+
+void DecodeCache::save() {
+    if (!file) return;  // not persistent, just shared
+    if (!profMisses.get()) return;  // nothing new
+
+    // Write to a temp file and rename, so concurrent runs never see a partial file
+    std::string tmpFile = std::string(file) + ".tmp." + std::to_string((long long)getpid());
+    FILE* f = fopen(tmpFile.c_str(), "w");
+    if (!f) {
+        warn("Could not open %s, decode cache not saved", tmpFile.c_str());
+        return;
+    }
+
+    FileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DECODE_CACHE_MAGIC;
+    hdr.buildHash = buildHash();
+    hdr.oooDecode = oooDecode;
+    for (uint32_t b = 0; b < numBuckets; b++) {
+        for (Entry* e = buckets[b]; e; e = e->next) hdr.entries++;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    const uint64_t zeros = 0;
+    for (uint32_t b = 0; b < numBuckets && ok; b++) {
+        for (Entry* e = buckets[b]; e && ok; e = e->next) {
+            FileEntry fe = {e->imgId, e->offset, e->bytes, e->objBytes};
+            ok &= fwrite(&fe, sizeof(fe), 1, f) == 1;
+            ok &= fwrite(e->bblInfo, e->objBytes, 1, f) == 1;
+            uint32_t pad = paddedBytes(e->objBytes) - e->objBytes;
+            if (pad) ok &= fwrite(&zeros, pad, 1, f) == 1;
+        }
+    }
+
+    ok &= fclose(f) == 0;
+    if (!ok || rename(tmpFile.c_str(), file) != 0) {
+        warn("Error writing decode cache to %s", file);
+        unlink(tmpFile.c_str());
+        return;
+    }
+    info("Wrote %ld decoded BBLs to %s", hdr.entries, file);
+}
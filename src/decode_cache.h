@@ -0,0 +1,107 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DECODE_CACHE_H_
+#define DECODE_CACHE_H_
+
+#include <stdint.h>
+#include "galloc.h"
+#include "pin.H"
+#include "stats.h"
+
+struct BblInfo;
+
+/* Cache of decoded BBLs, kept in the global heap and optionally persisted across runs.
+ *
+ * Decoding a BBL (XED queries, uop emission and decode-stage modeling) is expensive, and large binaries
+ * spend a long warm-up doing it. Instead of decoding each BBL in every process of every run, we key
+ * decoded BblInfos by (image id, offset of the BBL within the image, BBL size). The image id is derived
+ * from the ELF build-id (or from path, size and mtime for images without one), so entries are valid
+ * across processes, across ASLR, and across runs of the same binaries. Code outside of any image (e.g.,
+ * JIT'd code or the vDSO) is always decoded and never cached.
+ *
+ * The table is a lock-free chained hash table: entries are immutable once published, and are prepended to
+ * their bucket with a CAS, so lookups never block and processes of a multiprocess run that share binaries
+ * reuse each other's decoding (and memory) instead of decoding each BBL once per process.
+ *
+ * If a file is given, it is mmap'd and loaded at initialization, and all entries are written back to it
+ * when the simulation ends, so repeated sweeps over the same binaries skip decoding.
+ *
+ * NOTE: DynBbl::addr in a cached entry is the address the BBL had in the process that decoded it.
+ */
+class DecodeCache : public GlobAlloc {
+    private:
+        struct Entry {
+            uint64_t imgId;
+            uint64_t offset;
+            uint32_t bytes;  // BBL bytes, part of the key (BBLs are trace-dependent, a BBL may be cut short)
+            uint32_t objBytes;  // size of bblInfo
+            uint32_t procIdx;  // process that decoded it, -1 if loaded from file
+            BblInfo* bblInfo;
+            Entry* next;
+        };
+
+        Entry* volatile* buckets;
+        uint32_t numBuckets;  // power of 2
+
+        const char* file;  // nullptr if not persistent
+        const bool oooDecode;
+
+        Counter profHits;
+        Counter profSharedHits;
+        Counter profMisses;
+        Counter profUncacheable;
+        Counter profLoaded;
+        Counter profDecodeNs;
+        Counter profLoadNs;
+
+    public:
+        DecodeCache(const char* _file, bool _oooDecode, uint32_t _numBuckets);
+        void initStats(AggregateStat* parentStat);
+
+        // Process-local image tracking, call from IMG load/unload callbacks
+        static VOID imageLoad(IMG img, VOID* v);
+        static VOID imageUnload(IMG img, VOID* v);
+
+        // Returns the (shared) decoded BblInfo for this BBL, decoding it if needed
+        BblInfo* get(BBL bbl);
+
+        // Writes all entries to the file, if any. Call once, when all processes are done.
+        void save();
+
+    private:
+        void load();
+
+        inline uint32_t bucketIdx(uint64_t imgId, uint64_t offset, uint32_t bytes) const {
+            uint64_t h = (imgId ^ (offset * 0x9E3779B97F4A7C15L) ^ bytes);
+            return (h ^ (h >> 29)) & (numBuckets - 1);
+        }
+
+        // Searches [head, stop) in the bucket chain
+        Entry* find(Entry* head, Entry* stop, uint64_t imgId, uint64_t offset, uint32_t bytes);
+        BblInfo* insert(uint64_t imgId, uint64_t offset, uint32_t bytes, uint32_t objBytes, uint32_t procIdx, BblInfo* bblInfo);
+};
+
+#endif  // DECODE_CACHE_H_
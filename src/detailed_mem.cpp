@@ -116,7 +116,7 @@ void MemRankBase::SaveBackgroundCycles(void) {
 MemChannelBase::MemChannelBase(uint32_t _myId, MemParam *_mParam) {
     myId = _myId;
     mParam = _mParam;
-    accessLog.reserve(mParam->accessLogDepth);
+    accessLog.init(mParam->accessLogDepth);
 
     uint32_t rankCount = mParam->rankCount;
     ranks.resize(rankCount);
@@ -135,6 +135,12 @@ bool MemChannelBase::IsRowBufferHit(uint32_t row, uint32_t rank, uint32_t bank)
     return ((ranks[rank]->GetBankOpen(bank) == true) && (ranks[rank]->GetLastRow(bank) == row));
 }
 
+bool MemChannelBase::GetOpenRow(uint32_t rank, uint32_t bank, uint32_t& row) {
+    if (!ranks[rank]->GetBankOpen(bank)) return false;
+    row = ranks[rank]->GetLastRow(bank);
+    return true;
+}
+
 
 uint32_t MemChannelBase::UpdateRefreshNum(uint32_t rank, uint64_t arrivalCycle) {
     //////////////////////////////////////////////////////////////////////
@@ -195,13 +201,7 @@ uint64_t MemChannelBase::UpdateLastRefreshCycle(uint32_t rank, uint64_t arrivalC
 }
 
 void MemChannelBase::UpdateDataBusCycle(uint64_t start, uint64_t end) {
-    std::pair<uint64_t, uint64_t> tmpPair = std::make_pair(start, end);
-    accessLog.push_back(tmpPair);
-    sort(accessLog.begin(), accessLog.end());
-    if (accessLog.size() > mParam->accessLogDepth) {
-        accessLog.erase(accessLog.begin());
-        accessLog[0].first = 0;
-    }
+    accessLog.insert(start, end);
 }
 
 uint64_t MemChannelBase::CalcIntraIssueCycle(bool rowHit, uint32_t rank, MemAccessType type, uint64_t arrivalCycle, uint32_t refreshNum) {
@@ -843,7 +843,10 @@ uint64_t MemChannelBase::GetBackGroundEnergy(uint64_t memCycle, uint64_t lastMem
 ////////////////////////////////////////////////////////////////////////
 // Default Memory Scheduler Class
 MemSchedulerDefault::MemSchedulerDefault(uint32_t id, MemParam* mParam, MemChannelBase* mChnl)
-    : MemSchedulerBase(id, mParam, mChnl)
+    : MemSchedulerBase(id, mParam, mChnl),
+      rdQueue(mParam->rankCount, mParam->bankCount, false),
+      wrQueue(mParam->rankCount, mParam->bankCount, true),
+      wrDoneQueue(mParam->rankCount, mParam->bankCount, true)
 {
     prioritizedAccessType = READ;
     wrQueueSize = mParam->schedulerQueueCount;
@@ -853,44 +856,48 @@ MemSchedulerDefault::MemSchedulerDefault(uint32_t id, MemParam* mParam, MemChann
 
 MemSchedulerDefault::~MemSchedulerDefault() {}
 
+void MemSchedulerDefault::Enqueue(MemSchedQueue& queue, MemAccessEventBase* ev, Address addr) {
+    uint32_t row, col, rank, bank;
+    mChnl->AddressMap(addr, row, col, rank, bank);
+    queue.push_back(ev, addr, row, rank, bank);
+}
+
 bool MemSchedulerDefault::CheckSetEvent(MemAccessEventBase* ev) {
+    Address addr = ev->getAddr();
+
     // Write Queue Hit Check
-    g_vector<MemSchedQueueElem>::iterator it;
-    for(it = wrQueue.begin(); it != wrQueue.end(); it++) {
-        if (it->second == ev->getAddr()) {
-            if (ev->getType() == WRITE) {
-                wrQueue.erase(it);
-                wrQueue.push_back(MemSchedQueueElem(nullptr, ev->getAddr()));
-            }
-            return true;
+    MemSchedQueue::Entry* e = wrQueue.find(addr);
+    if (e) {
+        if (ev->getType() == WRITE) {
+            wrQueue.remove(e);
+            Enqueue(wrQueue, nullptr, addr);
         }
+        return true;
     }
 
     // Write Done Queue Hit Check
-    for(it = wrDoneQueue.begin(); it != wrDoneQueue.end(); it++) {
-        if (it->second == ev->getAddr()) {
-            if (ev->getType() == READ) {
-                // Update LRU
-                wrDoneQueue.erase(it);
-                wrDoneQueue.push_back(MemSchedQueueElem(nullptr, ev->getAddr()));
-            } else { // Write
-                // Update for New Data
-                wrDoneQueue.erase(it);
-                wrQueue.push_back(MemSchedQueueElem(nullptr, ev->getAddr()));
-            }
-            return true;
+    e = wrDoneQueue.find(addr);
+    if (e) {
+        wrDoneQueue.remove(e);
+        if (ev->getType() == READ) {
+            // Update LRU
+            Enqueue(wrDoneQueue, nullptr, addr);
+        } else { // Write
+            // Update for New Data
+            Enqueue(wrQueue, nullptr, addr);
         }
+        return true;
     }
 
     // No Hit
     if (ev->getType() == READ) {
-        rdQueue.push_back(MemSchedQueueElem(ev, ev->getAddr()));
+        Enqueue(rdQueue, ev, addr);
     } else { // Write
-        wrQueue.push_back(MemSchedQueueElem(nullptr, ev->getAddr()));
+        Enqueue(wrQueue, nullptr, addr);
         if (wrQueue.size() + wrDoneQueue.size() == wrQueueSize) {
             // Overflow case
             if (wrDoneQueue.empty() == false) {
-                wrDoneQueue.erase(wrDoneQueue.begin());
+                wrDoneQueue.remove(wrDoneQueue.front());
             } else {
                 // FIXME: Need to handle this - HK
                 warn("Write Buffer Overflow!!");
@@ -912,50 +919,41 @@ bool MemSchedulerDefault::GetEvent(MemAccessEventBase*& ev, Address& addr, MemAc
     //info("Id%d: Read Queue = %ld, Write Queue = %ld, Schedule = %d",
     //myId, rdQueue.size(), wrQueue.size(), prioritizedAccessType);
 
-    uint32_t idx;
-    g_vector<MemSchedQueueElem>::iterator it;
+    MemSchedQueue::Entry* e;
     if (prioritizedAccessType == READ) {
-        bRet = FindBestRequest(&rdQueue, idx);
-        if (bRet) {
-            it = rdQueue.begin() + idx;
-            ev = it->first;
+        e = FindBestRequest(rdQueue);
+        if (e) {
+            ev = e->ev;
             addr = ev->getAddr();
             type = ev->getType();
-            rdQueue.erase(it);
+            rdQueue.remove(e);
+            bRet = true;
         }
     }
 
     if (!bRet) { // Write Priority or No Read Entry
-        bRet = FindBestRequest(&wrQueue, idx);
-        if (bRet) {
-            it = wrQueue.begin() + idx;
+        e = FindBestRequest(wrQueue);
+        if (e) {
             ev = nullptr;
-            addr = it->second;
+            addr = e->addr;
             type = WRITE;
-            wrQueue.erase(it);
-            wrDoneQueue.push_back(MemSchedQueueElem(nullptr, addr));
+            wrQueue.remove(e);
+            Enqueue(wrDoneQueue, nullptr, addr);
+            bRet = true;
         }
     }
 
     return bRet;
 }
 
-bool MemSchedulerDefault::FindBestRequest(g_vector<MemSchedQueueElem> *queue, uint32_t& idx) {
-    idx = 0;
-    uint32_t tmpIdx = 0;
-    g_vector<MemSchedQueueElem>::iterator it;
-    for(it = queue->begin(); it!= queue->end(); it++) {
-        Address addr = it->second;
-        uint32_t row, col, rank, bank;
-        mChnl->AddressMap(addr, row, col, rank, bank);
-        if (mChnl->IsRowBufferHit(row, rank, bank) == true) {
-            idx = tmpIdx;
-            break;
-        }
-        tmpIdx++;
-    }
-
-    return !queue->empty();
+// FR-FCFS: oldest request that hits in an open row, or the oldest request if there are no row hits
+MemSchedQueue::Entry* MemSchedulerDefault::FindBestRequest(MemSchedQueue& queue) {
+    if (queue.empty()) return nullptr;
+    MemChannelBase* chnl = mChnl;
+    MemSchedQueue::Entry* e = queue.oldestRowHit([chnl](uint32_t rank, uint32_t bank, uint32_t& row) {
+        return chnl->GetOpenRow(rank, bank, row);
+    });
+    return e? e : queue.front();
 }
 
 
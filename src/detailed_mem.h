@@ -27,6 +27,7 @@
 #define DETAILED_MEM_H_
 
 #include "detailed_mem_params.h"
+#include "detailed_mem_queue.h"
 #include "g_std/g_string.h"
 #include "memory_hierarchy.h"
 #include "stats.h"
@@ -135,6 +136,53 @@ class MemRankBase : public GlobAlloc {
         void SetFAWCycle(uint64_t cycle) { assert(tFAWCycle[tFAWIndex] <= cycle); tFAWCycle[tFAWIndex++] = cycle; tFAWIndex %= 4; }
 };
 
+/* Data bus occupancy log: the latest depth (start, end) cycle pairs, sorted.
+ * Kept as a ring buffer with insertion from the back. Bus slots are mostly
+ * claimed in increasing order, so an insert usually moves nothing, instead of
+ * re-sorting the whole log on every access.
+ */
+class MemAccessLog {
+    private:
+        typedef std::pair<uint64_t, uint64_t> Slot;
+        Slot* buf;
+        uint32_t depth;
+        uint32_t cap;  // depth + 1, we briefly hold one extra entry on inserts
+        uint32_t head;
+        uint32_t count;
+
+        Slot& at(uint32_t i) { return buf[(head + i) % cap]; }
+
+    public:
+        MemAccessLog() : buf(nullptr), depth(0), cap(0), head(0), count(0) {}
+
+        void init(uint32_t _depth) {
+            depth = _depth;
+            cap = depth + 1;
+            buf = gm_calloc<Slot>(cap);
+            head = 0;
+            count = 0;
+        }
+
+        uint32_t size() const { return count; }
+        const Slot& operator[](uint32_t i) const { return buf[(head + i) % cap]; }
+
+        void insert(uint64_t start, uint64_t end) {
+            Slot s(start, end);
+            uint32_t i = count++;
+            while (i > 0 && s < at(i - 1)) {
+                at(i) = at(i - 1);
+                i--;
+            }
+            at(i) = s;
+            if (count > depth) {
+                // Drop the oldest entry; the new oldest one is treated as open-ended
+                head = (head + 1) % cap;
+                count--;
+                if (count) at(0).first = 0;
+            }
+        }
+};
+
 // DRAM channel base class
 class MemChannelBase : public GlobAlloc {
     protected:
@@ -142,7 +190,7 @@ class MemChannelBase : public GlobAlloc {
         MemParam *mParam;
 
         g_vector <MemRankBase*> ranks;
-        std::vector<std::pair<uint64_t, uint64_t> > accessLog;
+        MemAccessLog accessLog;
 
         virtual uint32_t UpdateRefreshNum(uint32_t rank, uint64_t arrivalCycle);
         virtual uint64_t UpdateLastRefreshCycle(uint32_t rank, uint64_t arrivalCycle, uint32_t refreshNum);
@@ -168,6 +216,7 @@ class MemChannelBase : public GlobAlloc {
         virtual uint64_t LatencySimulate(Address lineAddr, uint64_t arrivalCycle, uint64_t lastPhaseCycle, MemAccessType type);
         virtual void AddressMap(Address addr, uint32_t& row, uint32_t& col, uint32_t& rank, uint32_t& bank);
         bool IsRowBufferHit(uint32_t row, uint32_t rank, uint32_t bank);
+        bool GetOpenRow(uint32_t rank, uint32_t bank, uint32_t& row);
 
         virtual uint64_t GetActivateCount(void);
         virtual uint64_t GetPrechargeCount(void);
@@ -223,11 +272,14 @@ class MemSchedulerDefault : public MemSchedulerBase {
         uint32_t wrQueueHighWatermark;
         uint32_t wrQueueLowWatermark;
 
-        g_vector <MemSchedQueueElem> rdQueue;
-        g_vector <MemSchedQueueElem> wrQueue;
-        g_vector <MemSchedQueueElem> wrDoneQueue;
+        // Reads may repeat addresses; writes are merged, so wrQueue and
+        // wrDoneQueue are disjoint and indexed by address
+        MemSchedQueue rdQueue;
+        MemSchedQueue wrQueue;
+        MemSchedQueue wrDoneQueue;
 
-        bool FindBestRequest(g_vector <MemSchedQueueElem> *queue, uint32_t& idx);
+        void Enqueue(MemSchedQueue& queue, MemAccessEventBase* ev, Address addr);
+        MemSchedQueue::Entry* FindBestRequest(MemSchedQueue& queue);
 
     public:
         MemSchedulerDefault(uint32_t id, MemParam* mParam, MemChannelBase* mChnl);
@@ -0,0 +1,163 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DETAILED_MEM_QUEUE_H_
+#define DETAILED_MEM_QUEUE_H_
+
+#include "g_std/g_unordered_map.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "intrusive_list.h"
+#include "log.h"
+#include "memory_hierarchy.h"
+
+class MemAccessEventBase;
+
+/* Request queue for the Detailed memory scheduler. Requests are kept in
+ * arrival order in an intrusive list, and are also chained per (bank, row)
+ * and (optionally) indexed by address. This lets FR-FCFS find the oldest
+ * request that hits in an open row by checking only the open row of each bank
+ * with pending requests, and makes enqueue, removal, and address lookups O(1)
+ * amortized instead of linear scans plus vector erases.
+ *
+ * Banks are identified by their flat index, rank * banksPerRank + bank.
+ */
+class MemSchedQueue : public GlobAlloc {
+    public:
+        struct Entry : GlobAlloc, InListNode<Entry> {
+            MemAccessEventBase* ev;
+            Address addr;
+            uint32_t row;
+            uint32_t rank;
+            uint32_t bank;
+            uint64_t seq;  // arrival order, used to pick the oldest row hit across banks
+            Entry* rowNext;
+            Entry* rowPrev;
+        };
+
+    private:
+        // Per-(bank, row) chain, in arrival order. Kept by value in the map, so
+        // it can't be an InList (its nodes would point to a moving owner)
+        struct RowChain {
+            Entry* head;
+            Entry* tail;
+            RowChain() : head(nullptr), tail(nullptr) {}
+        };
+
+        InList<Entry> fifo;
+        InList<Entry> freeList;
+        g_unordered_map<uint64_t, RowChain> rowChains;
+        g_unordered_map<Address, Entry*> addrIndex;
+        g_vector<uint32_t> bankPending;
+        uint32_t banksPerRank;
+        uint64_t nextSeq;
+        bool indexAddrs;
+
+        uint32_t flatBank(uint32_t rank, uint32_t bank) const { return rank*banksPerRank + bank; }
+        static uint64_t rowKey(uint32_t flatBank, uint32_t row) { return (((uint64_t)flatBank) << 32) | row; }
+
+    public:
+        // indexAddrs requires addresses to be unique in the queue
+        MemSchedQueue(uint32_t ranks, uint32_t _banksPerRank, bool _indexAddrs)
+            : bankPending(ranks*_banksPerRank, 0), banksPerRank(_banksPerRank), nextSeq(0), indexAddrs(_indexAddrs) {}
+
+        bool empty() const { return fifo.empty(); }
+        size_t size() const { return fifo.size(); }
+        Entry* front() const { return fifo.front(); }
+
+        Entry* find(Address addr) const {
+            assert(indexAddrs);
+            g_unordered_map<Address, Entry*>::const_iterator it = addrIndex.find(addr);
+            return (it == addrIndex.end())? nullptr : it->second;
+        }
+
+        void push_back(MemAccessEventBase* ev, Address addr, uint32_t row, uint32_t rank, uint32_t bank) {
+            Entry* e = freeList.front();
+            if (e) freeList.pop_front();
+            else e = new Entry();
+
+            e->ev = ev;
+            e->addr = addr;
+            e->row = row;
+            e->rank = rank;
+            e->bank = bank;
+            e->seq = nextSeq++;
+            fifo.push_back(e);
+
+            uint32_t fb = flatBank(rank, bank);
+            RowChain& rc = rowChains[rowKey(fb, row)];
+            e->rowNext = nullptr;
+            e->rowPrev = rc.tail;
+            if (rc.tail) rc.tail->rowNext = e;
+            else rc.head = e;
+            rc.tail = e;
+            bankPending[fb]++;
+
+            if (indexAddrs) {
+                bool inserted = addrIndex.insert(std::make_pair(addr, e)).second;
+                assert_msg(inserted, "Duplicate address 0x%lx in address-indexed scheduler queue", addr);
+            }
+        }
+
+        void remove(Entry* e) {
+            fifo.remove(e);
+
+            uint32_t fb = flatBank(e->rank, e->bank);
+            g_unordered_map<uint64_t, RowChain>::iterator it = rowChains.find(rowKey(fb, e->row));
+            assert_msg(it != rowChains.end(), "Scheduler queue entry 0x%lx missing from its row chain", e->addr);
+            RowChain& rc = it->second;
+            if (e->rowPrev) e->rowPrev->rowNext = e->rowNext;
+            else rc.head = e->rowNext;
+            if (e->rowNext) e->rowNext->rowPrev = e->rowPrev;
+            else rc.tail = e->rowPrev;
+            if (!rc.head) rowChains.erase(it);
+            assert(bankPending[fb]);
+            bankPending[fb]--;
+
+            if (indexAddrs) addrIndex.erase(e->addr);
+            freeList.push_back(e);
+        }
+
+        /* Returns the oldest request that hits in an open row, or nullptr if
+         * there is none. getOpenRow(rank, bank, row&) must return whether the
+         * bank is open, and if so, its open row.
+         */
+        template <typename F>
+        Entry* oldestRowHit(F getOpenRow) const {
+            Entry* best = nullptr;
+            for (uint32_t fb = 0; fb < bankPending.size(); fb++) {
+                if (!bankPending[fb]) continue;
+                uint32_t row;
+                if (!getOpenRow(fb / banksPerRank, fb % banksPerRank, row)) continue;
+                g_unordered_map<uint64_t, RowChain>::const_iterator it = rowChains.find(rowKey(fb, row));
+                if (it == rowChains.end()) continue;
+                Entry* e = it->second.head;
+                if (!best || e->seq < best->seq) best = e;
+            }
+            return best;
+        }
+};
+
+#endif  // DETAILED_MEM_QUEUE_H_
@@ -0,0 +1,255 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "domain_tuner.h"
+#include <algorithm>
+#include "bithacks.h"
+#include "log.h"
+
+DomainTuner::DomainTuner(const std::vector<uint64_t>& unitEvents, const std::vector<uint64_t>& unitCrossings, const std::vector<uint64_t>& unitRetries)
+    : numUnits(unitEvents.size()), events(numUnits), savings(numUnits*numUnits), crossings(numUnits*numUnits)
+{
+    assert(unitCrossings.size() == numUnits*numUnits);
+    assert(unitRetries.size() == numUnits);
+
+    //Each crossing into v runs once in v, plus its share of v's retries
+    std::vector<double> crossingCost(numUnits);
+    for (uint32_t v = 0; v < numUnits; v++) {
+        uint64_t incoming = 0;
+        for (uint32_t u = 0; u < numUnits; u++) incoming += unitCrossings[u*numUnits + v];
+        crossingCost[v] = incoming? 1.0 + ((double)unitRetries[v])/incoming : 1.0;
+    }
+
+    for (uint32_t u = 0; u < numUnits; u++) {
+        events[u] = unitEvents[u];
+        for (uint32_t v = 0; v < numUnits; v++) {
+            if (u == v) continue;
+            uint64_t uv = unitCrossings[u*numUnits + v];
+            uint64_t vu = unitCrossings[v*numUnits + u];
+            savings[u*numUnits + v] = uv*crossingCost[v] + vu*crossingCost[u];
+            crossings[u*numUnits + v] = uv + vu;
+        }
+    }
+}
+
+std::vector<uint32_t> DomainTuner::evenMap(uint32_t domains) const {
+    std::vector<uint32_t> map(numUnits);
+    for (uint32_t u = 0; u < numUnits; u++) map[u] = ((uint64_t)u)*domains/numUnits;
+    return map;
+}
+
+double DomainTuner::estimateTime(const std::vector<uint32_t>& map, uint32_t domains, uint32_t threads) const {
+    assert(map.size() == numUnits);
+    assert(domains % threads == 0);
+    uint32_t threadDomains = domains/threads;
+    std::vector<double> threadLoad(threads, 0.0);
+    for (uint32_t u = 0; u < numUnits; u++) {
+        double load = events[u];
+        for (uint32_t v = u+1; v < numUnits; v++) {
+            if (map[u] == map[v]) load -= savings[u*numUnits + v];
+        }
+        threadLoad[map[u]/threadDomains] += load;
+    }
+    double maxLoad = 0.0;
+    for (double l : threadLoad) maxLoad = MAX(maxLoad, l);
+    return maxLoad;
+}
+
+uint64_t DomainTuner::countCrossings(const std::vector<uint32_t>& map) const {
+    uint64_t res = 0;
+    for (uint32_t u = 0; u < numUnits; u++) {
+        for (uint32_t v = u+1; v < numUnits; v++) {
+            if (map[u] != map[v]) res += crossings[u*numUnits + v];
+        }
+    }
+    return res;
+}
+
+std::vector<uint32_t> DomainTuner::tune(uint32_t domains, uint32_t threads) const {
+    std::vector<uint32_t> map = clusterMap(domains, threads);
+    refine(map, domains, threads);
+    //Never propose something worse than the fixed placement
+    std::vector<uint32_t> even = evenMap(domains);
+    if (estimateTime(even, domains, threads) <= estimateTime(map, domains, threads)) {
+        refine(even, domains, threads);
+        if (estimateTime(even, domains, threads) <= estimateTime(map, domains, threads)) return even;
+    }
+    return map;
+}
+
+/* Groups units that cross a lot into the same domain: merges the pair of
+ * groups with the largest savings while the merged group fits in a thread's
+ * fair share of the load (plus some slack). Groups are then placed, heaviest
+ * first, on the least loaded thread, in a free domain if it has one.
+ */
+std::vector<uint32_t> DomainTuner::clusterMap(uint32_t domains, uint32_t threads) const {
+    assert(domains % threads == 0);
+    uint32_t threadDomains = domains/threads;
+
+    std::vector<uint32_t> group(numUnits);
+    std::vector<double> load(events);
+    std::vector<double> link(savings); //[g*numUnits + h], savings between groups g and h
+    std::vector<bool> live(numUnits, true);
+    double totalLoad = 0.0;
+    for (uint32_t u = 0; u < numUnits; u++) {
+        group[u] = u;
+        totalLoad += events[u];
+    }
+    double cap = 1.05*totalLoad/threads;
+
+    auto merge = [&](uint32_t g, uint32_t h) {
+        load[g] += load[h] - link[g*numUnits + h];
+        for (uint32_t k = 0; k < numUnits; k++) {
+            if (!live[k] || k == g || k == h) continue;
+            link[g*numUnits + k] += link[h*numUnits + k];
+            link[k*numUnits + g] = link[g*numUnits + k];
+        }
+        live[h] = false;
+        for (uint32_t& gr : group) if (gr == h) gr = g;
+    };
+
+    while (true) {
+        uint32_t bg = numUnits, bh = numUnits;
+        double bestLink = 0.0;
+        for (uint32_t g = 0; g < numUnits; g++) {
+            if (!live[g]) continue;
+            for (uint32_t h = g+1; h < numUnits; h++) {
+                if (!live[h]) continue;
+                double l = link[g*numUnits + h];
+                if (l > bestLink && load[g] + load[h] - l <= cap) {
+                    bestLink = l;
+                    bg = g;
+                    bh = h;
+                }
+            }
+        }
+        if (bg == numUnits) break;
+        merge(bg, bh);
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t g = 0; g < numUnits; g++) if (live[g]) order.push_back(g);
+    std::sort(order.begin(), order.end(), [&load](uint32_t g, uint32_t h) {return load[g] > load[h];});
+
+    std::vector<double> threadLoad(threads, 0.0);
+    std::vector<double> domainLoad(domains, 0.0);
+    std::vector<uint32_t> threadUsed(threads, 0);
+    std::vector<uint32_t> groupDomain(numUnits);
+    for (uint32_t g : order) {
+        uint32_t bt = 0;
+        for (uint32_t t = 1; t < threads; t++) if (threadLoad[t] < threadLoad[bt]) bt = t;
+        uint32_t d;
+        if (threadUsed[bt] < threadDomains) {
+            d = bt*threadDomains + threadUsed[bt]++;
+        } else {
+            //No free domains left in this thread, share its least loaded one
+            d = bt*threadDomains;
+            for (uint32_t i = 1; i < threadDomains; i++) if (domainLoad[bt*threadDomains + i] < domainLoad[d]) d = bt*threadDomains + i;
+        }
+        groupDomain[g] = d;
+        domainLoad[d] += load[g];
+        threadLoad[bt] += load[g];
+    }
+
+    std::vector<uint32_t> map(numUnits);
+    for (uint32_t u = 0; u < numUnits; u++) map[u] = groupDomain[group[u]];
+    return map;
+}
+
+/* Greedily moves single units across domains while that reduces the estimated
+ * time or, on ties, the crossings left.
+ */
+void DomainTuner::refine(std::vector<uint32_t>& map, uint32_t domains, uint32_t threads) const {
+    assert(domains % threads == 0);
+    uint32_t threadDomains = domains/threads;
+    //conn[u*domains + d]: savings (and crossings) between u and the other units in d
+    std::vector<double> conn(numUnits*domains, 0.0);
+    std::vector<uint64_t> xconn(numUnits*domains, 0);
+    std::vector<double> threadLoad(threads, 0.0);
+    for (uint32_t u = 0; u < numUnits; u++) {
+        for (uint32_t v = 0; v < numUnits; v++) {
+            conn[u*domains + map[v]] += savings[u*numUnits + v];
+            xconn[u*domains + map[v]] += crossings[u*numUnits + v];
+        }
+    }
+    for (uint32_t u = 0; u < numUnits; u++) {
+        //Each shared saving is split between both units
+        threadLoad[map[u]/threadDomains] += events[u] - conn[u*domains + map[u]]/2;
+    }
+    uint64_t cut = countCrossings(map);
+
+    auto maxLoad = [&threadLoad]() {
+        double m = 0.0;
+        for (double l : threadLoad) m = MAX(m, l);
+        return m;
+    };
+
+    const double eps = 1e-9;
+    for (uint32_t pass = 0; pass < numUnits*domains; pass++) {
+        double curMax = maxLoad();
+        double bestMax = curMax;
+        uint64_t bestCut = cut;
+        uint32_t bestUnit = numUnits;
+        uint32_t bestDomain = 0;
+        for (uint32_t u = 0; u < numUnits; u++) {
+            uint32_t a = map[u];
+            uint32_t ta = a/threadDomains;
+            for (uint32_t b = 0; b < domains; b++) {
+                if (b == a) continue;
+                uint32_t tb = b/threadDomains;
+                double la = threadLoad[ta] - (events[u] - conn[u*domains + a]);
+                double lb = ((ta == tb)? la : threadLoad[tb]) + events[u] - conn[u*domains + b];
+                double newMax = lb;
+                for (uint32_t t = 0; t < threads; t++) {
+                    if (t != ta && t != tb) newMax = MAX(newMax, threadLoad[t]);
+                }
+                if (ta != tb) newMax = MAX(newMax, la);
+                uint64_t newCut = cut + xconn[u*domains + a] - xconn[u*domains + b];
+                bool better = (newMax < bestMax - eps*curMax) || (newMax <= bestMax + eps*curMax && newCut < bestCut);
+                if (better) {
+                    bestMax = newMax;
+                    bestCut = newCut;
+                    bestUnit = u;
+                    bestDomain = b;
+                }
+            }
+        }
+        if (bestUnit == numUnits) break;
+
+        uint32_t u = bestUnit;
+        uint32_t a = map[u];
+        uint32_t b = bestDomain;
+        threadLoad[a/threadDomains] -= events[u] - conn[u*domains + a];
+        threadLoad[b/threadDomains] += events[u] - conn[u*domains + b];
+        for (uint32_t v = 0; v < numUnits; v++) {
+            conn[v*domains + a] -= savings[v*numUnits + u];
+            conn[v*domains + b] += savings[v*numUnits + u];
+            xconn[v*domains + a] -= crossings[v*numUnits + u];
+            xconn[v*domains + b] += crossings[v*numUnits + u];
+        }
+        cut = bestCut;
+        map[u] = b;
+    }
+}
@@ -0,0 +1,66 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOMAIN_TUNER_H_
+#define DOMAIN_TUNER_H_
+
+#include <stdint.h>
+#include <vector>
+
+/* Proposes a placement of weave domains from a profiling run (sim.tuneDomains).
+ * Each domain of the profiling run is a unit that goes to one of the target
+ * domains; target domains are split across contention threads in contiguous
+ * ranges, as ContentionSim does. The estimated weave time of a placement is
+ * the load of the busiest thread, in events; placing two units in the same
+ * domain saves the crossing events (and their retries) between them. tune()
+ * clusters units that cross a lot, balances the clusters across threads, and
+ * then refines the placement one unit at a time. It never proposes a placement
+ * that is estimated to be slower than the even one the fixed formulas in
+ * init.cpp produce.
+ */
+class DomainTuner {
+    private:
+        uint32_t numUnits;
+        std::vector<double> events; //per unit
+        std::vector<double> savings; //[u*numUnits + v], events saved if u and v share a domain; symmetric
+        std::vector<uint64_t> crossings; //[u*numUnits + v], crossings between u and v in either direction
+
+    public:
+        //crossings is indexed by [src*units + dst]; retries are the crossing retries in each dst
+        DomainTuner(const std::vector<uint64_t>& unitEvents, const std::vector<uint64_t>& unitCrossings, const std::vector<uint64_t>& unitRetries);
+
+        //Unit u goes to domain u*domains/units
+        std::vector<uint32_t> evenMap(uint32_t domains) const;
+        std::vector<uint32_t> tune(uint32_t domains, uint32_t threads) const;
+
+        double estimateTime(const std::vector<uint32_t>& map, uint32_t domains, uint32_t threads) const;
+        uint64_t countCrossings(const std::vector<uint32_t>& map) const;
+
+    private:
+        std::vector<uint32_t> clusterMap(uint32_t domains, uint32_t threads) const;
+        void refine(std::vector<uint32_t>& map, uint32_t domains, uint32_t threads) const;
+};
+
+#endif  // DOMAIN_TUNER_H_
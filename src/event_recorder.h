@@ -30,6 +30,7 @@
 #include "memory_hierarchy.h"
 #include "pad.h"
 #include "slab_alloc.h"
+#include "stats.h"
 
 class TimingEvent;
 
@@ -78,6 +79,22 @@ class EventRecorder : public GlobAlloc {
             return slabAlloc.alloc(sz);
         }
 
+        //Event memory stats
+        void initStats(AggregateStat* parentStat) {
+            AggregateStat* memStat = new AggregateStat();
+            memStat->init("evMem", "Timing event memory stats");
+            auto slabsStat = makeLambdaStat([this]() { return slabAlloc.getSlabs(); });
+            slabsStat->init("slabs", "64KB slabs held; slabs are never released, so this is the peak footprint");
+            memStat->append(slabsStat);
+            auto liveStat = makeLambdaStat([this]() { return slabAlloc.getLiveBytes(); });
+            liveStat->init("liveBytes", "Bytes in live events; the rest of the slabs is free or fragmented");
+            memStat->append(liveStat);
+            auto peakStat = makeLambdaStat([this]() { return slabAlloc.getPeakLiveBytes(); });
+            peakStat->init("peakLiveBytes", "Peak bytes in live events");
+            memStat->append(peakStat);
+            parentStat->append(memStat);
+        }
+
         //Event recording interface
 
         void pushRecord(const TimingRecord& rec) {
@@ -35,6 +35,14 @@ class HashFamily : public GlobAlloc {
         virtual ~HashFamily() {}
 
         virtual uint64_t hash(uint32_t id, uint64_t val) = 0;
+
+        /* Computes functions 0..n-1 on val, writing them to res. Equivalent to calling hash() n times, but
+         * families that can evaluate several functions at once (e.g., H3) override it. Used by zcaches, which
+         * need all the hash functions of every address they visit.
+         */
+        virtual void hashAll(uint64_t val, uint32_t n, uint64_t* res) {
+            for (uint32_t i = 0; i < n; i++) res[i] = hash(i, val);
+        }
 };
 
 class H3HashFamily : public HashFamily {
@@ -42,10 +50,18 @@ class H3HashFamily : public HashFamily {
         const uint32_t numFuncs;
         uint32_t resShift;
         uint64_t* hMatrix;
+        uint64_t* hTable;  // byte-sliced lookup tables, 8 x 256 entries per function, derived from hMatrix
     public:
         H3HashFamily(uint32_t numFunctions, uint32_t outputBits, uint64_t randSeed = 123132127);
         virtual ~H3HashFamily();
         uint64_t hash(uint32_t id, uint64_t val);
+        void hashAll(uint64_t val, uint32_t n, uint64_t* res);
+
+        // Reference bit-matrix implementation, used to build hTable (and by hashbench)
+        uint64_t matrixHash(uint32_t id, uint64_t val);
+
+    private:
+        inline uint64_t fold(uint64_t res) const;
 };
 
 class SHA1HashFamily : public HashFamily {
@@ -0,0 +1,122 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks that the byte-sliced H3 tables (hash() and hashAll()) produce the same outputs as the reference bit-matrix
+ * implementation, and reports the speed of each. H3 is linear over GF(2), as are both implementations, so agreeing on
+ * every single-byte input (which include a basis of the input space) implies agreeing on all inputs. We also check a
+ * stream of random inputs, which would catch a broken table layout or a non-linear bug.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "galloc.h"
+#include "hash.h"
+#include "log.h"
+#include "mtrand.h"
+#include "profile_stats.h"
+
+using namespace std;
+
+volatile uint64_t hashSink;  // keeps hash results from being optimized away
+
+static void check(H3HashFamily* hf, uint32_t funcs, uint32_t bits, const vector<uint64_t>& vals) {
+    vector<uint64_t> res(funcs);
+    auto checkVal = [&](uint64_t val) {
+        for (uint32_t f = 0; f < funcs; f++) {
+            uint64_t ref = hf->matrixHash(f, val);
+            if (hf->hash(f, val) != ref) panic("%d funcs, %d bits: hash(%d, 0x%lx) = 0x%lx, reference 0x%lx", funcs, bits, f, val, hf->hash(f, val), ref);
+        }
+        for (uint32_t n = 1; n <= funcs; n++) {
+            hf->hashAll(val, n, &res[0]);
+            for (uint32_t f = 0; f < n; f++) {
+                if (res[f] != hf->matrixHash(f, val)) panic("%d funcs, %d bits: hashAll(0x%lx, %d) func %d mismatch", funcs, bits, val, n, f);
+            }
+        }
+    };
+
+    for (uint32_t b = 0; b < 8; b++) {
+        for (uint64_t v = 0; v < 256; v++) checkVal(v << (8*b));
+    }
+    for (uint64_t val : vals) checkVal(val);
+}
+
+// Returns ns per hashed value (all funcs); mode 0 is the bit-matrix reference, 1 is hash(), 2 is hashAll()
+static double bench(H3HashFamily* hf, uint32_t funcs, const vector<uint64_t>& vals, uint32_t mode) {
+    uint64_t res[64];
+    uint64_t acc = 0;
+    uint64_t startNs = getNs();
+    for (uint64_t val : vals) {
+        switch (mode) {
+            case 0:
+                for (uint32_t f = 0; f < funcs; f++) acc ^= hf->matrixHash(f, val);
+                break;
+            case 1:
+                for (uint32_t f = 0; f < funcs; f++) acc ^= hf->hash(f, val);
+                break;
+            case 2:
+                hf->hashAll(val, funcs, res);
+                for (uint32_t f = 0; f < funcs; f++) acc ^= res[f];
+                break;
+        }
+    }
+    uint64_t ns = getNs() - startNs;
+    hashSink = acc;
+    return ((double)ns)/vals.size();
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc > 2) {
+        info("Checks and benchmarks the table-driven H3 hash functions against the bit-matrix reference");
+        info("Usage: %s [<random values, default 1M>]", argv[0]);
+        exit(1);
+    }
+    uint64_t numVals = (argc == 2)? strtoull(argv[1], nullptr, 0) : 1000000;
+
+    gm_init(64<<20 /*64 MB*/);
+
+    MTRand rnd(42);
+    vector<uint64_t> vals(numVals);
+    for (uint64_t& v : vals) v = (((uint64_t)rnd.randInt()) << 32) | rnd.randInt();
+
+    const uint32_t funcCounts[] = {1, 4, 8, 16};
+    const uint32_t outputBits[] = {8, 16, 32, 64};
+    info("%6s %6s %14s %14s %14s %9s %9s", "Funcs", "Bits", "Matrix ns/val", "hash() ns/val", "hashAll ns/val", "hash() x", "hashAll x");
+    for (uint32_t funcs : funcCounts) {
+        for (uint32_t bits : outputBits) {
+            H3HashFamily* hf = new H3HashFamily(funcs, bits, 0xF00BA4 + funcs*bits);
+            check(hf, funcs, bits, vals);
+            double matrixNs = bench(hf, funcs, vals, 0);
+            double hashNs = bench(hf, funcs, vals, 1);
+            double hashAllNs = bench(hf, funcs, vals, 2);
+            info("%6d %6d %14.2f %14.2f %14.2f %9.2f %9.2f", funcs, bits, matrixNs, hashNs, hashAllNs, matrixNs/hashNs, matrixNs/hashAllNs);
+            delete hf;
+        }
+    }
+    info("All tables match the reference implementation");
+    return 0;
+}
@@ -27,16 +27,166 @@
 #define IDEAL_ARRAYS_H_
 
 #include "cache_arrays.h"
-#include "g_std/g_unordered_map.h"
-#include "intrusive_list.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
 #include "part_repl_policies.h"
 #include "repl_policies.h"
 
 /* Fully associative cache arrays with LRU replacement (non-part; part coming up) */
 
-//We use a combination of a hash table and an intrusive list to perform fully-associative lookups and insertions in O(1) time
+//Per-access bookkeeping is O(1) and touches few host cache lines: lookups go through a flat open-addressing
+//tag index, and LRU order is kept in append-only recency logs instead of a global doubly-linked list.
 //TODO: Post-deadline, make it a single array with a rank(req) interface
 
+/* Tag index for fully-associative arrays: lineAddr -> lineId, linear probing at <= 50% load, with
+ * backward-shift deletion so there are no tombstones. Never allocates after construction.
+ */
+class IdealTagIndex : public GlobAlloc {
+    private:
+        struct Slot {
+            Address lineAddr;
+            uint32_t lineId; //EMPTY if unused
+        };
+
+        static const uint32_t EMPTY = (uint32_t)-1;
+
+        Slot* slots;
+        uint32_t mask;
+        uint32_t shift;
+
+        inline uint32_t home(Address lineAddr) const {
+            return (uint32_t)((lineAddr * 0x9E3779B97F4A7C15ULL) >> shift); //Fibonacci hashing
+        }
+
+    public:
+        explicit IdealTagIndex(uint32_t numLines) {
+            uint32_t bits = 1;
+            while ((1ULL << bits) < 2ULL*numLines) bits++;
+            mask = (1 << bits) - 1;
+            shift = 64 - bits;
+            slots = gm_calloc<Slot>(mask + 1);
+            for (uint32_t i = 0; i <= mask; i++) slots[i].lineId = EMPTY;
+        }
+
+        int32_t find(Address lineAddr) const {
+            for (uint32_t i = home(lineAddr);; i = (i + 1) & mask) {
+                const Slot& s = slots[i];
+                if (s.lineId == EMPTY) return -1;
+                if (s.lineAddr == lineAddr) return s.lineId;
+            }
+        }
+
+        void insert(Address lineAddr, uint32_t lineId) {
+            uint32_t i = home(lineAddr);
+            while (slots[i].lineId != EMPTY) {
+                assert(slots[i].lineAddr != lineAddr);
+                i = (i + 1) & mask;
+            }
+            slots[i].lineAddr = lineAddr;
+            slots[i].lineId = lineId;
+        }
+
+        //Removes lineAddr only if it maps to lineId (evicted lines that were never valid keep a stale address)
+        void erase(Address lineAddr, uint32_t lineId) {
+            uint32_t i = home(lineAddr);
+            while (true) {
+                if (slots[i].lineId == EMPTY) return;
+                if (slots[i].lineAddr == lineAddr) break;
+                i = (i + 1) & mask;
+            }
+            if (slots[i].lineId != lineId) return;
+
+            //Shift back later entries of the cluster that would become unreachable
+            uint32_t j = i;
+            while (true) {
+                j = (j + 1) & mask;
+                if (slots[j].lineId == EMPTY) break;
+                uint32_t k = home(slots[j].lineAddr);
+                bool reachable = (i <= j)? (i < k && k <= j) : (i < k || k <= j);
+                if (!reachable) {
+                    slots[i] = slots[j];
+                    i = j;
+                }
+            }
+            slots[i].lineId = EMPTY;
+        }
+};
+
+/* Exact LRU order for the lines of a fully-associative array (or a partition of it). Every touch appends
+ * the line to a log; a line's live entry is its latest one, and older entries are skipped lazily and
+ * dropped when the log is compacted. Touches are sequential appends instead of list unlinks/relinks of
+ * random neighbors, and compaction is amortized O(1) per touch. Lines may move across logs: T must have
+ * p (id of the log that owns the line) and logPos (position of its live entry in that log).
+ */
+template <typename T>
+class RecencyLog : public GlobAlloc {
+    private:
+        g_vector<uint32_t> log;
+        T* entries;
+        uint32_t id;
+        uint32_t head; //entries before head are stale
+        uint32_t live;
+
+        inline bool isLive(uint32_t pos) const {
+            const T& e = entries[log[pos]];
+            return e.p == id && e.logPos == pos;
+        }
+
+        void append(uint32_t lineId) {
+            entries[lineId].logPos = log.size();
+            log.push_back(lineId);
+        }
+
+        void compact() {
+            uint32_t n = 0;
+            for (uint32_t pos = head; pos < log.size(); pos++) {
+                if (isLive(pos)) {
+                    uint32_t lineId = log[pos];
+                    log[n] = lineId;
+                    entries[lineId].logPos = n;
+                    n++;
+                }
+            }
+            assert(n == live);
+            log.resize(n);
+            head = 0;
+        }
+
+    public:
+        RecencyLog(T* _entries, uint32_t _id) : entries(_entries), id(_id), head(0), live(0) {}
+
+        //Line becomes owned by this log (caller has set its p), as MRU
+        void add(uint32_t lineId) {
+            assert(entries[lineId].p == id);
+            if (log.size() >= 2*live + 64) compact();
+            live++;
+            append(lineId);
+        }
+
+        //Line is about to be owned by another log; its entries here become stale
+        void drop(uint32_t lineId) {
+            assert(entries[lineId].p == id);
+            assert(live);
+            live--;
+            entries[lineId].logPos = (uint32_t)-1; //so that no stale entry looks live once the line is added elsewhere
+        }
+
+        //Moves an owned line to MRU
+        void touch(uint32_t lineId) {
+            assert(entries[lineId].p == id);
+            if (log.size() >= 2*live + 64) compact();
+            append(lineId);
+        }
+
+        uint32_t lru() {
+            assert(live);
+            while (!isLive(head)) head++;
+            return log[head];
+        }
+
+        uint32_t size() const {return live;}
+};
+
 class IdealLRUArray : public CacheArray {
     private:
         //We need a fake replpolicy and just want the CC...
@@ -54,15 +204,15 @@ class IdealLRUArray : public CacheArray {
                 DECL_RANK_BINDINGS
         };
 
-        struct Entry : InListNode<Entry> {
+        struct Entry {
             Address lineAddr;
-            const uint32_t lineId;
-            explicit Entry(uint32_t _lineId) : lineAddr(0), lineId(_lineId) {}
+            uint32_t p; //always 0, single log
+            uint32_t logPos;
         };
 
         Entry* array;
-        InList<Entry> lruList;
-        g_unordered_map<Address, uint32_t> lineMap; //address->lineId; if too slow, try an AATree, which does not alloc dynamically
+        RecencyLog<Entry>* lruLog;
+        IdealTagIndex* lineIndex;
 
         uint32_t numLines;
         ProxyReplPolicy* rp;
@@ -71,43 +221,37 @@ class IdealLRUArray : public CacheArray {
     public:
         explicit IdealLRUArray(uint32_t _numLines) : numLines(_numLines), cc(nullptr) {
             array = gm_calloc<Entry>(numLines);
-            for (uint32_t i = 0; i < numLines; i++) {
-                Entry* e = new (&array[i]) Entry(i);
-                lruList.push_front(e);
-            }
+            lruLog = new RecencyLog<Entry>(array, 0);
+            for (uint32_t i = 0; i < numLines; i++) lruLog->add(i); //line 0 is LRU
+            lineIndex = new IdealTagIndex(numLines);
             rp = new ProxyReplPolicy(this);
         }
 
         int32_t lookup(const Address lineAddr, const MemReq* req, bool updateReplacement) {
-            g_unordered_map<Address, uint32_t>::iterator it = lineMap.find(lineAddr);
-            if (it == lineMap.end()) return -1;
+            int32_t lineId = lineIndex->find(lineAddr);
+            if (lineId == -1) return -1;
 
-            uint32_t lineId = it->second;
-            if (updateReplacement) {
-                lruList.remove(&array[lineId]);
-                lruList.push_front(&array[lineId]);
-            }
+            if (updateReplacement) lruLog->touch(lineId);
             return lineId;
         }
 
         uint32_t preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr) {
-            Entry* e = lruList.back();
-            *wbLineAddr = e->lineAddr;
-            return e->lineId;
+            uint32_t lineId = lruLog->lru();
+            *wbLineAddr = array[lineId].lineAddr;
+            return lineId;
         }
 
         void postinsert(const Address lineAddr, const MemReq* req, uint32_t lineId) {
             Entry* e = &array[lineId];
 
             //Update addr mapping for lineId
-            lineMap.erase(e->lineAddr);
-            assert((lineMap.find(lineAddr) == lineMap.end()));
+            lineIndex->erase(e->lineAddr, lineId);
+            assert(lineIndex->find(lineAddr) == -1);
             e->lineAddr = lineAddr;
-            lineMap[lineAddr] = lineId;
+            lineIndex->insert(lineAddr, lineId);
 
             //Update repl
-            lruList.remove(e);
-            lruList.push_front(e);
+            lruLog->touch(lineId);
         }
 
         ReplPolicy* getRP() const {return rp;}
@@ -117,15 +261,15 @@ class IdealLRUArray : public CacheArray {
 //Goes with IdealLRUPartArray
 class IdealLRUPartReplPolicy : public PartReplPolicy {
     protected:
-        struct Entry : InListNode<Entry> {
-            const uint32_t lineId;
+        struct Entry {
             uint32_t p;
+            uint32_t logPos;
             bool used; //careful, true except when just evicted, even if invalid
-            Entry(uint32_t _id, uint32_t _p) : lineId(_id), p(_p), used(true) {}
         };
 
         struct IdPartInfo : public PartInfo {
-            InList<Entry> lruList;
+            RecencyLog<Entry> lruLog;
+            IdPartInfo(Entry* entries, uint32_t p) : lruLog(entries, p) {}
         };
 
         Entry* array;
@@ -138,17 +282,18 @@ class IdealLRUPartReplPolicy : public PartReplPolicy {
         IdealLRUPartReplPolicy(PartitionMonitor* _monitor, PartMapper* _mapper, uint32_t _numLines, uint32_t _numBuckets) : PartReplPolicy(_monitor, _mapper), numLines(_numLines), numBuckets(_numBuckets) {
             partitions = mapper->getNumPartitions();
             partInfo = gm_calloc<IdPartInfo>(partitions);
+            array = gm_calloc<Entry>(numLines);
 
-            for (uint32_t p = 0; p <= partitions; p++) {
-                new (&partInfo[p]) IdPartInfo();
+            for (uint32_t p = 0; p < partitions; p++) {
+                new (&partInfo[p]) IdPartInfo(array, p);
                 partInfo[p].targetSize = numLines/partitions;
                 partInfo[p].size = 0;
             }
 
-            array = gm_calloc<Entry>(numLines);
             for (uint32_t i = 0; i < numLines; i++) {
-                Entry* e = new (&array[i]) Entry(i, 0);
-                partInfo[0].lruList.push_front(e);
+                array[i].p = 0;
+                array[i].used = true;
+                partInfo[0].lruLog.add(i); //line 0 is LRU
                 partInfo[0].size++;
             }
         }
@@ -183,8 +328,7 @@ class IdealLRUPartReplPolicy : public PartReplPolicy {
             Entry* e = &array[id];
             if (e->used) {
                 partInfo[e->p].profHits.inc();
-                partInfo[e->p].lruList.remove(e);
-                partInfo[e->p].lruList.push_front(e);
+                partInfo[e->p].lruLog.touch(id);
             } else {
                 uint32_t oldPart = e->p;
                 uint32_t newPart = mapper->getPartition(*req);
@@ -196,14 +340,18 @@ class IdealLRUPartReplPolicy : public PartReplPolicy {
                     partInfo[oldPart].profSelfEvictions.inc();
                 }
                 partInfo[newPart].profMisses.inc();
-                e->p = newPart;
-                partInfo[oldPart].lruList.remove(e);
-                partInfo[newPart].lruList.push_front(e);
+                if (oldPart != newPart) {
+                    partInfo[oldPart].lruLog.drop(id);
+                    e->p = newPart;
+                    partInfo[newPart].lruLog.add(id);
+                } else {
+                    partInfo[newPart].lruLog.touch(id);
+                }
                 e->used = true;
             }
 
             //Update partitioner
-            monitor->access(e->p, req->lineAddr);
+            monitor->access(e->p, req->lineAddr, req->srcId);
         }
 
         void replaced(uint32_t id) {
@@ -231,8 +379,8 @@ class IdealLRUPartReplPolicy : public PartReplPolicy {
 
             //info("rp: %d / %d %d / %d %d", victimPart, partInfo[0].size, partInfo[0].targetSize, partInfo[1].size, partInfo[1].targetSize);
             assert(partInfo[victimPart].size > 0);
-            assert(partInfo[victimPart].size == partInfo[victimPart].lruList.size());
-            return partInfo[victimPart].lruList.back()->lineId;
+            assert(partInfo[victimPart].size == partInfo[victimPart].lruLog.size());
+            return partInfo[victimPart].lruLog.lru();
         }
 
         template <typename C> uint32_t rank(const MemReq* req, C cands) {panic("!!");}
@@ -241,7 +389,7 @@ class IdealLRUPartReplPolicy : public PartReplPolicy {
 
 class IdealLRUPartArray : public CacheArray {
     private:
-        g_unordered_map<Address, uint32_t> lineMap; //address->lineId; if too slow, try an AATree, which does not alloc dynamically
+        IdealTagIndex* lineIndex;
         Address* lineAddrs; //lineId -> address, for replacements
         IdealLRUPartReplPolicy* rp;
         uint32_t numLines;
@@ -249,13 +397,13 @@ class IdealLRUPartArray : public CacheArray {
     public:
         IdealLRUPartArray(uint32_t _numLines, IdealLRUPartReplPolicy* _rp) : rp(_rp), numLines(_numLines) {
             lineAddrs = gm_calloc<Address>(numLines);
+            lineIndex = new IdealTagIndex(numLines);
         }
 
         int32_t lookup(const Address lineAddr, const MemReq* req, bool updateReplacement) {
-            g_unordered_map<Address, uint32_t>::iterator it = lineMap.find(lineAddr);
-            if (it == lineMap.end()) return -1;
+            int32_t lineId = lineIndex->find(lineAddr);
+            if (lineId == -1) return -1;
 
-            uint32_t lineId = it->second;
             if (updateReplacement) {
                 rp->update(lineId, req);
             }
@@ -270,10 +418,10 @@ class IdealLRUPartArray : public CacheArray {
 
         void postinsert(const Address lineAddr, const MemReq* req, uint32_t lineId) {
             //Update addr mapping for lineId
-            lineMap.erase(lineAddrs[lineId]);
-            assert((lineMap.find(lineAddr) == lineMap.end()));
+            lineIndex->erase(lineAddrs[lineId], lineId);
+            assert(lineIndex->find(lineAddr) == -1);
             lineAddrs[lineId] = lineAddr;
-            lineMap[lineAddr] = lineId;
+            lineIndex->insert(lineAddr, lineId);
 
             //Update repl
             rp->replaced(lineId);
@@ -0,0 +1,401 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Differential test and benchmark for the ideal (fully-associative, exact LRU) arrays in ideal_arrays.h. Replays
+ * random access streams through IdealLRUArray and IdealLRUPartArray, and through reference copies of both that keep
+ * LRU order in intrusive lists and map addresses with an unordered_map, as ideal_arrays.h originally did. We panic
+ * unless both return the same hits, victims and writebacks (and, for the partitioned arrays, feed the same accesses
+ * to the partition monitor, including across partition size changes), and time each replay.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "g_std/g_unordered_map.h"
+#include "galloc.h"
+#include "ideal_arrays.h"
+#include "intrusive_list.h"
+#include "log.h"
+#include "mtrand.h"
+#include "partitioner.h"
+#include "partition_mapper.h"
+#include "profile_stats.h"
+
+using namespace std;
+
+/* Reference arrays: list-based exact LRU */
+
+class ListLRUArray : public CacheArray {
+    private:
+        struct Entry : InListNode<Entry> {
+            Address lineAddr;
+            const uint32_t lineId;
+            explicit Entry(uint32_t _lineId) : lineAddr(0), lineId(_lineId) {}
+        };
+
+        Entry* array;
+        InList<Entry> lruList;
+        g_unordered_map<Address, uint32_t> lineMap;
+        uint32_t numLines;
+
+    public:
+        explicit ListLRUArray(uint32_t _numLines) : numLines(_numLines) {
+            array = gm_calloc<Entry>(numLines);
+            for (uint32_t i = 0; i < numLines; i++) {
+                Entry* e = new (&array[i]) Entry(i);
+                lruList.push_front(e);
+            }
+        }
+
+        int32_t lookup(const Address lineAddr, const MemReq* req, bool updateReplacement) {
+            g_unordered_map<Address, uint32_t>::iterator it = lineMap.find(lineAddr);
+            if (it == lineMap.end()) return -1;
+
+            uint32_t lineId = it->second;
+            if (updateReplacement) {
+                lruList.remove(&array[lineId]);
+                lruList.push_front(&array[lineId]);
+            }
+            return lineId;
+        }
+
+        uint32_t preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr) {
+            Entry* e = lruList.back();
+            *wbLineAddr = e->lineAddr;
+            return e->lineId;
+        }
+
+        void postinsert(const Address lineAddr, const MemReq* req, uint32_t lineId) {
+            Entry* e = &array[lineId];
+            lineMap.erase(e->lineAddr);
+            e->lineAddr = lineAddr;
+            lineMap[lineAddr] = lineId;
+            lruList.remove(e);
+            lruList.push_front(e);
+        }
+};
+
+// Same victim selection as IdealLRUPartReplPolicy, on per-partition lists
+class ListLRUPartReplPolicy : public PartReplPolicy {
+    private:
+        struct Entry : InListNode<Entry> {
+            const uint32_t lineId;
+            uint32_t p;
+            bool used;
+            Entry(uint32_t _id, uint32_t _p) : lineId(_id), p(_p), used(true) {}
+        };
+
+        struct ListPartInfo : public PartInfo {
+            InList<Entry> lruList;
+        };
+
+        Entry* array;
+        ListPartInfo* partInfo;
+        uint32_t partitions;
+        uint32_t numLines;
+        uint32_t numBuckets;
+
+    public:
+        ListLRUPartReplPolicy(PartitionMonitor* _monitor, PartMapper* _mapper, uint32_t _numLines, uint32_t _numBuckets)
+            : PartReplPolicy(_monitor, _mapper), numLines(_numLines), numBuckets(_numBuckets)
+        {
+            partitions = mapper->getNumPartitions();
+            partInfo = gm_calloc<ListPartInfo>(partitions);
+            for (uint32_t p = 0; p < partitions; p++) {
+                new (&partInfo[p]) ListPartInfo();
+                partInfo[p].targetSize = numLines/partitions;
+                partInfo[p].size = 0;
+            }
+
+            array = gm_calloc<Entry>(numLines);
+            for (uint32_t i = 0; i < numLines; i++) {
+                Entry* e = new (&array[i]) Entry(i, 0);
+                partInfo[0].lruList.push_front(e);
+                partInfo[0].size++;
+            }
+        }
+
+        void initStats(AggregateStat* parentStat) {}
+
+        void setPartitionSizes(const uint32_t* sizes) {
+            for (uint32_t p = 0; p < partitions; p++) partInfo[p].targetSize = (sizes[p]*numLines)/numBuckets;
+        }
+
+        void update(uint32_t id, const MemReq* req) {
+            Entry* e = &array[id];
+            if (e->used) {
+                partInfo[e->p].lruList.remove(e);
+                partInfo[e->p].lruList.push_front(e);
+            } else {
+                uint32_t oldPart = e->p;
+                uint32_t newPart = mapper->getPartition(*req);
+                if (oldPart != newPart) {
+                    partInfo[oldPart].size--;
+                    partInfo[newPart].size++;
+                }
+                e->p = newPart;
+                partInfo[oldPart].lruList.remove(e);
+                partInfo[newPart].lruList.push_front(e);
+                e->used = true;
+            }
+            monitor->access(e->p, req->lineAddr, req->srcId);
+        }
+
+        void replaced(uint32_t id) {
+            array[id].used = false;
+        }
+
+        uint32_t rank(const MemReq* req) {
+            uint32_t victimPart = mapper->getPartition(*req);
+            double maxPartDiff = 0.0;
+            if (partInfo[victimPart].size == 0) maxPartDiff = -2.0;
+            for (uint32_t p = 0; p < partitions; p++) {
+                double diff = ((int32_t)partInfo[p].size - (int32_t)partInfo[p].targetSize)/((double)(partInfo[p].targetSize + 1));
+                if (diff > maxPartDiff && partInfo[p].size > 0) {
+                    maxPartDiff = diff;
+                    victimPart = p;
+                }
+            }
+            assert(partInfo[victimPart].size == partInfo[victimPart].lruList.size());
+            return partInfo[victimPart].lruList.back()->lineId;
+        }
+
+        template <typename C> uint32_t rank(const MemReq* req, C cands) {panic("!!");}
+        DECL_RANK_BINDINGS;
+};
+
+class ListLRUPartArray : public CacheArray {
+    private:
+        g_unordered_map<Address, uint32_t> lineMap;
+        Address* lineAddrs;
+        ListLRUPartReplPolicy* rp;
+        uint32_t numLines;
+
+    public:
+        ListLRUPartArray(uint32_t _numLines, ListLRUPartReplPolicy* _rp) : rp(_rp), numLines(_numLines) {
+            lineAddrs = gm_calloc<Address>(numLines);
+        }
+
+        int32_t lookup(const Address lineAddr, const MemReq* req, bool updateReplacement) {
+            g_unordered_map<Address, uint32_t>::iterator it = lineMap.find(lineAddr);
+            if (it == lineMap.end()) return -1;
+            if (updateReplacement) rp->update(it->second, req);
+            return it->second;
+        }
+
+        uint32_t preinsert(const Address lineAddr, const MemReq* req, Address* wbLineAddr) {
+            uint32_t lineId = rp->rank(req);
+            *wbLineAddr = lineAddrs[lineId];
+            return lineId;
+        }
+
+        void postinsert(const Address lineAddr, const MemReq* req, uint32_t lineId) {
+            lineMap.erase(lineAddrs[lineId]);
+            lineAddrs[lineId] = lineAddr;
+            lineMap[lineAddr] = lineId;
+            rp->replaced(lineId);
+            rp->update(lineId, req);
+        }
+};
+
+/* Partitioning stand-ins */
+
+// Hashes the accesses it sees, so both policies must feed it the same ones
+class HashMonitor : public PartitionMonitor {
+    private:
+        uint32_t partitions;
+
+    public:
+        uint64_t hash;
+
+        explicit HashMonitor(uint32_t _partitions) : PartitionMonitor(16), partitions(_partitions), hash(0) {}
+        uint32_t getNumPartitions() const {return partitions;}
+        void access(uint32_t partition, Address lineAddr, uint32_t srcId) {hash = hash*31 + partition*7 + lineAddr;}
+        uint32_t get(uint32_t partition, uint32_t bucket) const {return 0;}
+        uint32_t getNumAccesses(uint32_t partition) const {return 0;}
+        void reset() {}
+};
+
+class SrcPartMapper : public PartMapper {
+    private:
+        uint32_t partitions;
+
+    public:
+        explicit SrcPartMapper(uint32_t _partitions) : partitions(_partitions) {}
+        uint32_t getNumPartitions() {return partitions;}
+        uint32_t getPartition(const MemReq& req) {return req.srcId % partitions;}
+};
+
+/* Streams */
+
+struct Access {
+    Address lineAddr;
+    uint32_t srcId;
+};
+
+// Half the accesses reuse lines at geometric distances (mean ~ the array size), half are uniform over 2x the array
+static vector<Access> genStream(uint32_t numLines, uint32_t numAccesses, uint32_t srcs, uint64_t seed) {
+    MTRand rnd(seed);
+    vector<Access> accs;
+    accs.reserve(numAccesses);
+    double p = 1.0/numLines;
+    for (uint32_t i = 0; i < numAccesses; i++) {
+        uint64_t line;
+        if (rnd.randInt(1)) {
+            line = 1 + ((uint64_t)(log(1.0 - rnd.randExc())/log(1.0 - p))) % (4ull*numLines);
+        } else {
+            line = 1 + rnd.randInt(2*numLines - 1);
+        }
+        accs.push_back({line*977 + 1, (uint32_t)rnd.randInt(srcs - 1)});
+    }
+    return accs;
+}
+
+// Replays accs on the array; if out is given, logs each outcome (line hit, or line filled and line written back)
+template <typename A>
+static uint64_t replay(A* array, const vector<Access>& accs, size_t begin, size_t end, vector<uint64_t>* out) {
+    uint64_t misses = 0;
+    for (size_t i = begin; i < end; i++) {
+        const Access& a = accs[i];
+        MemReq req;
+        memset(&req, 0, sizeof(req));
+        req.lineAddr = a.lineAddr;
+        req.srcId = a.srcId;
+        int32_t lineId = array->lookup(a.lineAddr, &req, true);
+        uint64_t outcome;
+        if (lineId == -1) {
+            Address wbLineAddr;
+            uint32_t victim = array->preinsert(a.lineAddr, &req, &wbLineAddr);
+            array->postinsert(a.lineAddr, &req, victim);
+            outcome = (1ull << 63) | ((uint64_t)victim << 40) | wbLineAddr;
+            misses++;
+        } else {
+            outcome = lineId;
+        }
+        if (out) out->push_back(outcome);
+    }
+    return misses;
+}
+
+static void compare(const char* what, uint32_t numLines, const vector<uint64_t>& ref, const vector<uint64_t>& ideal) {
+    assert(ref.size() == ideal.size());
+    for (size_t i = 0; i < ref.size(); i++) {
+        if (ref[i] != ideal[i]) {
+            panic("%s, %d lines: access %ld differs (reference 0x%lx, ideal 0x%lx)", what, numLines, i, ref[i], ideal[i]);
+        }
+    }
+}
+
+static void check(uint32_t rounds) {
+    MTRand rnd(42);
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint32_t numLines = 1 + rnd.randInt(2999);
+        uint32_t partitions = 1 + rnd.randInt(5);
+        const uint32_t buckets = 64;
+        vector<Access> accs = genStream(numLines, 20000 + rnd.randInt(40000), 7, r + 1);
+
+        vector<uint64_t> ref, ideal;
+        replay(new ListLRUArray(numLines), accs, 0, accs.size(), &ref);
+        replay(new IdealLRUArray(numLines), accs, 0, accs.size(), &ideal);
+        compare("LRU", numLines, ref, ideal);
+
+        // Partitioned arrays, changing partition sizes half-way through
+        ref.clear();
+        ideal.clear();
+        SrcPartMapper* mapper = new SrcPartMapper(partitions);
+        HashMonitor* refMon = new HashMonitor(partitions);
+        HashMonitor* idealMon = new HashMonitor(partitions);
+        ListLRUPartReplPolicy* refRP = new ListLRUPartReplPolicy(refMon, mapper, numLines, buckets);
+        IdealLRUPartReplPolicy* idealRP = new IdealLRUPartReplPolicy(idealMon, mapper, numLines, buckets);
+        ListLRUPartArray* refArray = new ListLRUPartArray(numLines, refRP);
+        IdealLRUPartArray* idealArray = new IdealLRUPartArray(numLines, idealRP);
+        size_t half = accs.size()/2;
+        replay(refArray, accs, 0, half, &ref);
+        replay(idealArray, accs, 0, half, &ideal);
+        vector<uint32_t> sizes(partitions);
+        uint32_t left = buckets;
+        for (uint32_t p = 0; p < partitions; p++) {
+            sizes[p] = (p == partitions - 1)? left : rnd.randInt(left);
+            left -= sizes[p];
+        }
+        refRP->setPartitionSizes(&sizes[0]);
+        idealRP->setPartitionSizes(&sizes[0]);
+        replay(refArray, accs, half, accs.size(), &ref);
+        replay(idealArray, accs, half, accs.size(), &ideal);
+        compare("Partitioned LRU", numLines, ref, ideal);
+        if (refMon->hash != idealMon->hash) panic("Partitioned LRU, %d lines: monitors saw different accesses", numLines);
+    }
+    info("%d rounds: ideal and reference arrays agree on every access", rounds);
+}
+
+static void bench(uint32_t numLines, uint32_t numAccesses) {
+    const uint32_t partitions = 8;
+    vector<Access> accs = genStream(numLines, numAccesses, partitions, 1);
+    uint64_t ns[4];
+    uint64_t misses[4];
+    for (uint32_t v = 0; v < 4; v++) {
+        CacheArray* array;
+        if (v == 0) {
+            array = new ListLRUArray(numLines);
+        } else if (v == 1) {
+            array = new IdealLRUArray(numLines);
+        } else {
+            SrcPartMapper* mapper = new SrcPartMapper(partitions);
+            HashMonitor* mon = new HashMonitor(partitions);
+            if (v == 2) array = new ListLRUPartArray(numLines, new ListLRUPartReplPolicy(mon, mapper, numLines, 256));
+            else array = new IdealLRUPartArray(numLines, new IdealLRUPartReplPolicy(mon, mapper, numLines, 256));
+        }
+        uint64_t startNs = getNs();
+        misses[v] = replay(array, accs, 0, accs.size(), nullptr);
+        ns[v] = getNs() - startNs;
+    }
+    if (misses[0] != misses[1] || misses[2] != misses[3]) panic("%d lines: miss counts differ", numLines);
+    info("%9d %10.3f %10.1f %9.1f %9.2f %11.1f %12.1f %9.2f", numLines, ((double)misses[0])/numAccesses,
+            ((double)ns[0])/numAccesses, ((double)ns[1])/numAccesses, ((double)ns[0])/ns[1],
+            ((double)ns[2])/numAccesses, ((double)ns[3])/numAccesses, ((double)ns[2])/ns[3]);
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc > 3) {
+        info("Checks IdealLRUArray and IdealLRUPartArray against list-based exact LRU, and benchmarks both");
+        info("Usage: %s [<check rounds, default 300> [<accesses per benchmark, default 20M>]]", argv[0]);
+        exit(1);
+    }
+    uint32_t rounds = (argc >= 2)? strtoul(argv[1], nullptr, 0) : 300;
+    uint32_t numAccesses = (argc >= 3)? strtoul(argv[2], nullptr, 0) : 20000000;
+
+    gm_init(1024<<20 /*1 GB*/);
+
+    check(rounds);
+
+    info("%9s %10s %10s %9s %9s %11s %12s %9s", "Lines", "Miss rate", "List ns", "Ideal ns", "Speedup",
+            "ListPart ns", "IdealPart ns", "Speedup");
+    for (uint32_t numLines : {1u << 12, 1u << 15, 1u << 18, 1u << 21}) bench(numLines, numAccesses);
+    return 0;
+}
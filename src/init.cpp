@@ -41,6 +41,7 @@
 #include "detailed_mem_params.h"
 #include "ddr_mem.h"
 #include "debug_zsim.h"
+#include "decode_cache.h"
 #include "dramsim_mem_ctrl.h"
 #include "event_queue.h"
 #include "filter_cache.h"
@@ -54,6 +55,7 @@
 #include "null_core.h"
 #include "ooo_core.h"
 #include "part_repl_policies.h"
+#include "phase_controller.h"
 #include "pin_cmd.h"
 #include "prefetcher.h"
 #include "proc_stats.h"
@@ -84,6 +86,26 @@ extern void EndOfPhaseActions(); //in zsim.cpp
  * follow the layout of zinfo, top-down.
  */
 
+/* Weave domain placement. Each kind of component (cores, cache banks, memory controllers) is spread evenly over
+ * placement slots. By default there is one slot per domain; with sim.domainMap, there is one slot per map entry,
+ * and the map gives each slot's domain. A run with sim.tuneDomains proposes such a map.
+ */
+static vector<uint32_t> domainMap;
+
+static uint32_t GetDomainSlots() {
+    return domainMap.empty()? zinfo->numDomains : domainMap.size();
+}
+
+static uint32_t SlotDomain(uint32_t slot) {
+    assert(slot < GetDomainSlots());
+    return domainMap.empty()? slot : domainMap[slot];
+}
+
+// Domain of component idx out of num components of its kind
+static uint32_t PlaceDomain(uint32_t idx, uint32_t num) {
+    return SlotDomain(((uint64_t)idx)*GetDomainSlots()/num);
+}
+
 BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name, uint32_t bankSize, bool isTerminal, uint32_t domain) {
     string type = config.get<const char*>(prefix + "type", "Simple");
     // Shortcut for TraceDriven type
@@ -230,7 +252,10 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
 
         // Partitioner
         // TODO: Depending on partitioner type, we want one per bank or one per cache.
-        Partitioner* p = new LookaheadPartitioner(prp, pm->getNumPartitions(), buckets, 1, allocPortion);
+        // Peekahead gives the same allocations as the original lookahead, faster
+        string partitioner = config.get<const char*>(prefix + "repl.partitioner", "Peekahead");
+        if (partitioner != "Peekahead" && partitioner != "Lookahead") panic("Invalid repl.partitioner %s on %s", partitioner.c_str(), name.c_str());
+        Partitioner* p = new LookaheadPartitioner(prp, pm->getNumPartitions(), buckets, 1, allocPortion, nullptr, partitioner == "Peekahead");
 
         //Schedule its tick
         uint32_t interval = config.get<uint32_t>(prefix + "repl.interval", 5000); //phases
@@ -249,7 +274,8 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
     // ReplPolicy* dataRP = nullptr;
     // uint32_t tagRatio = config.get<uint32_t>(prefix + "tagRatio", 1);
     if (arrayType == "SetAssoc") {
-        array = new SetAssocArray(numLines, ways, rp, hf);
+        bool wideTagMatch = config.get<bool>(prefix + "array.wideTagMatch", false);  // AVX2 tags compares, see tag_match.h
+        array = new SetAssocArray(numLines, ways, rp, hf, wideTagMatch);
     } else if (arrayType == "S") {
         // tagRP = new LRUReplPolicy<true>(numLines*tagRatio);
         // dataRP = new LRUReplPolicy<false>(numLines);
@@ -345,6 +371,7 @@ DDRMemory* BuildDDRMemory(Config& config, uint32_t lineSize, uint32_t frequency,
     // If set, writes are deferred and bursted out to reduce WTR overheads
     bool deferWrites = config.get<bool>(prefix + "deferWrites", true);
     bool closedPage = config.get<bool>(prefix + "closedPage", true);
+    bool bankXor = config.get<bool>(prefix + "bankXor", false);
 
     // Max row hits before we stop prioritizing further row hits to this bank.
     // Balances throughput and fairness; 0 -> FCFS / high (e.g., -1) -> pure FR-FCFS
@@ -355,11 +382,14 @@ DDRMemory* BuildDDRMemory(Config& config, uint32_t lineSize, uint32_t frequency,
     uint32_t controllerLatency = config.get<uint32_t>(prefix + "controllerLatency", 10);  // in system cycles
 
     auto mem = new DDRMemory(zinfo->lineSize, pageSize, ranksPerChannel, banksPerRank, frequency, tech,
-            addrMapping, controllerLatency, queueDepth, maxRowHits, deferWrites, closedPage, domain, name);
+            addrMapping, controllerLatency, queueDepth, maxRowHits, deferWrites, closedPage, bankXor, domain, name);
     return mem;
 }
 
-MemObject* BuildMemoryController(Config& config, uint32_t lineSize, uint32_t frequency, uint32_t domain, g_string& name) {
+// slots is the number of placement slots this controller can spread over, starting at slot (see PlaceDomain)
+MemObject* BuildMemoryController(Config& config, uint32_t lineSize, uint32_t frequency, uint32_t slot, uint32_t slots, g_string& name) {
+    uint32_t domain = SlotDomain(slot);
+
     //Type
     string type = config.get<const char*>("sys.mem.type", "Simple");
 
@@ -378,6 +408,14 @@ MemObject* BuildMemoryController(Config& config, uint32_t lineSize, uint32_t fre
         uint32_t bandwidth = config.get<uint32_t>("sys.mem.bandwidth", 6400);
 
         mem = new MD1Memory(lineSize, frequency, bandwidth, latency, name);
+    } else if (type == "BankedMG1") {
+        // Peak data bus bandwidth (in MB/s); latency is the zero-load row hit latency
+        uint32_t bandwidth = config.get<uint32_t>("sys.mem.bandwidth", 6400);
+        uint32_t rowMissPenalty = config.get<uint32_t>("sys.mem.rowMissPenalty", 40);  // in core cycles
+        uint32_t banks = config.get<uint32_t>("sys.mem.banks", 32);  // total across ranks
+        uint32_t rowSize = config.get<uint32_t>("sys.mem.rowSize", 8192);  // in bytes
+        uint32_t rowSampleRate = config.get<uint32_t>("sys.mem.rowSampleRate", 4);  // track 1 in N banks' open rows
+        mem = new BankedMG1Memory(lineSize, frequency, bandwidth, latency, rowMissPenalty, banks, rowSize, rowSampleRate, name);
     } else if (type == "WeaveMD1") {
         uint32_t bandwidth = config.get<uint32_t>("sys.mem.bandwidth", 6400);
         uint32_t boundLatency = config.get<uint32_t>("sys.mem.boundLatency", latency);
@@ -386,7 +424,23 @@ MemObject* BuildMemoryController(Config& config, uint32_t lineSize, uint32_t fre
         uint32_t boundLatency = config.get<uint32_t>("sys.mem.boundLatency", 100);
         mem = new WeaveSimpleMemory(latency, boundLatency, domain, name);
     } else if (type == "DDR") {
-        mem = BuildDDRMemory(config, lineSize, frequency, domain, name, "sys.mem.");
+        uint32_t channels = config.get<uint32_t>("sys.mem.channels", 1);
+        if (channels == 1) {
+            mem = BuildDDRMemory(config, lineSize, frequency, domain, name, "sys.mem.");
+        } else {
+            // Each channel gets its own slice of this controller's slots
+            uint32_t interleave = config.get<uint32_t>("sys.mem.channelInterleave", 1);  // in lines
+            bool xorHash = config.get<bool>("sys.mem.channelXorHash", false);
+            g_vector<DDRMemory*> chans;
+            for (uint32_t c = 0; c < channels; c++) {
+                stringstream ss;
+                ss << name << "-ch" << c;
+                g_string chName(ss.str().c_str());
+                uint32_t chDomain = SlotDomain(slot + c*slots/channels);
+                chans.push_back(BuildDDRMemory(config, lineSize, frequency, chDomain, chName, "sys.mem."));
+            }
+            mem = new MultiChannelDDRMemory(chans, interleave, xorHash, name);
+        }
     } else if (type == "DRAMSim") {
         uint64_t cpuFreqHz = 1000000 * frequency;
         uint32_t capacity = config.get<uint32_t>("sys.mem.capacityMB", 16384);
@@ -447,7 +501,7 @@ CacheGroup* BuildCacheGroup(Config& config, const string& name, bool isTerminal)
                 ss << "b" << j;
             }
             g_string bankName(ss.str().c_str());
-            uint32_t domain = (i*banks + j)*zinfo->numDomains/(caches*banks); //(banks > 1)? nextDomain() : (i*banks + j)*zinfo->numDomains/(caches*banks);
+            uint32_t domain = PlaceDomain(i*banks + j, caches*banks);
             cg[i][j] = BuildCacheBank(config, prefix, bankName, bankSize, isTerminal, domain);
         }
     }
@@ -540,9 +594,9 @@ static void InitSystem(Config& config) {
         stringstream ss;
         ss << "mem-" << i;
         g_string name(ss.str().c_str());
-        //uint32_t domain = nextDomain(); //i*zinfo->numDomains/memControllers;
-        uint32_t domain = i*zinfo->numDomains/memControllers;
-        mems[i] = BuildMemoryController(config, zinfo->lineSize, zinfo->freqMHz, domain, name);
+        uint32_t slot = i*GetDomainSlots()/memControllers;
+        uint32_t slots = MAX((uint32_t)1, (i+1)*GetDomainSlots()/memControllers - slot);
+        mems[i] = BuildMemoryController(config, zinfo->lineSize, zinfo->freqMHz, slot, slots, name);
     }
 
     if (memControllers > 1) {
@@ -731,7 +785,7 @@ static void InitSystem(Config& config) {
                     if (type == "Simple") {
                         core = new (&simpleCores[j]) SimpleCore(ic, dc, sc, name);
                     } else if (type == "Timing") {
-                        uint32_t domain = j*zinfo->numDomains/cores;
+                        uint32_t domain = PlaceDomain(j, cores);
                         TimingCore* tcore = new (&timingCores[j]) TimingCore(ic, dc, domain, name);
                         zinfo->eventRecorders[coreIdx] = tcore->getEventRecorder();
                         zinfo->eventRecorders[coreIdx]->setSourceId(coreIdx);
@@ -878,7 +932,7 @@ static void PostInitStats(bool perProcessDir, Config& config) {
                 zinfo->trigger = i;
                 zinfo->eventualStatsBackend->dump(true /*buffered*/);
             };
-            zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, dumpStats, 0, zinfo->maxMinInstrs, MAX_IPC*zinfo->phaseLength));
+            zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, dumpStats, 0, zinfo->maxMinInstrs, MAX_IPC*MaxPhaseLength()));
         }
     }
 
@@ -895,6 +949,11 @@ static void InitGlobalStats() {
     zinfo->profSimTime->init("time", "Simulator time breakdown", 4, stateNames);
     zinfo->rootStat->append(zinfo->profSimTime);
 
+    zinfo->profEndOfPhase = new TimeBreakdownStat();
+    const char* eopStateNames[] = {"none", "pause", "termCheck", "weave", "phaseCtrl", "events"};
+    zinfo->profEndOfPhase->init("eopTime", "End-of-phase actions time breakdown", 6, eopStateNames);
+    zinfo->rootStat->append(zinfo->profEndOfPhase);
+
     ProxyStat* triggerStat = new ProxyStat();
     triggerStat->init("trigger", "Reason for this stats dump", &zinfo->trigger);
     zinfo->rootStat->append(triggerStat);
@@ -948,6 +1007,32 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
     zinfo->numDomains = config.get<uint32_t>("sim.domains", 1);
     uint32_t numSimThreads = config.get<uint32_t>("sim.contentionThreads", MAX((uint32_t)1, zinfo->numDomains/2)); //gives a bit of parallelism, TODO tune
     zinfo->contentionSim = new ContentionSim(zinfo->numDomains, numSimThreads);
+    //Weave sampling: run the weave phase on 1 of every weaveSamplePeriod phases, and have cores predict their contention delays on the rest
+    uint32_t weaveSamplePeriod = config.get<uint32_t>("sim.weaveSamplePeriod", 1);
+    double weaveSampleAlpha = config.get<double>("sim.weaveSampleAlpha", 0.5);
+    zinfo->contentionSim->setWeaveSampling(weaveSamplePeriod, weaveSampleAlpha);
+    //Domains that keep far-future events in a timing wheel instead of a map: "all", or a list of domain ids
+    string wheelDomains = config.get<const char*>("sim.wheelDomains", "");
+    if (wheelDomains == "all") {
+        for (uint32_t i = 0; i < zinfo->numDomains; i++) zinfo->contentionSim->setFarWheel(i);
+    } else {
+        for (uint32_t d : ParseList<uint32_t>(wheelDomains)) {
+            if (d >= zinfo->numDomains) panic("sim.wheelDomains: invalid domain %d, there are %d", d, zinfo->numDomains);
+            zinfo->contentionSim->setFarWheel(d);
+        }
+    }
+    //Domain placement (see PlaceDomain): sim.domainMap gives the domain of each placement slot, and, if
+    //sim.tuneDomains is set, this run proposes a map of its domains onto that many domains at the end
+    domainMap = ParseList<uint32_t>(config.get<const char*>("sim.domainMap", ""));
+    for (uint32_t d : domainMap) {
+        if (d >= zinfo->numDomains) panic("sim.domainMap: invalid domain %d, there are %d", d, zinfo->numDomains);
+    }
+    uint32_t tuneDomains = config.get<uint32_t>("sim.tuneDomains", 0);
+    if (tuneDomains) {
+        vector<uint32_t> slots;
+        for (uint32_t s = 0; s < GetDomainSlots(); s++) slots.push_back(SlotDomain(s));
+        zinfo->contentionSim->setDomainTuning(tuneDomains, slots);
+    }
     zinfo->contentionSim->initStats(zinfo->rootStat);
     zinfo->eventRecorders = gm_calloc<EventRecorder*>(zinfo->numCores);
 
@@ -957,6 +1042,24 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
     zinfo->numPhases = 0;
 
     zinfo->phaseLength = config.get<uint32_t>("sim.phaseLength", 10000);
+    zinfo->nextPhaseLength = zinfo->phaseLength;
+    if (config.get<bool>("sim.adaptivePhaseLength", false)) {
+        uint32_t minPhaseLength = config.get<uint32_t>("sim.minPhaseLength", MAX(zinfo->phaseLength/4, 1u));
+        uint32_t maxPhaseLength = config.get<uint32_t>("sim.maxPhaseLength", zinfo->phaseLength*4);
+        if (zinfo->phaseLength < minPhaseLength || zinfo->phaseLength > maxPhaseLength) {
+            panic("sim.phaseLength (%d) must be within sim.minPhaseLength (%d) and sim.maxPhaseLength (%d)", zinfo->phaseLength, minPhaseLength, maxPhaseLength);
+        }
+        double growSkew = config.get<double>("sim.phaseGrowSkew", 0.01);
+        double shrinkSkew = config.get<double>("sim.phaseShrinkSkew", 0.05);
+        double shrinkRetries = config.get<double>("sim.phaseShrinkXingRetries", 1.0);
+        double shrinkQueueDelay = config.get<double>("sim.phaseShrinkQueueDelay", 100.0);  // mean cycles/request over zero-load latency
+        uint32_t growHysteresis = config.get<uint32_t>("sim.phaseGrowHysteresis", 4);
+        zinfo->phaseController = new PhaseLengthController(minPhaseLength, maxPhaseLength, growSkew, shrinkSkew, shrinkRetries,
+                shrinkQueueDelay, growHysteresis);
+        zinfo->phaseController->initStats(zinfo->rootStat);
+    } else {
+        zinfo->phaseController = nullptr;
+    }
     zinfo->statsPhaseInterval = config.get<uint32_t>("sim.statsPhaseInterval", 100);
     zinfo->freqMHz = config.get<uint32_t>("sys.frequency", 2000);
 
@@ -990,8 +1093,11 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
         if (parallelism < zinfo->numCores) info("Limiting concurrent threads to %d", parallelism);
         assert(parallelism > 0); //jeez...
 
+        //Threads wake each other up in a tree with this fan-out at the start of each phase; 0 wakes them serially
+        uint32_t barrierFanout = config.get<uint32_t>("sim.barrierFanout", 0);
+
         uint32_t schedQuantum = config.get<uint32_t>("sim.schedQuantum", 10000); //phases
-        zinfo->sched = new Scheduler(EndOfPhaseActions, parallelism, zinfo->numCores, schedQuantum);
+        zinfo->sched = new Scheduler(EndOfPhaseActions, parallelism, barrierFanout, zinfo->numCores, schedQuantum);
     } else {
         zinfo->sched = nullptr;
     }
@@ -1026,6 +1132,18 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
     //Caches, cores, memory controllers
     InitSystem(config);
 
+    //Decoded BBL cache (needs oooDecode, which is set when building the cores)
+    //Persistent if a file is given; otherwise, used only to share decoded BBLs across processes
+    string decodeCacheFile = config.get<const char*>("sim.decodeCacheFile", "");
+    bool shareDecodedBbls = config.get<bool>("sim.shareDecodedBbls", zinfo->numProcs > 1);
+    if (!decodeCacheFile.empty() || shareDecodedBbls) {
+        uint32_t decodeCacheBuckets = config.get<uint32_t>("sim.decodeCacheBuckets", 1 << 16);
+        zinfo->decodeCache = new DecodeCache(decodeCacheFile.empty()? nullptr : decodeCacheFile.c_str(), zinfo->oooDecode, decodeCacheBuckets);
+        zinfo->decodeCache->initStats(zinfo->rootStat);
+    } else {
+        zinfo->decodeCache = nullptr;
+    }
+
     //Sched stats (deferred because of circular deps)
     if (zinfo->sched) zinfo->sched->initStats(zinfo->rootStat);
 
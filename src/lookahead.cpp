@@ -24,7 +24,9 @@
  */
 
 #include <algorithm>
+#include <queue>
 #include <tuple>
+#include <vector>
 #include "part_repl_policies.h"
 #include "partitioner.h"
 
@@ -110,19 +112,176 @@ void computeBestPartitioning(
 
 }  // namespace lookahead
 
+/* Peekahead: same allocations as lookahead, but precomputes the lower convex
+ * hull of each miss curve, so the best marginal utility of a partition is
+ * just the slope to its next hull point, and keeps partitions in a max-heap
+ * (see Beckmann and Sanchez, Jigsaw, PACT 2013). Costs O(P*B + S*log(P)) for
+ * S allocation steps, vs O(P*B^2) for lookahead.
+ *
+ * To match lookahead's choices exactly, including ties (lookahead picks the
+ * smallest allocation among equal utilities, and the lowest partition):
+ *  - Hulls keep collinear points, so the next hull point is the closest one
+ *    with the maximum marginal utility.
+ *  - Utilities are compared as exact fractions. Lookahead compares doubles,
+ *    which gives the same order as long as misses < 2^32 and buckets < 2^20.
+ *  - When the next hull point is beyond the remaining balance, the best
+ *    allocation is within the segment, so we scan as lookahead does. Heap
+ *    entries made stale by a shrinking balance are re-evaluated on pop;
+ *    utilities only drop as the balance shrinks, so the top valid entry is
+ *    the true maximum.
+ * Hulls require non-increasing miss curves (always true for UMONs); on
+ * others, lookahead's unsigned arithmetic gives different utilities, so we
+ * just run lookahead.
+ */
+namespace peekahead {
+
+struct HullPoint {
+    uint32_t x;
+    uint32_t y;
+};
+
+struct Candidate {
+    uint64_t extraHits;  // utility is extraHits/alloc
+    uint32_t alloc;
+    uint32_t part;
+};
+
+// For the max-heap: higher utility first, then lower partition
+struct CandidateLess {
+    bool operator()(const Candidate& a, const Candidate& b) const {
+        uint64_t au = a.extraHits*b.alloc;
+        uint64_t bu = b.extraHits*a.alloc;
+        return (au < bu) || (au == bu && a.part > b.part);
+    }
+};
+
+class PartitionCurve {
+    private:
+        uint32_t start;
+        std::vector<uint32_t> misses;  // indexed by alloc - start
+        std::vector<HullPoint> hull;
+        uint32_t hullIdx;
+
+        uint32_t get(uint32_t alloc) const { return misses[alloc - start]; }
+
+    public:
+        // Returns false if the curve is not non-increasing
+        bool init(uint32_t part, uint32_t _start, uint32_t end, const PartitionMonitor& monitor) {
+            start = _start;
+            misses.resize(end - start + 1);
+            for (uint32_t x = start; x <= end; x++) {
+                misses[x - start] = monitor.get(part, x);
+                if (x > start && misses[x - start] > misses[x - start - 1]) return false;
+            }
+
+            // Monotone chain; drops only points strictly above the hull
+            hull.clear();
+            for (uint32_t x = start; x <= end; x++) {
+                HullPoint c = {x, get(x)};
+                while (hull.size() >= 2) {
+                    const HullPoint& h0 = hull[hull.size()-2];
+                    const HullPoint& h1 = hull[hull.size()-1];
+                    int64_t lhs = ((int64_t)h1.y - (int64_t)h0.y)*((int64_t)c.x - (int64_t)h0.x);
+                    int64_t rhs = ((int64_t)c.y - (int64_t)h0.y)*((int64_t)h1.x - (int64_t)h0.x);
+                    if (lhs > rhs) hull.pop_back();
+                    else break;
+                }
+                hull.push_back(c);
+            }
+            hullIdx = 0;
+            return true;
+        }
+
+        Candidate best(uint32_t part, uint32_t curAlloc, uint32_t balance) const {
+            assert(balance > 0);
+            Candidate c;
+            c.part = part;
+            if (hull[hullIdx].x == curAlloc && hullIdx + 1 < hull.size() && hull[hullIdx+1].x - curAlloc <= balance) {
+                c.alloc = hull[hullIdx+1].x - curAlloc;
+                c.extraHits = get(curAlloc) - hull[hullIdx+1].y;
+            } else {
+                // Next hull point out of reach, or we're off the hull after an earlier scan
+                c.alloc = 1;
+                c.extraHits = get(curAlloc) - get(curAlloc + 1);
+                for (uint32_t i = 2; i <= balance; i++) {
+                    uint64_t extraHits = get(curAlloc) - get(curAlloc + i);
+                    if (extraHits*c.alloc > c.extraHits*i) {
+                        c.alloc = i;
+                        c.extraHits = extraHits;
+                    }
+                }
+            }
+            return c;
+        }
+
+        void advance(uint32_t newAlloc) {
+            while (hullIdx + 1 < hull.size() && hull[hullIdx+1].x <= newAlloc) hullIdx++;
+        }
+};
+
+void computeBestPartitioning(
+    uint32_t numPartitions, uint32_t buckets, uint32_t minAlloc, bool* forbidden,
+    uint32_t* allocs, const PartitionMonitor& monitor) {
+    uint32_t balance = buckets;
+
+    // Zero out allocs or set to mins
+    for (uint32_t i = 0; i < numPartitions; i++) {
+        allocs[i] = minAlloc;
+    }
+
+    balance -= minAlloc;
+    if (!balance) return;
+    uint32_t maxAlloc = minAlloc + balance;
+
+    std::vector<PartitionCurve> curves(numPartitions);
+    for (uint32_t i = 0; i < numPartitions; i++) {
+        if (forbidden && forbidden[i]) continue;
+        if (!curves[i].init(i, minAlloc, maxAlloc, monitor)) {
+            lookahead::computeBestPartitioning(numPartitions, buckets, minAlloc, forbidden, allocs, monitor);
+            return;
+        }
+    }
+
+    std::priority_queue<Candidate, std::vector<Candidate>, CandidateLess> heap;
+    for (uint32_t i = 0; i < numPartitions; i++) {
+        if (forbidden && forbidden[i]) continue;  // this partition doesn't get anything
+        heap.push(curves[i].best(i, allocs[i], balance));
+    }
+
+    while (balance > 0) {
+        assert_msg(!heap.empty(), "All partitions are forbidden");
+        Candidate c = heap.top();
+        heap.pop();
+        while (c.alloc > balance) {
+            // Stale, computed with a larger balance
+            heap.push(curves[c.part].best(c.part, allocs[c.part], balance));
+            c = heap.top();
+            heap.pop();
+        }
+
+        allocs[c.part] += c.alloc;
+        balance -= c.alloc;
+        curves[c.part].advance(allocs[c.part]);
+        if (balance) heap.push(curves[c.part].best(c.part, allocs[c.part], balance));
+    }
+}
+
+}  // namespace peekahead
+
 // LookaheadPartitioner
 
 LookaheadPartitioner::LookaheadPartitioner(PartReplPolicy* _repl, uint32_t _numPartitions, uint32_t _buckets,
-                                           uint32_t _minAlloc, double _allocPortion, bool* _forbidden)
+                                           uint32_t _minAlloc, double _allocPortion, bool* _forbidden, bool _useHulls)
         : Partitioner(_minAlloc, _allocPortion, _forbidden)
         , repl(_repl)
         , numPartitions(_numPartitions)
-        , buckets(_buckets) {
+        , buckets(_buckets)
+        , useHulls(_useHulls) {
     assert_msg(buckets > 0, "Must have non-zero buckets to avoid divide-by-zero exception.");
 
     curAllocs = gm_calloc<uint32_t>(buckets + 1);
 
-    info("LookaheadPartitioner: %d part buckets", buckets);
+    info("LookaheadPartitioner: %d part buckets, %s", buckets, useHulls? "peekahead" : "lookahead");
 }
 
 //allocs are in buckets
@@ -130,9 +289,15 @@ void LookaheadPartitioner::partition() {
     auto& monitor = *repl->getMonitor();
 
     uint32_t bestAllocs[numPartitions];
-    lookahead::computeBestPartitioning(
-        numPartitions, allocPortion*buckets, minAlloc*numPartitions,
-        forbidden, bestAllocs, monitor);
+    if (useHulls) {
+        peekahead::computeBestPartitioning(
+            numPartitions, allocPortion*buckets, minAlloc*numPartitions,
+            forbidden, bestAllocs, monitor);
+    } else {
+        lookahead::computeBestPartitioning(
+            numPartitions, allocPortion*buckets, minAlloc*numPartitions,
+            forbidden, bestAllocs, monitor);
+    }
 
     uint64_t newUtility = lookahead::computePartitioningTotalUtility(
         numPartitions, bestAllocs, monitor);
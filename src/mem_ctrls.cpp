@@ -26,6 +26,9 @@
 //#include "timing_event.h"
 //#include "event_recorder.h"
 #include "mem_ctrls.h"
+#include <string.h>
+#include "bithacks.h"
+#include "event_queue.h"
 #include "zsim.h"
 
 uint64_t SimpleMemory::access(MemReq& req) {
@@ -60,10 +63,20 @@ uint64_t SimpleMemory::access(MemReq& req) {
 
 
 
+// Recomputes the MD1 latency at the end of every phase
+class MD1UpdateEvent : public Event {
+    private:
+        MD1Memory* mem;
+
+    public:
+        explicit MD1UpdateEvent(MD1Memory* _mem) : Event(1), mem(_mem) {}
+        void callback() { mem->updateLatency(); }
+};
+
 MD1Memory::MD1Memory(uint32_t requestSize, uint32_t megacyclesPerSecond, uint32_t megabytesPerSecond, uint32_t _zeroLoadLatency, g_string& _name)
     : zeroLoadLatency(_zeroLoadLatency), name(_name)
 {
-    lastPhase = 0;
+    lastUpdateCycle = 0;
 
     double bytesPerCycle = ((double)megabytesPerSecond)/((double)megacyclesPerSecond);
     maxRequestsPerCycle = bytesPerCycle/requestSize;
@@ -72,23 +85,52 @@ MD1Memory::MD1Memory(uint32_t requestSize, uint32_t megacyclesPerSecond, uint32_
     zeroLoadLatency = _zeroLoadLatency;
 
     smoothedPhaseAccesses = 0.0;
-    curPhaseAccesses = 0;
+    unaccountedAccesses = 0;
     curLatency = zeroLoadLatency;
 
-    futex_init(&updateLock);
+    // srcIds are core ids, except in trace-driven runs, which have no cores; slots absorb any collisions
+    numCountSlots = MAX(zinfo->numCores, (uint32_t)1);
+    coreCounts = gm_memalign<CoreCounts>(CACHE_LINE_BYTES, numCountSlots);
+    memset(coreCounts, 0, sizeof(CoreCounts)*numCountSlots);
+
+    zinfo->eventQueue->insert(new MD1UpdateEvent(this), 0);
+}
+
+void MD1Memory::initStats(AggregateStat* parentStat) {
+    AggregateStat* memStats = new AggregateStat();
+    memStats->init(name.c_str(), "Memory controller stats");
+    auto rdStat = makeLambdaStat([this]() { return sumCounts([](const CoreCounts& c) { return c.reads; }); });
+    rdStat->init("rd", "Read requests"); memStats->append(rdStat);
+    auto wrStat = makeLambdaStat([this]() { return sumCounts([](const CoreCounts& c) { return c.writes; }); });
+    wrStat->init("wr", "Write requests"); memStats->append(wrStat);
+    auto rdLatStat = makeLambdaStat([this]() { return sumCounts([](const CoreCounts& c) { return c.rdLat; }); });
+    rdLatStat->init("rdlat", "Total latency experienced by read requests"); memStats->append(rdLatStat);
+    auto wrLatStat = makeLambdaStat([this]() { return sumCounts([](const CoreCounts& c) { return c.wrLat; }); });
+    wrLatStat->init("wrlat", "Total latency experienced by write requests"); memStats->append(wrLatStat);
+    profLoad.init("load", "Sum of load factors (0-100) per update"); memStats->append(&profLoad);
+    profUpdates.init("ups", "Number of latency updates"); memStats->append(&profUpdates);
+    profClampedLoads.init("clampedLoads", "Number of updates where the load was clamped to 95%"); memStats->append(&profClampedLoads);
+    parentStat->append(memStats);
 }
 
 void MD1Memory::updateLatency() {
-    uint32_t phaseCycles = (zinfo->numPhases - lastPhase)*(zinfo->phaseLength);
+    // Runs at the end of the phase, while no bound-phase accesses are in flight
+    for (uint32_t i = 0; i < numCountSlots; i++) {
+        unaccountedAccesses += coreCounts[i].phaseAccesses;
+        coreCounts[i].phaseAccesses = 0;
+    }
+
+    uint64_t phaseEndCycle = zinfo->globPhaseCycles + zinfo->phaseLength;  // globPhaseCycles denotes the start of the phase that is ending
+    uint32_t phaseCycles = phaseEndCycle - lastUpdateCycle;
     if (phaseCycles < 10000) return; //Skip with short phases
 
-    smoothedPhaseAccesses =  (curPhaseAccesses*0.5) + (smoothedPhaseAccesses*0.5);
+    smoothedPhaseAccesses =  (unaccountedAccesses*0.5) + (smoothedPhaseAccesses*0.5);
     double requestsPerCycle = smoothedPhaseAccesses/((double)phaseCycles);
     double load = requestsPerCycle/maxRequestsPerCycle;
 
     //Clamp load
     if (load > 0.95) {
-        //warn("MC: Load exceeds limit, %f, clamping, curPhaseAccesses %d, smoothed %f, phase %ld", load, curPhaseAccesses, smoothedPhaseAccesses, zinfo->numPhases);
+        //warn("MC: Load exceeds limit, %f, clamping, unaccountedAccesses %ld, smoothed %f, phase %ld", load, unaccountedAccesses, smoothedPhaseAccesses, zinfo->numPhases);
         load = 0.95;
         profClampedLoads.inc();
     }
@@ -101,47 +143,228 @@ void MD1Memory::updateLatency() {
     profLoad.inc(intLoad);
     profUpdates.inc();
 
-    curPhaseAccesses = 0;
-    __sync_synchronize();
-    lastPhase = zinfo->numPhases;
+    unaccountedAccesses = 0;
+    lastUpdateCycle = phaseEndCycle;
 }
 
 uint64_t MD1Memory::access(MemReq& req) {
-    if (zinfo->numPhases > lastPhase) {
-        futex_lock(&updateLock);
-        //Recheck, someone may have updated already
-        if (zinfo->numPhases > lastPhase) {
-            updateLatency();
-        }
-        futex_unlock(&updateLock);
-    }
-
+    // Each slot is mostly written by one core, so these atomics stay in its private cache
+    CoreCounts& cc = coreCounts[req.srcId % numCountSlots];
+    uint32_t latency = curLatency;
     switch (req.type) {
         case PUTX:
             //Dirty wback
-            profWrites.atomicInc();
-            profTotalWrLat.atomicInc(curLatency);
-            __sync_fetch_and_add(&curPhaseAccesses, 1);
+            __sync_fetch_and_add(&cc.writes, 1);
+            __sync_fetch_and_add(&cc.wrLat, latency);
+            __sync_fetch_and_add(&cc.phaseAccesses, 1);
             //Note no break
         case PUTS:
             //Not a real access -- memory must treat clean wbacks as if they never happened.
             *req.state = I;
             break;
         case GETS:
-            profReads.atomicInc();
-            profTotalRdLat.atomicInc(curLatency);
-            __sync_fetch_and_add(&curPhaseAccesses, 1);
+            __sync_fetch_and_add(&cc.reads, 1);
+            __sync_fetch_and_add(&cc.rdLat, latency);
+            __sync_fetch_and_add(&cc.phaseAccesses, 1);
             *req.state = req.is(MemReq::NOEXCL)? S : E;
             break;
         case GETX:
-            profReads.atomicInc();
-            profTotalRdLat.atomicInc(curLatency);
-            __sync_fetch_and_add(&curPhaseAccesses, 1);
+            __sync_fetch_and_add(&cc.reads, 1);
+            __sync_fetch_and_add(&cc.rdLat, latency);
+            __sync_fetch_and_add(&cc.phaseAccesses, 1);
             *req.state = M;
             break;
 
         default: panic("!?");
     }
-    return req.cycle + ((req.type == PUTS)? 0 /*PUTS is not a real access*/ : curLatency);
+    return req.cycle + ((req.type == PUTS)? 0 /*PUTS is not a real access*/ : latency);
+}
+
+
+// Recomputes the bank latencies at the end of every phase
+class BankedMG1UpdateEvent : public Event {
+    private:
+        BankedMG1Memory* mem;
+
+    public:
+        explicit BankedMG1UpdateEvent(BankedMG1Memory* _mem) : Event(1), mem(_mem) {}
+        void callback() { mem->updateLatency(); }
+};
+
+BankedMG1Memory::BankedMG1Memory(uint32_t lineSize, uint32_t megacyclesPerSecond, uint32_t megabytesPerSecond, uint32_t _zeroLoadLatency,
+        uint32_t _rowMissPenalty, uint32_t _numBanks, uint32_t rowBytes, uint32_t _rowSampleRate, g_string& _name)
+    : zeroLoadLatency(_zeroLoadLatency), rowMissPenalty(_rowMissPenalty), numBanks(_numBanks),
+      rowLines(rowBytes/lineSize), rowSampleRate(_rowSampleRate), name(_name)
+{
+    lastUpdateCycle = 0;
+
+    double bytesPerCycle = ((double)megabytesPerSecond)/((double)megacyclesPerSecond);
+    maxRequestsPerCycle = bytesPerCycle/lineSize;
+    assert(maxRequestsPerCycle > 0.0);
+    if (!numBanks) panic("%s: need at least one bank", name.c_str());
+    if (!rowLines) panic("%s: row size (%d bytes) must be at least a line", name.c_str(), rowBytes);
+    if (!rowSampleRate || rowSampleRate > numBanks) panic("%s: rowSampleRate must be in [1, banks]", name.c_str());
+
+    // Start from an open-page, no-load estimate
+    smoothedHitRate = 0.5;
+    unaccountedHits = 0;
+    unaccountedSamples = 0;
+    smoothedBankAccesses.resize(numBanks, 0.0);
+    unaccountedBankAccesses.resize(numBanks, 0);
+    bankLatency.resize(numBanks, zeroLoadLatency + rowMissPenalty/2);
+
+    sampledOpenRows.resize((numBanks + rowSampleRate - 1)/rowSampleRate, -1ul);
+
+    // srcIds are core ids, except in trace-driven runs, which have no cores; slots absorb any collisions
+    numCountSlots = MAX(zinfo->numCores, (uint32_t)1);
+    coreCounts = gm_memalign<CoreCounts>(CACHE_LINE_BYTES, numCountSlots);
+    memset(coreCounts, 0, sizeof(CoreCounts)*numCountSlots);
+    uint32_t countsPerLine = CACHE_LINE_BYTES/sizeof(uint32_t);
+    bankCountsStride = (numBanks + countsPerLine - 1)/countsPerLine*countsPerLine;
+    bankCounts = gm_memalign<uint32_t>(CACHE_LINE_BYTES, bankCountsStride*numCountSlots);
+    memset(bankCounts, 0, sizeof(uint32_t)*bankCountsStride*numCountSlots);
+
+    zinfo->eventQueue->insert(new BankedMG1UpdateEvent(this), 0);
+
+    info("%s: %d banks, %d lines/row, sampling 1/%d banks, %.2f lines/cycle, latency %d hit / %d miss",
+            name.c_str(), numBanks, rowLines, rowSampleRate, maxRequestsPerCycle, zeroLoadLatency, zeroLoadLatency + rowMissPenalty);
+}
+
+void BankedMG1Memory::initStats(AggregateStat* parentStat) {
+    AggregateStat* memStats = new AggregateStat();
+    memStats->init(name.c_str(), "Memory controller stats");
+    auto rdStat = makeLambdaStat([this]() { return sumCounts([](const CoreCounts& c) { return c.reads; }); });
+    rdStat->init("rd", "Read requests"); memStats->append(rdStat);
+    auto wrStat = makeLambdaStat([this]() { return sumCounts([](const CoreCounts& c) { return c.writes; }); });
+    wrStat->init("wr", "Write requests"); memStats->append(wrStat);
+    auto rdLatStat = makeLambdaStat([this]() { return sumCounts([](const CoreCounts& c) { return c.rdLat; }); });
+    rdLatStat->init("rdlat", "Total latency experienced by read requests"); memStats->append(rdLatStat);
+    auto wrLatStat = makeLambdaStat([this]() { return sumCounts([](const CoreCounts& c) { return c.wrLat; }); });
+    wrLatStat->init("wrlat", "Total latency experienced by write requests"); memStats->append(wrLatStat);
+    profLoad.init("load", "Sum of data bus load factors (0-100) per update"); memStats->append(&profLoad);
+    profMaxBankLoad.init("maxBankLoad", "Sum of the most loaded bank's load factor (0-100) per update"); memStats->append(&profMaxBankLoad);
+    profHitRate.init("rowHitRate", "Sum of estimated row hit rates (0-100) per update"); memStats->append(&profHitRate);
+    profUpdates.init("ups", "Number of latency updates"); memStats->append(&profUpdates);
+    profClampedLoads.init("clampedLoads", "Number of updates where the bus or a bank load was clamped to 95%"); memStats->append(&profClampedLoads);
+    parentStat->append(memStats);
+}
+
+void BankedMG1Memory::updateLatency() {
+    // Runs at the end of the phase, while no bound-phase accesses are in flight
+    for (uint32_t i = 0; i < numCountSlots; i++) {
+        unaccountedHits += coreCounts[i].sampledHits;
+        unaccountedSamples += coreCounts[i].sampledAccesses;
+        coreCounts[i].sampledHits = 0;
+        coreCounts[i].sampledAccesses = 0;
+        uint32_t* counts = &bankCounts[i*bankCountsStride];
+        for (uint32_t b = 0; b < numBanks; b++) {
+            unaccountedBankAccesses[b] += counts[b];
+            counts[b] = 0;
+        }
+    }
+
+    uint64_t phaseEndCycle = zinfo->globPhaseCycles + zinfo->phaseLength;  // globPhaseCycles denotes the phase that is ending
+    uint32_t phaseCycles = phaseEndCycle - lastUpdateCycle;
+    if (phaseCycles < 10000) return; //Skip with short phases
+
+    if (unaccountedSamples) {
+        double hitRate = ((double)unaccountedHits)/((double)unaccountedSamples);
+        smoothedHitRate = (hitRate*0.5) + (smoothedHitRate*0.5);
+    }
+    double h = smoothedHitRate;
+
+    bool clamped = false;
+    auto clamp = [&clamped](double load) {
+        if (load > 0.95) {
+            clamped = true;
+            return 0.95;
+        }
+        return load;
+    };
+
+    // Data bus, M/D/1
+    double busService = 1.0/maxRequestsPerCycle;
+    double totalAccesses = 0.0;
+    for (uint32_t b = 0; b < numBanks; b++) {
+        smoothedBankAccesses[b] = (unaccountedBankAccesses[b]*0.5) + (smoothedBankAccesses[b]*0.5);
+        totalAccesses += smoothedBankAccesses[b];
+    }
+    double busLoad = clamp(totalAccesses/((double)phaseCycles)/maxRequestsPerCycle);
+    double busWait = busService*0.5*busLoad/(1.0 - busLoad);
+
+    // Banks, M/G/1 with a hit/miss service time mix (Pollaczek-Khinchine)
+    double hitService = busService;
+    double missService = busService + rowMissPenalty;
+    double meanService = h*hitService + (1.0 - h)*missService;
+    double meanSqService = h*hitService*hitService + (1.0 - h)*missService*missService;
+    double baseLatency = zeroLoadLatency + (1.0 - h)*rowMissPenalty + busWait;
+
+    double maxBankLoad = 0.0;
+    for (uint32_t b = 0; b < numBanks; b++) {
+        double arrivalRate = smoothedBankAccesses[b]/((double)phaseCycles);
+        double load = arrivalRate*meanService;
+        if (load > 0.95) arrivalRate = 0.95/meanService;
+        load = clamp(load);
+        maxBankLoad = std::max(maxBankLoad, load);
+        double bankWait = arrivalRate*meanSqService/(2.0*(1.0 - load));
+        bankLatency[b] = (uint32_t)(baseLatency + bankWait);
+        unaccountedBankAccesses[b] = 0;
+    }
+
+    //info("%s: hit rate %.2f, bus load %.2f, max bank load %.2f", name.c_str(), h, busLoad, maxBankLoad);
+    if (clamped) profClampedLoads.inc();
+    profLoad.inc((uint32_t)(busLoad*100.0));
+    profMaxBankLoad.inc((uint32_t)(maxBankLoad*100.0));
+    profHitRate.inc((uint32_t)(h*100.0));
+    profUpdates.inc();
+
+    unaccountedHits = 0;
+    unaccountedSamples = 0;
+    lastUpdateCycle = phaseEndCycle;
 }
 
+uint64_t BankedMG1Memory::access(MemReq& req) {
+    if (req.type == PUTS) {
+        //Not a real access -- memory must treat clean wbacks as if they never happened.
+        *req.state = I;
+        return req.cycle;
+    }
+
+    // Each slot is mostly written by one core, so these atomics stay in its private cache
+    uint32_t slot = req.srcId % numCountSlots;
+    CoreCounts& cc = coreCounts[slot];
+
+    // Banks are interleaved at line granularity; row is above the bank and column bits
+    uint32_t bank = req.lineAddr % numBanks;
+    uint64_t row = req.lineAddr/numBanks/rowLines;
+    __sync_fetch_and_add(&bankCounts[slot*bankCountsStride + bank], 1);
+    if (bank % rowSampleRate == 0) {
+        uint64_t& openRow = sampledOpenRows[bank/rowSampleRate];
+        if (openRow == row) __sync_fetch_and_add(&cc.sampledHits, 1);
+        __sync_fetch_and_add(&cc.sampledAccesses, 1);
+        openRow = row;
+    }
+
+    uint32_t latency = bankLatency[bank];
+    switch (req.type) {
+        case PUTX:
+            //Dirty wback
+            __sync_fetch_and_add(&cc.writes, 1);
+            __sync_fetch_and_add(&cc.wrLat, latency);
+            *req.state = I;
+            break;
+        case GETS:
+            __sync_fetch_and_add(&cc.reads, 1);
+            __sync_fetch_and_add(&cc.rdLat, latency);
+            *req.state = req.is(MemReq::NOEXCL)? S : E;
+            break;
+        case GETX:
+            __sync_fetch_and_add(&cc.reads, 1);
+            __sync_fetch_and_add(&cc.rdLat, latency);
+            *req.state = M;
+            break;
+
+        default: panic("!?");
+    }
+    return req.cycle + latency;
+}
@@ -27,6 +27,7 @@
 #define MEM_CTRLS_H_
 
 #include "g_std/g_string.h"
+#include "g_std/g_vector.h"
 #include "memory_hierarchy.h"
 #include "pad.h"
 #include "stats.h"
@@ -48,53 +49,130 @@ class SimpleMemory : public MemObject {
 
 /* Implements a memory controller with limited bandwidth, throttling latency
  * using an M/D/1 queueing model.
+ *
+ * Accesses are counted in per-core, line-padded slots, and the latency is
+ * recomputed once per phase by an end-of-phase event, so the bound phase
+ * only reads curLatency and never touches lines shared across cores.
  */
 class MD1Memory : public MemObject {
     private:
-        uint64_t lastPhase;
+        struct CoreCounts {
+            uint64_t phaseAccesses;
+            uint64_t reads, writes;
+            uint64_t rdLat, wrLat;
+            PAD_SZ(5*sizeof(uint64_t));
+        };
+
+        uint64_t lastUpdateCycle;  // end of the interval covered by the last latency update
         double maxRequestsPerCycle;
         double smoothedPhaseAccesses;
         uint32_t zeroLoadLatency;
-        uint32_t curLatency;
+        uint32_t curLatency;  // read-mostly, only written at the end of a phase
 
-        PAD();
+        uint64_t unaccountedAccesses;  // from phases too short to update on
+        CoreCounts* coreCounts;  // indexed by srcId, modulo numCountSlots
+        uint32_t numCountSlots;
 
-        Counter profReads;
-        Counter profWrites;
-        Counter profTotalRdLat;
-        Counter profTotalWrLat;
         Counter profLoad;
         Counter profUpdates;
         Counter profClampedLoads;
-        uint32_t curPhaseAccesses;
 
         g_string name; //barely used
-        lock_t updateLock;
-        PAD();
 
     public:
         MD1Memory(uint32_t lineSize, uint32_t megacyclesPerSecond, uint32_t megabytesPerSecond, uint32_t _zeroLoadLatency, g_string& _name);
 
-        void initStats(AggregateStat* parentStat) {
-            AggregateStat* memStats = new AggregateStat();
-            memStats->init(name.c_str(), "Memory controller stats");
-            profReads.init("rd", "Read requests"); memStats->append(&profReads);
-            profWrites.init("wr", "Write requests"); memStats->append(&profWrites);
-            profTotalRdLat.init("rdlat", "Total latency experienced by read requests"); memStats->append(&profTotalRdLat);
-            profTotalWrLat.init("wrlat", "Total latency experienced by write requests"); memStats->append(&profTotalWrLat);
-            profLoad.init("load", "Sum of load factors (0-100) per update"); memStats->append(&profLoad);
-            profUpdates.init("ups", "Number of latency updates"); memStats->append(&profUpdates);
-            profClampedLoads.init("clampedLoads", "Number of updates where the load was clamped to 95%"); memStats->append(&profClampedLoads);
-            parentStat->append(memStats);
-        }
+        void initStats(AggregateStat* parentStat);
 
         //uint32_t access(Address lineAddr, AccessType type, uint32_t childId, MESIState* state /*both input and output*/, MESIState initialState, lock_t* childLock);
         uint64_t access(MemReq& req);
 
         const char* getName() {return name.c_str();}
 
+        // Called at the end of each phase
+        void updateLatency();
+
     private:
+        template <typename F> uint64_t sumCounts(F f) const {
+            uint64_t res = 0;
+            for (uint32_t i = 0; i < numCountSlots; i++) res += f(coreCounts[i]);
+            return res;
+        }
+};
+
+/* Analytical memory controller with per-bank contention. Sits between
+ * MD1Memory (a single queue, no banks or row buffers) and DDRMemory (cycle
+ * accurate, expensive) in both accuracy and cost, for design-space sweeps.
+ *
+ * Every phase, it recomputes each bank's latency from three pieces:
+ *  - Row buffer locality: the row hit rate, estimated with an open-row table
+ *    that tracks a sample of the banks exactly (1 in rowSampleRate).
+ *  - Bank contention: an M/G/1 queue per bank, where the service time is
+ *    the bus transfer time on a row hit, plus rowMissPenalty on a miss.
+ *  - Bandwidth: an M/D/1 queue for the shared data bus.
+ * Loads are clamped to 95%, as in MD1Memory. Like MD1Memory, this is a
+ * bound-phase-only model: accesses count into per-core slots and read the
+ * latencies, which are recomputed at the end of each phase.
+ */
+class BankedMG1Memory : public MemObject {
+    private:
+        // Per-core access counts, as in MD1Memory
+        struct CoreCounts {
+            uint64_t reads, writes;
+            uint64_t rdLat, wrLat;
+            uint64_t sampledHits, sampledAccesses;
+            PAD_SZ(6*sizeof(uint64_t));
+        };
+
+        uint64_t lastUpdateCycle;
+        double maxRequestsPerCycle;  // data bus bandwidth
+        uint32_t zeroLoadLatency;    // on a row hit
+        uint32_t rowMissPenalty;     // PRE + ACT
+        uint32_t numBanks;
+        uint32_t rowLines;           // lines per row (page)
+        uint32_t rowSampleRate;
+
+        double smoothedHitRate;
+        uint64_t unaccountedHits, unaccountedSamples;  // from phases too short to update on
+        g_vector<double> smoothedBankAccesses;
+        g_vector<uint64_t> unaccountedBankAccesses;
+        g_vector<uint32_t> bankLatency;  // read-mostly, only written at the end of a phase
+
+        // Sampled open-row table, indexed by bank/rowSampleRate. Updates are
+        // racy across cores in the bound phase; it's only an estimator
+        g_vector<uint64_t> sampledOpenRows;
+
+        CoreCounts* coreCounts;  // indexed by srcId, modulo numCountSlots
+        uint32_t* bankCounts;  // per-core phase accesses to each bank, bankCountsStride (line-aligned) per core
+        uint32_t bankCountsStride;
+        uint32_t numCountSlots;
+
+        Counter profLoad;
+        Counter profMaxBankLoad;
+        Counter profHitRate;
+        Counter profUpdates;
+        Counter profClampedLoads;
+
+        g_string name;
+
+    public:
+        BankedMG1Memory(uint32_t lineSize, uint32_t megacyclesPerSecond, uint32_t megabytesPerSecond, uint32_t _zeroLoadLatency,
+                uint32_t _rowMissPenalty, uint32_t _numBanks, uint32_t rowBytes, uint32_t _rowSampleRate, g_string& _name);
+
+        void initStats(AggregateStat* parentStat);
+        uint64_t access(MemReq& req);
+
+        const char* getName() {return name.c_str();}
+
+        // Called at the end of each phase
         void updateLatency();
+
+    private:
+        template <typename F> uint64_t sumCounts(F f) const {
+            uint64_t res = 0;
+            for (uint32_t i = 0; i < numCountSlots; i++) res += f(coreCounts[i]);
+            return res;
+        }
 };
 
 #endif  // MEM_CTRLS_H_
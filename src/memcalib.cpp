@@ -0,0 +1,375 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Calibrates BankedMG1Memory's parameters against DDRMemory. Drives a single DDRMemory channel with synthetic,
+ * open-loop request streams (Poisson arrivals at a range of offered loads, with sequential, mixed and random
+ * localities, and 1/3 writebacks), and records each stream's mean read latency and sustained bandwidth. DDRMemory's
+ * timing lives in its weave-phase events, so this simulates them with a single-domain stand-in for ContentionSim
+ * (the real one needs the core models and Pin). Then it runs BankedMG1Memory on the same streams, one phase at a
+ * time, and reports both side by side. Without parameters, it first fits BankedMG1's latency, rowMissPenalty and
+ * bandwidth to minimize the mean relative read latency error over the streams that DDRMemory sustains.
+ */
+
+#include <math.h>
+#include <queue>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tuple>
+#include <vector>
+
+#include "contention_sim.h"
+#include "ddr_mem.h"
+#include "event_queue.h"
+#include "event_recorder.h"
+#include "galloc.h"
+#include "log.h"
+#include "mem_ctrls.h"
+#include "mtrand.h"
+#include "stats.h"
+#include "timing_event.h"
+#include "zsim.h"
+
+using namespace std;
+
+GlobSimInfo* zinfo;
+
+// DDR channel under calibration, as in tests/mem_sweep.cfg's DDR block (other parameters are init.cpp's defaults)
+static const uint32_t FREQ_MHZ = 2000;
+static const uint32_t LINE_SIZE = 64;
+static const char* DDR_TECH = "DDR3-1333-CL10";
+static const uint32_t DDR_RANKS = 4;
+static const uint32_t DDR_BANKS = 8;
+static const uint32_t DDR_PAGE_SIZE = 8*1024;
+static const uint32_t DDR_CTRL_LATENCY = 10;
+
+// BankedMG1 geometry, which is not fitted: banks and row size follow the DDR geometry
+static const uint32_t MG1_BANKS = DDR_RANKS*DDR_BANKS;
+static const uint32_t MG1_ROW_SIZE = 1024*LINE_SIZE;
+static const uint32_t MG1_ROW_SAMPLE_RATE = 4;
+
+static const uint32_t PHASE_LENGTH = 10000;
+
+/* Single-domain stand-in for ContentionSim: one priority queue of events, run in cycle order. This defines the
+ * ContentionSim methods that TimingEvent and DDRMemory use; contention_sim.cpp is not linked in.
+ */
+
+typedef tuple<uint64_t, uint64_t, TimingEvent*> QueuedEvent;  // cycle, insertion order, event
+static priority_queue<QueuedEvent, vector<QueuedEvent>, greater<QueuedEvent>> weaveQueue;
+static uint64_t weaveSeq = 0;
+static uint64_t weaveCycle = 0;
+
+ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
+    // Only for the weave-phase measurements that DDRMemory records (queueing delays)
+    numDomains = _numDomains;
+    domains = gm_calloc<DomainData>(numDomains);
+}
+
+void ContentionSim::enqueue(TimingEvent* ev, uint64_t cycle) {
+    assert_msg(cycle >= weaveCycle, "Enqueued event at %ld, current cycle is %ld", cycle, weaveCycle);
+    weaveQueue.push(make_tuple(cycle, weaveSeq++, ev));
+}
+
+void ContentionSim::enqueueSynced(TimingEvent* ev, uint64_t cycle) {
+    enqueue(ev, cycle);
+}
+
+void ContentionSim::enqueueCrossing(CrossingEvent* ev, uint64_t cycle, uint32_t srcId, uint32_t srcDomain, uint32_t dstDomain, EventRecorder* evRec) {
+    panic("memcalib has a single domain, it should see no crossings");
+}
+
+void ContentionSim::wakeChildren(TimingEvent* ev, uint64_t startCycle) {
+    panic("memcalib's memory events should have no children");
+}
+
+// Runs all queued events before limitCycle
+static void runEvents(uint64_t limitCycle) {
+    while (!weaveQueue.empty() && get<0>(weaveQueue.top()) < limitCycle) {
+        QueuedEvent qe = weaveQueue.top();
+        weaveQueue.pop();
+        weaveCycle = get<0>(qe);
+        get<2>(qe)->run(weaveCycle);
+    }
+}
+
+/* Streams */
+
+struct Access {
+    uint64_t cycle;
+    Address lineAddr;
+    bool write;
+};
+
+struct Stream {
+    const char* locality;
+    double load;  // offered, as a fraction of the data bus bandwidth
+    vector<Access> accesses;
+};
+
+// Nominal data bus bandwidth, in lines/cycle
+static double busLinesPerCycle() {
+    double memMTps = 1333.0;  // DDR3-1333
+    return memMTps*8/LINE_SIZE/FREQ_MHZ;
+}
+
+// With probability seqProb an access follows the previous one, otherwise it goes to a random line in a 1GB footprint
+static Stream genStream(const char* locality, double seqProb, double load, uint32_t numAccesses, uint64_t seed) {
+    Stream s;
+    s.locality = locality;
+    s.load = load;
+    MTRand rnd(seed);
+    const uint64_t footprintLines = (1ul << 30)/LINE_SIZE;
+    double meanGap = 1.0/(load*busLinesPerCycle());
+    double cycle = 1000.0;
+    Address lineAddr = rnd.randInt(footprintLines - 1);
+    for (uint32_t i = 0; i < numAccesses; i++) {
+        cycle += -meanGap*log(1.0 - rnd.randExc());
+        lineAddr = (rnd.randExc() < seqProb)? (lineAddr + 1) % footprintLines : rnd.randInt(footprintLines - 1);
+        bool write = rnd.randInt(2) == 0;
+        s.accesses.push_back({(uint64_t)cycle, lineAddr, write});
+    }
+    return s;
+}
+
+/* Models */
+
+struct Result {
+    double rdLatency;  // mean, in cycles
+    double linesPerCycle;  // sustained
+};
+
+static uint64_t getStat(AggregateStat* memStats, const char* name) {
+    for (uint32_t i = 0; i < memStats->curSize(); i++) {
+        Stat* s = memStats->get(i);
+        if (strcmp(s->name(), name) == 0) return dynamic_cast<ScalarStat*>(s)->get();
+    }
+    panic("No stat %s in %s", name, memStats->name());
+}
+
+static void issue(MemObject* mem, const Access& a) {
+    MESIState state = I;
+    MemReq req = {a.lineAddr, a.write? PUTX : GETS, 0, &state, a.cycle, nullptr, state, 0, 0, 0};
+    mem->access(req);
+}
+
+static Result runDDR(const Stream& s) {
+    g_string name("ddr");
+    DDRMemory* mem = new DDRMemory(LINE_SIZE, DDR_PAGE_SIZE, DDR_RANKS, DDR_BANKS, FREQ_MHZ, DDR_TECH, "rank:col:bank",
+            DDR_CTRL_LATENCY, 16 /*queueDepth*/, 4 /*maxRowHits*/, true /*deferWrites*/, false /*closedPage*/,
+            false /*bankXor*/, 0 /*domain*/, name);
+    AggregateStat* rootStat = new AggregateStat();
+    rootStat->init("root", "Stats");
+    mem->initStats(rootStat);
+
+    EventRecorder* evRec = zinfo->eventRecorders[0];
+    weaveCycle = 0;
+    for (const Access& a : s.accesses) {
+        // Events run in cycle order, and arrivals only enqueue events after their own cycle
+        runEvents(a.cycle + 1);
+        issue(mem, a);
+        TimingEvent* ev = evRec->popRecord().startEvent;
+        ev->queue(a.cycle + ev->getPreDelay());
+    }
+    runEvents(-1ul);
+
+    AggregateStat* memStats = dynamic_cast<AggregateStat*>(rootStat->get(0));
+    uint64_t elapsed = weaveCycle - s.accesses.front().cycle;
+    return {((double)getStat(memStats, "rdlat"))/getStat(memStats, "rd"), ((double)s.accesses.size())/elapsed};
+}
+
+struct MG1Params {
+    uint32_t latency;
+    uint32_t rowMissPenalty;
+    uint32_t bandwidth;  // MB/s
+};
+
+static Result runBankedMG1(const Stream& s, const MG1Params& p) {
+    zinfo->eventQueue = new EventQueue();
+    zinfo->numPhases = 0;
+    zinfo->globPhaseCycles = 0;
+
+    FILE* out = logFdOut;
+    logFdOut = fopen("/dev/null", "w");  // quiet the constructor, which the fit calls a lot
+    g_string name("mg1");
+    BankedMG1Memory* mem = new BankedMG1Memory(LINE_SIZE, FREQ_MHZ, p.bandwidth, p.latency, p.rowMissPenalty,
+            MG1_BANKS, MG1_ROW_SIZE, MG1_ROW_SAMPLE_RATE, name);
+    fclose(logFdOut);
+    logFdOut = out;
+    AggregateStat* rootStat = new AggregateStat();
+    rootStat->init("root", "Stats");
+    mem->initStats(rootStat);
+
+    for (const Access& a : s.accesses) {
+        while (a.cycle >= zinfo->globPhaseCycles + PHASE_LENGTH) {
+            zinfo->eventQueue->tick();
+            zinfo->numPhases++;
+            zinfo->globPhaseCycles += PHASE_LENGTH;
+        }
+        issue(mem, a);
+    }
+
+    // BankedMG1 does not limit bandwidth, so it sustains the offered load
+    AggregateStat* memStats = dynamic_cast<AggregateStat*>(rootStat->get(0));
+    uint64_t elapsed = s.accesses.back().cycle - s.accesses.front().cycle;
+    return {((double)getStat(memStats, "rdlat"))/getStat(memStats, "rd"), ((double)s.accesses.size())/elapsed};
+}
+
+/* Fitting */
+
+// A stream is sustained if DDRMemory keeps up with its offered load; past that, its latency grows with the stream's
+// length, and there is nothing to fit
+static bool sustained(const Stream& s, const Result& ddr) {
+    return ddr.linesPerCycle >= 0.97*s.load*busLinesPerCycle();
+}
+
+static double fitError(const vector<Stream>& streams, const vector<Result>& ddr, const MG1Params& p) {
+    double err = 0.0;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < streams.size(); i++) {
+        if (!sustained(streams[i], ddr[i])) continue;
+        Result mg1 = runBankedMG1(streams[i], p);
+        err += fabs(mg1.rdLatency - ddr[i].rdLatency)/ddr[i].rdLatency;
+        n++;
+    }
+    assert(n);
+    return err/n;
+}
+
+// Coordinate descent from the parameters derived from the DDR timings, halving the steps once no move helps
+static MG1Params fit(const vector<Stream>& streams, const vector<Result>& ddr, MG1Params p) {
+    int32_t steps[] = {8, 16, 1024};
+    const int32_t minSteps[] = {1, 1, 64};
+    double bestErr = fitError(streams, ddr, p);
+    info("Fitting from latency %d, rowMissPenalty %d, bandwidth %d: error %.1f%%", p.latency, p.rowMissPenalty,
+            p.bandwidth, bestErr*100);
+    while (true) {
+        bool improved = false;
+        for (uint32_t d = 0; d < 3; d++) {
+            for (int32_t dir : {1, -1}) {
+                while (true) {
+                    MG1Params q = p;
+                    uint32_t* v = (d == 0)? &q.latency : (d == 1)? &q.rowMissPenalty : &q.bandwidth;
+                    if (dir < 0 && *v <= (uint32_t)steps[d]) break;
+                    *v += dir*steps[d];
+                    double err = fitError(streams, ddr, q);
+                    if (err >= bestErr) break;
+                    bestErr = err;
+                    p = q;
+                    improved = true;
+                }
+            }
+        }
+        if (!improved) {
+            bool halved = false;
+            for (uint32_t d = 0; d < 3; d++) {
+                if (steps[d] > minSteps[d]) {
+                    steps[d] /= 2;
+                    halved = true;
+                }
+            }
+            if (!halved) break;
+        }
+    }
+    info("Fitted latency %d, rowMissPenalty %d, bandwidth %d: error %.1f%%", p.latency, p.rowMissPenalty,
+            p.bandwidth, bestErr*100);
+    return p;
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc != 1 && argc != 4) {
+        info("Calibrates BankedMG1Memory against a DDR3-1333-CL10 DDRMemory channel (see tests/mem_sweep.cfg)");
+        info("Usage: %s [<latency> <rowMissPenalty> <bandwidth MB/s>]  (without parameters, fits them)", argv[0]);
+        exit(1);
+    }
+
+    gm_init(1024<<20 /*1 GB*/);
+    zinfo = gm_calloc<GlobSimInfo>();
+    zinfo->numCores = 1;
+    zinfo->lineSize = LINE_SIZE;
+    zinfo->freqMHz = FREQ_MHZ;
+    zinfo->phaseLength = PHASE_LENGTH;
+    zinfo->contentionSim = new ContentionSim(1, 1);
+    zinfo->eventRecorders = gm_calloc<EventRecorder*>(1);
+    zinfo->eventRecorders[0] = new EventRecorder();
+
+    struct Locality {const char* name; double seqProb;};
+    const Locality localities[] = {{"seq", 0.95}, {"mixed", 0.5}, {"random", 0.0}};
+    const double loads[] = {0.1, 0.3, 0.5, 0.7, 0.9};
+    const uint32_t numAccesses = 200000;
+
+    vector<Stream> streams;
+    vector<Stream> overloads;
+    uint64_t seed = 1;
+    for (const Locality& l : localities) {
+        for (double load : loads) streams.push_back(genStream(l.name, l.seqProb, load, numAccesses, seed++));
+        overloads.push_back(genStream(l.name, l.seqProb, 2.0, numAccesses, seed++));
+    }
+
+    FILE* out = logFdOut;
+    logFdOut = fopen("/dev/null", "w");
+    vector<Result> ddr;
+    for (const Stream& s : streams) ddr.push_back(runDDR(s));
+    vector<Result> ddrPeak;
+    for (const Stream& s : overloads) ddrPeak.push_back(runDDR(s));
+    fclose(logFdOut);
+    logFdOut = out;
+
+    MG1Params p = {52, 60, 10667};  // derived from the DDR3-1333-CL10 timings, see tests/mem_sweep.cfg
+    if (argc == 4) {
+        p.latency = strtoul(argv[1], nullptr, 0);
+        p.rowMissPenalty = strtoul(argv[2], nullptr, 0);
+        p.bandwidth = strtoul(argv[3], nullptr, 0);
+    } else {
+        p = fit(streams, ddr, p);
+    }
+
+    auto toMBps = [](double linesPerCycle) { return linesPerCycle*LINE_SIZE*FREQ_MHZ; };
+    info("BankedMG1 latency %d, rowMissPenalty %d, bandwidth %d MB/s vs DDRMemory %s, %d ranks x %d banks, open page",
+            p.latency, p.rowMissPenalty, p.bandwidth, DDR_TECH, DDR_RANKS, DDR_BANKS);
+    info("%8s %6s %10s %10s %10s %8s", "Locality", "Load", "DDR MB/s", "DDR rdlat", "MG1 rdlat", "Error");
+    double totalErr = 0.0;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < streams.size(); i++) {
+        const Stream& s = streams[i];
+        Result mg1 = runBankedMG1(s, p);
+        if (sustained(s, ddr[i])) {
+            double err = (mg1.rdLatency - ddr[i].rdLatency)/ddr[i].rdLatency;
+            totalErr += fabs(err);
+            n++;
+            info("%8s %5.0f%% %10.0f %10.1f %10.1f %7.1f%%", s.locality, s.load*100, toMBps(ddr[i].linesPerCycle),
+                    ddr[i].rdLatency, mg1.rdLatency, err*100);
+        } else {
+            info("%8s %5.0f%% %10.0f %10.1f %10.1f %8s", s.locality, s.load*100, toMBps(ddr[i].linesPerCycle),
+                    ddr[i].rdLatency, mg1.rdLatency, "(sat)");
+        }
+    }
+    info("Mean absolute read latency error over %d sustained streams: %.1f%%", n, totalErr/n*100);
+    for (uint32_t i = 0; i < overloads.size(); i++) {
+        info("Peak DDR bandwidth, %s: %.0f MB/s (BankedMG1 bandwidth %d MB/s)", overloads[i].locality,
+                toMBps(ddrPeak[i].linesPerCycle), p.bandwidth);
+    }
+    return 0;
+}
@@ -0,0 +1,342 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Differential test and benchmark for MemSchedQueue (detailed_mem_queue.h). Replays random request streams through
+ * two copies of MemSchedulerDefault's FR-FCFS policy: one on the original vectors, which scan for row hits and
+ * address-map every entry they visit, and one on MemSchedQueue, as detailed_mem.cpp does now. Bank states evolve
+ * only from the issued requests and a fixed seed, so as long as both issue the same requests, both see the same open
+ * rows; we panic unless they issue the same requests in the same order, and time each replay. MemSchedulerDefault
+ * itself needs the whole DRAM model, so the policy code below mirrors its CheckSetEvent() and GetEvent().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+#include <vector>
+
+#include "detailed_mem_queue.h"
+#include "galloc.h"
+#include "log.h"
+#include "mtrand.h"
+#include "profile_stats.h"
+
+using namespace std;
+
+// Stands in for MemAccessEventBase, which the queues only hold pointers to
+struct BenchReq {
+    Address addr;
+    bool write;
+};
+
+static inline MemAccessEventBase* toEv(BenchReq* r) {return reinterpret_cast<MemAccessEventBase*>(r);}
+static inline BenchReq* fromEv(MemAccessEventBase* ev) {return reinterpret_cast<BenchReq*>(ev);}
+
+// Open-row state and address mapping of one channel
+struct Channel {
+    uint32_t ranks, banks, rows;
+    vector<bool> open;
+    vector<uint32_t> openRow;
+
+    Channel(uint32_t _ranks, uint32_t _banks, uint32_t _rows)
+        : ranks(_ranks), banks(_banks), rows(_rows), open(_ranks*_banks, false), openRow(_ranks*_banks, 0) {}
+
+    void AddressMap(Address addr, uint32_t& row, uint32_t& rank, uint32_t& bank) const {
+        bank = addr % banks;
+        rank = (addr / banks) % ranks;
+        row = (addr / banks / ranks) % rows;
+    }
+
+    bool IsRowBufferHit(uint32_t row, uint32_t rank, uint32_t bank) const {
+        return open[rank*banks + bank] && openRow[rank*banks + bank] == row;
+    }
+
+    bool GetOpenRow(uint32_t rank, uint32_t bank, uint32_t& row) const {
+        if (!open[rank*banks + bank]) return false;
+        row = openRow[rank*banks + bank];
+        return true;
+    }
+
+    // Issuing a request opens its row; a random bank also closes now and then, as with precharges and refreshes
+    void Issue(Address addr, MTRand& rnd) {
+        uint32_t row, rank, bank;
+        AddressMap(addr, row, rank, bank);
+        open[rank*banks + bank] = true;
+        openRow[rank*banks + bank] = row;
+        if (rnd.randInt(7) == 0) open[rnd.randInt(ranks*banks - 1)] = false;
+    }
+};
+
+// The original policy, on vectors
+class VectorScheduler {
+    private:
+        typedef pair<MemAccessEventBase*, Address> Elem;
+        vector<Elem> rdQueue, wrQueue, wrDoneQueue;
+        Channel* chnl;
+        bool prioritizeWrites;
+        uint32_t wrQueueSize, wrQueueHighWatermark, wrQueueLowWatermark;
+
+        bool FindBestRequest(vector<Elem>& queue, uint32_t& idx) {
+            idx = 0;
+            for (uint32_t i = 0; i < queue.size(); i++) {
+                uint32_t row, rank, bank;
+                chnl->AddressMap(queue[i].second, row, rank, bank);
+                if (chnl->IsRowBufferHit(row, rank, bank)) {
+                    idx = i;
+                    break;
+                }
+            }
+            return !queue.empty();
+        }
+
+    public:
+        VectorScheduler(Channel* _chnl, uint32_t queueCount)
+            : chnl(_chnl), prioritizeWrites(false), wrQueueSize(queueCount),
+              wrQueueHighWatermark(queueCount*2/3), wrQueueLowWatermark(queueCount/3) {}
+
+        bool CheckSetEvent(MemAccessEventBase* ev) {
+            Address addr = fromEv(ev)->addr;
+            bool write = fromEv(ev)->write;
+            for (vector<Elem>::iterator it = wrQueue.begin(); it != wrQueue.end(); it++) {
+                if (it->second == addr) {
+                    if (write) {
+                        wrQueue.erase(it);
+                        wrQueue.push_back(Elem(nullptr, addr));
+                    }
+                    return true;
+                }
+            }
+            for (vector<Elem>::iterator it = wrDoneQueue.begin(); it != wrDoneQueue.end(); it++) {
+                if (it->second == addr) {
+                    wrDoneQueue.erase(it);
+                    if (write) wrQueue.push_back(Elem(nullptr, addr));
+                    else wrDoneQueue.push_back(Elem(nullptr, addr));
+                    return true;
+                }
+            }
+            if (!write) {
+                rdQueue.push_back(Elem(ev, addr));
+            } else {
+                wrQueue.push_back(Elem(nullptr, addr));
+                if (wrQueue.size() + wrDoneQueue.size() == wrQueueSize && !wrDoneQueue.empty()) wrDoneQueue.erase(wrDoneQueue.begin());
+            }
+            return false;
+        }
+
+        bool GetEvent(MemAccessEventBase*& ev, Address& addr, bool& write) {
+            if (wrQueue.size() >= wrQueueHighWatermark) prioritizeWrites = true;
+            else if (wrQueue.size() <= wrQueueLowWatermark) prioritizeWrites = false;
+
+            uint32_t idx;
+            if (!prioritizeWrites && FindBestRequest(rdQueue, idx)) {
+                ev = rdQueue[idx].first;
+                addr = fromEv(ev)->addr;
+                write = false;
+                rdQueue.erase(rdQueue.begin() + idx);
+                return true;
+            }
+            if (FindBestRequest(wrQueue, idx)) {
+                ev = nullptr;
+                addr = wrQueue[idx].second;
+                write = true;
+                wrQueue.erase(wrQueue.begin() + idx);
+                wrDoneQueue.push_back(Elem(nullptr, addr));
+                return true;
+            }
+            return false;
+        }
+
+        size_t size() const {return rdQueue.size() + wrQueue.size() + wrDoneQueue.size();}
+};
+
+// The current policy, on MemSchedQueue
+class IndexedScheduler {
+    private:
+        MemSchedQueue rdQueue, wrQueue, wrDoneQueue;
+        Channel* chnl;
+        bool prioritizeWrites;
+        uint32_t wrQueueSize, wrQueueHighWatermark, wrQueueLowWatermark;
+
+        void Enqueue(MemSchedQueue& queue, MemAccessEventBase* ev, Address addr) {
+            uint32_t row, rank, bank;
+            chnl->AddressMap(addr, row, rank, bank);
+            queue.push_back(ev, addr, row, rank, bank);
+        }
+
+        MemSchedQueue::Entry* FindBestRequest(MemSchedQueue& queue) {
+            if (queue.empty()) return nullptr;
+            Channel* c = chnl;
+            MemSchedQueue::Entry* e = queue.oldestRowHit([c](uint32_t rank, uint32_t bank, uint32_t& row) {
+                return c->GetOpenRow(rank, bank, row);
+            });
+            return e? e : queue.front();
+        }
+
+    public:
+        IndexedScheduler(Channel* _chnl, uint32_t queueCount)
+            : rdQueue(_chnl->ranks, _chnl->banks, false), wrQueue(_chnl->ranks, _chnl->banks, true),
+              wrDoneQueue(_chnl->ranks, _chnl->banks, true), chnl(_chnl), prioritizeWrites(false),
+              wrQueueSize(queueCount), wrQueueHighWatermark(queueCount*2/3), wrQueueLowWatermark(queueCount/3) {}
+
+        bool CheckSetEvent(MemAccessEventBase* ev) {
+            Address addr = fromEv(ev)->addr;
+            bool write = fromEv(ev)->write;
+            MemSchedQueue::Entry* e = wrQueue.find(addr);
+            if (e) {
+                if (write) {
+                    wrQueue.remove(e);
+                    Enqueue(wrQueue, nullptr, addr);
+                }
+                return true;
+            }
+            e = wrDoneQueue.find(addr);
+            if (e) {
+                wrDoneQueue.remove(e);
+                Enqueue(write? wrQueue : wrDoneQueue, nullptr, addr);
+                return true;
+            }
+            if (!write) {
+                Enqueue(rdQueue, ev, addr);
+            } else {
+                Enqueue(wrQueue, nullptr, addr);
+                if (wrQueue.size() + wrDoneQueue.size() == wrQueueSize && !wrDoneQueue.empty()) wrDoneQueue.remove(wrDoneQueue.front());
+            }
+            return false;
+        }
+
+        bool GetEvent(MemAccessEventBase*& ev, Address& addr, bool& write) {
+            if (wrQueue.size() >= wrQueueHighWatermark) prioritizeWrites = true;
+            else if (wrQueue.size() <= wrQueueLowWatermark) prioritizeWrites = false;
+
+            MemSchedQueue::Entry* e;
+            if (!prioritizeWrites && (e = FindBestRequest(rdQueue))) {
+                ev = e->ev;
+                addr = fromEv(ev)->addr;
+                write = false;
+                rdQueue.remove(e);
+                return true;
+            }
+            if ((e = FindBestRequest(wrQueue))) {
+                ev = nullptr;
+                addr = e->addr;
+                write = true;
+                wrQueue.remove(e);
+                Enqueue(wrDoneQueue, nullptr, addr);
+                return true;
+            }
+            return false;
+        }
+
+        size_t size() const {return rdQueue.size() + wrQueue.size() + wrDoneQueue.size();}
+};
+
+// Each step either enqueues the next request or, with the same probability, tries to issue one
+struct Stream {
+    vector<BenchReq> reqs;
+    vector<bool> issueSteps;
+};
+
+static Stream genStream(uint32_t steps, uint32_t footprint, uint32_t writePct, uint64_t seed) {
+    MTRand rnd(seed);
+    Stream s;
+    for (uint32_t i = 0; i < steps; i++) {
+        bool issue = rnd.randInt(1);
+        s.issueSteps.push_back(issue);
+        if (!issue) {
+            BenchReq r;
+            // Half the requests stream through consecutive lines (row hits), the rest are random
+            r.addr = (rnd.randInt(1) && !s.reqs.empty())? (s.reqs.back().addr + 1) % footprint : rnd.randInt(footprint - 1);
+            r.write = rnd.randInt(99) < writePct;
+            s.reqs.push_back(r);
+        }
+    }
+    return s;
+}
+
+// Replays the stream; returns the time taken, in ns, and the issue order in issued
+template <typename S>
+uint64_t replay(Stream& s, uint32_t ranks, uint32_t banks, uint32_t queueCount, uint32_t maxPending, vector<Address>& issued) {
+    Channel chnl(ranks, banks, 64);
+    S* sched = new S(&chnl, queueCount);
+    MTRand rnd(99);
+    uint32_t nextReq = 0;
+    uint64_t startNs = getNs();
+    for (bool issue : s.issueSteps) {
+        if (issue || sched->size() >= maxPending) {
+            MemAccessEventBase* ev;
+            Address addr;
+            bool write;
+            if (sched->GetEvent(ev, addr, write)) {
+                chnl.Issue(addr, rnd);
+                issued.push_back(write? ~addr : addr);
+            }
+        } else if (nextReq < s.reqs.size()) {
+            sched->CheckSetEvent(toEv(&s.reqs[nextReq++]));
+        }
+    }
+    uint64_t ns = getNs() - startNs;
+    delete sched;
+    return ns;
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc > 2) {
+        info("Checks MemSchedQueue's FR-FCFS decisions against the original vector queues, and benchmarks both");
+        info("Usage: %s [<steps per stream, default 1M>]", argv[0]);
+        exit(1);
+    }
+    uint32_t steps = (argc == 2)? strtoul(argv[1], nullptr, 0) : 1000000;
+
+    gm_init(64<<20 /*64 MB*/);
+
+    struct Config {uint32_t ranks, banks, queueCount, maxPending, footprint, writePct;};
+    const Config configs[] = {
+        {1, 8, 16, 32, 256, 30},
+        {2, 8, 32, 64, 4096, 30},
+        {2, 8, 64, 128, 512, 50},
+        {4, 8, 128, 512, 1 << 16, 30},
+        {4, 16, 256, 1024, 1 << 16, 70},
+    };
+
+    info("%5s %5s %6s %8s %9s %10s %14s %14s %9s", "Ranks", "Banks", "WrQ", "Pending", "Footprint", "Issued",
+            "Vector ns/op", "Indexed ns/op", "Speedup");
+    uint64_t seed = 1;
+    for (const Config& c : configs) {
+        Stream s = genStream(steps, c.footprint, c.writePct, seed++);
+        vector<Address> vecIssued, idxIssued;
+        uint64_t vecNs = replay<VectorScheduler>(s, c.ranks, c.banks, c.queueCount, c.maxPending, vecIssued);
+        uint64_t idxNs = replay<IndexedScheduler>(s, c.ranks, c.banks, c.queueCount, c.maxPending, idxIssued);
+        for (size_t i = 0; i < vecIssued.size() || i < idxIssued.size(); i++) {
+            if (i >= vecIssued.size() || i >= idxIssued.size() || vecIssued[i] != idxIssued[i]) {
+                panic("%d ranks, %d banks, queue %d: issue %ld differs (%ld issued with vectors, %ld with MemSchedQueue)",
+                        c.ranks, c.banks, c.queueCount, i, vecIssued.size(), idxIssued.size());
+            }
+        }
+        info("%5d %5d %6d %8d %9d %10ld %14.1f %14.1f %9.2f", c.ranks, c.banks, c.queueCount, c.maxPending, c.footprint,
+                vecIssued.size(), ((double)vecNs)/steps, ((double)idxNs)/steps, ((double)vecNs)/idxNs);
+    }
+    info("All streams issued the same requests in the same order");
+    return 0;
+}
@@ -23,15 +23,35 @@
  * this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "contention_sim.h"
+#include "event_queue.h"
 #include "partitioner.h"
+#include "zsim.h"
 
 // UMon
 
+class UMonMonitor::DrainTask : public ParallelTask {
+    private:
+        const UMonMonitor* mon;
+    public:
+        explicit DrainTask(const UMonMonitor* _mon) : mon(_mon) {}
+        void run(uint32_t partition) { mon->drainPartition(partition); }
+};
+
+class UMonDrainEvent : public Event {
+    private:
+        UMonMonitor* mon;
+    public:
+        explicit UMonDrainEvent(UMonMonitor* _mon) : Event(1 /*every phase*/), mon(_mon) {}
+        void callback() { mon->drain(); }
+};
+
 UMonMonitor::UMonMonitor(uint32_t _numLines, uint32_t _umonLines, uint32_t _umonBuckets, uint32_t _numPartitions, uint32_t _buckets)
         : PartitionMonitor(_buckets)
         , missCache(nullptr)
         , missCacheValid(false)
-        , monitors(_numPartitions, nullptr) {
+        , monitors(_numPartitions, nullptr)
+        , pendingSamples(0) {
     assert(_numPartitions > 0);
 
     missCache = gm_calloc<uint32_t>(_buckets * _numPartitions);
@@ -39,6 +59,13 @@ UMonMonitor::UMonMonitor(uint32_t _numLines, uint32_t _umonLines, uint32_t _umon
     for (auto& monitor : monitors) {
         monitor = new UMon(_numLines, _umonLines, _umonBuckets);
     }
+
+    numSlots = MAX(zinfo->numCores, 1u);
+    samples.resize(numSlots);
+    for (auto& slot : samples) slot.resize(_numPartitions);
+
+    drainTask = new DrainTask(this);
+    zinfo->eventQueue->insert(new UMonDrainEvent(this), 0);
 }
 
 UMonMonitor::~UMonMonitor() {
@@ -47,11 +74,21 @@ UMonMonitor::~UMonMonitor() {
     }
     gm_free(missCache);
     monitors.clear();
+    delete drainTask;
 }
 
-void UMonMonitor::access(uint32_t partition, Address lineAddr) {
+void UMonMonitor::access(uint32_t partition, Address lineAddr, uint32_t srcId) {
     assert(partition < monitors.size());
-    monitors[partition]->access(lineAddr);
+    // All UMONs share the same hash function, so any of them can filter
+    if (!monitors[partition]->isSampled(lineAddr)) return;
+    samples[srcId % numSlots][partition].push_back(lineAddr);
+    pendingSamples++;
+}
+
+void UMonMonitor::drain() const {
+    if (!pendingSamples) return;
+    zinfo->contentionSim->runParallel(drainTask, monitors.size());
+    pendingSamples = 0;
 
     // check optimization assumption -- we shouldn't cache all misses
     // if they are getting accessed while they are updated! -nzb
@@ -59,8 +96,19 @@ void UMonMonitor::access(uint32_t partition, Address lineAddr) {
     missCacheValid = false;
 }
 
+void UMonMonitor::drainPartition(uint32_t partition) const {
+    // Walk slots in order so that results do not depend on thread interleaving
+    UMon* monitor = monitors[partition];
+    for (auto& slot : samples) {
+        g_vector<Address>& buf = slot[partition];
+        for (Address lineAddr : buf) monitor->accessSampled(lineAddr);
+        buf.clear();
+    }
+}
+
 uint32_t UMonMonitor::getNumAccesses(uint32_t partition) const {
     assert(partition < monitors.size());
+    drain();
 
     auto monitor = monitors[partition];
     return monitor->getNumAccesses();
@@ -70,6 +118,7 @@ uint32_t UMonMonitor::get(uint32_t partition, uint32_t bucket) const {
     assert(partition < monitors.size());
 
     if (!missCacheValid) {
+        drain();
         getMissCurves();
         missCacheValid = true;
     }
@@ -128,6 +177,7 @@ void UMonMonitor::getMissCurve(uint32_t* misses, uint32_t partition) const {
 }
 
 void UMonMonitor::reset() {
+    drain();
     for (auto monitor : monitors) {
         monitor->startNextInterval();
     }
@@ -114,11 +114,13 @@ void OOOCore::initStats(AggregateStat* parentStat) {
     profIssueStalls.init("issueStalls",  "Issue stalls");  coreStat->append(&profIssueStalls);
 #endif
 
+    cRec.getEventRecorder()->initStats(coreStat);
+
     parentStat->append(coreStat);
 }
 
 uint64_t OOOCore::getInstrs() const {return instrs;}
-uint64_t OOOCore::getPhaseCycles() const {return curCycle % zinfo->phaseLength;}
+uint64_t OOOCore::getPhaseCycles() const {return (curCycle > zinfo->globPhaseCycles)? curCycle - zinfo->globPhaseCycles : 0;}
 
 void OOOCore::contextSwitch(int32_t gid) {
     if (gid == -1) {
@@ -506,6 +508,12 @@ void OOOCore::cSimEnd() {
     if (targetCycle > curCycle) advance(targetCycle);
 }
 
+void OOOCore::cSimSkip() {
+    uint64_t targetCycle = cRec.cSimSkip(curCycle);
+    assert(targetCycle >= curCycle);
+    if (targetCycle > curCycle) advance(targetCycle);
+}
+
 void OOOCore::advance(uint64_t targetCycle) {
     assert(targetCycle > curCycle);
     decodeCycle += targetCycle - curCycle;
@@ -551,7 +559,7 @@ void OOOCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo, InsType b
         core->bbl(bblAddr, bblInfo, bblType);
 
         while (core->curCycle > core->phaseEndCycle) {
-            core->phaseEndCycle += zinfo->phaseLength;
+            core->phaseEndCycle += zinfo->nextPhaseLength;
 
             uint32_t cid = getCid(tid);
             // NOTE: TakeBarrier may take ownership of the core, and so it will be used by some other thread. If TakeBarrier context-switches us,
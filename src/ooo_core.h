@@ -458,6 +458,7 @@ class OOOCore : public Core {
         inline EventRecorder* getEventRecorder() {return cRec.getEventRecorder();}
         void cSimStart();
         void cSimEnd();
+        void cSimSkip();
 
     private:
         inline void load(Address addr, Address pc, InsType type);
@@ -468,7 +469,7 @@ class OOOCore : public Core {
          * jumps.
          *
          * UPDATE: With decodeCycle, this difference is more serious. ONLY
-         * cSimStart and cSimEnd should call advance(). advance() is now meant
+         * cSimStart, cSimEnd and cSimSkip should call advance(). advance() is now meant
          * to advance the cycle counters in the whole core in lockstep.
          */
         inline void advance(uint64_t targetCycle);
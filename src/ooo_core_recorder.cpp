@@ -25,6 +25,7 @@
 
 #include "ooo_core_recorder.h"
 #include <string>
+#include "contention_sim.h"
 #include "timing_event.h"
 #include "zsim.h"
 
@@ -135,12 +136,14 @@ uint64_t OOOCoreRecorder::notifyJoin(uint64_t curCycle) {
         lastEvProduced->setMinStartCycle(curCycle);
         lastEvProduced->queue(curCycle);
         eventRecorder.setStartSlack(0);
+        skewPredictor.restart(curCycle);
         DEBUG_MSG("[%s] Joined, was HALTED, curCycle %ld halted %ld", name.c_str(), curCycle, totalHaltedCycles);
     } else if (state == DRAINING) {
         assert(curCycle >= zinfo->globPhaseCycles); //should not have gone out of sync...
         DEBUG_MSG("[%s] Joined, was DRAINING, curCycle %ld", name.c_str(), curCycle);
         assert(lastEvProduced);
         addIssueEvent(curCycle);
+        skewPredictor.restart(curCycle);
     } else {
         panic("[%s] Invalid state %d on join()", name.c_str(), state);
     }
@@ -316,9 +319,18 @@ uint64_t OOOCoreRecorder::cSimEnd(uint64_t curCycle) {
 
     assert(lastEvCycle1 <= curCycle);
     assert_msg(lastEvCycle2 <= curCycle, "[%s] lec2 %ld cc %ld, state %d", name.c_str(), lastEvCycle2, curCycle, state);
-    if (unlikely(lastEvCycle1 > lastEvCycle2)) panic("[%s] Contention simulation introduced a negative skew, curCycle %ld, lc1 %ld lc2 %ld, gapCycles %ld", name.c_str(), curCycle, lastEvCycle1, lastEvCycle2, gapCycles);
+    // With weave sampling, skipped phases may have predicted more skew than there was; the core keeps it
+    uint64_t unverifiedCycles = skewPredictor.getUnverifiedCycles();
+    if (unlikely(lastEvCycle1 > lastEvCycle2 + unverifiedCycles)) panic("[%s] Contention simulation introduced a negative skew, curCycle %ld, lc1 %ld lc2 %ld, gapCycles %ld", name.c_str(), curCycle, lastEvCycle1, lastEvCycle2, gapCycles);
 
-    uint64_t skew = lastEvCycle2 - lastEvCycle1;
+    uint64_t skew = (lastEvCycle2 > lastEvCycle1)? lastEvCycle2 - lastEvCycle1 : 0;
+
+    if (state == RUNNING) {
+        zinfo->contentionSim->reportSkewSample(skewPredictor.predict(curCycle), skew);
+        skewPredictor.train(curCycle, skew, zinfo->contentionSim->getSkewAlpha());
+    } else {
+        skewPredictor.verify();
+    }
 
     // Skew clock
     // Note that by adding to gapCycles, we keep the zll clock (defined as curCycle - gapCycles) constant.
@@ -357,6 +369,27 @@ uint64_t OOOCoreRecorder::cSimEnd(uint64_t curCycle) {
     return curCycle;
 }
 
+uint64_t OOOCoreRecorder::cSimSkip(uint64_t curCycle) {
+    if (state == HALTED) return curCycle; //nothing to do
+
+    DEBUG_MSG("[%s] Cycle %ld cSimSkip %d", name.c_str(), curCycle, state);
+
+    if (state == RUNNING) {
+        // No events were recorded this phase; the next issue event links to the last one with a longer
+        // delay. Stand in for the weave phase by skewing the clock as cSimEnd would.
+        uint64_t skew = skewPredictor.skip(curCycle);
+        zinfo->contentionSim->reportSkewCorrection(skew);
+        curCycle += skew;
+        gapCycles += skew;
+        eventRecorder.setGapCycles(gapCycles);
+    } else if (state == DRAINING) {
+        // We only find out we are done draining on sampled phases; until then, keep up as cSimStart does
+        uint64_t nextPhaseCycle = zinfo->globPhaseCycles + zinfo->phaseLength;
+        if (curCycle < nextPhaseCycle) curCycle = nextPhaseCycle;
+    }
+    return curCycle;
+}
+
 void OOOCoreRecorder::reportIssueEventSimulated(OOOIssueEvent* ev, uint64_t startCycle) {
     lastEvSimulatedZllStartCycle = ev->zllStartCycle;
     lastEvSimulatedStartCycle = startCycle;
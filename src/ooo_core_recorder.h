@@ -31,6 +31,7 @@
 #include "event_recorder.h"
 #include "g_std/g_string.h"
 #include "g_std/g_vector.h"
+#include "skew_predictor.h"
 
 class OOOIssueEvent;
 class OOORespEvent;
@@ -85,6 +86,8 @@ class OOOCoreRecorder {
         uint64_t totalHaltedCycles; //does not include cycles since last transition to HALTED
         uint64_t lastUnhaltedCycle; //set on transition to HALTED
 
+        SkewPredictor skewPredictor; //used only with weave sampling
+
         uint32_t domain;
         g_string name;
 
@@ -103,6 +106,7 @@ class OOOCoreRecorder {
         //Methods called between the bound and weave phases
         uint64_t cSimStart(uint64_t curCycle); //returns updated curCycle
         uint64_t cSimEnd(uint64_t curCycle); //returns updated curCycle
+        uint64_t cSimSkip(uint64_t curCycle); //instead of cSimStart/cSimEnd on phases that skip the weave; returns updated curCycle
 
         //Methods called in the weave phase
         inline void reportIssueEventSimulated(OOOIssueEvent* ev, uint64_t startCycle);
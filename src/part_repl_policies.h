@@ -168,7 +168,7 @@ class WayPartReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
             e->ts = timestamp++;
 
             //Update partitioner...
-            monitor->access(e->p, e->addr);
+            monitor->access(e->p, e->addr, req->srcId);
         }
 
         void startReplacement(const MemReq* req) {
@@ -270,15 +270,33 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
 
         VantagePartInfo* partInfo;
 
+        /* Per-line state, packed in 8 bytes. ts wraps around, so it is compared as an age relative to the current
+         * timestamp; ageLines() clamps old ages periodically so that they never wrap. Addresses are not kept,
+         * update() always gets the line's address in req.
+         */
         struct LineInfo {
-            Address addr; //FIXME: This is redundant due to the replacement policy interface
-            uint64_t ts; //timestamp, >0 if in the cache, == 0 if line is empty (little significance otherwise)
-            uint64_t bts; //coarse-grain per-partition timestamp
-            uint32_t p; //partition ID
-            uint32_t op; //original partition id: same as partition id when in partition, but does not change when moved to FFA (unmanaged region)
+            uint32_t ts; //timestamp, >0 if in the cache, == 0 if line is empty (little significance otherwise)
+            uint32_t meta; //[31:20] partition ID, [19:8] original partition ID, [7:0] coarse-grain timestamp (8 LSBs)
+
+            //partition ID
+            uint32_t p() const {return meta >> 20;}
+            void setP(uint32_t p) {meta = (meta & 0x000fffff) | (p << 20);}
+            //original partition id: same as partition id when in partition, but does not change when moved to FFA (unmanaged region)
+            uint32_t op() const {return (meta >> 8) & 0xfff;}
+            void setOp(uint32_t op) {meta = (meta & 0xfff000ff) | (op << 8);}
+            //coarse-grain per-partition timestamp
+            uint32_t bts() const {return meta & 0xff;}
+            void setBts(uint64_t bts) {meta = (meta & 0xffffff00) | (bts & 0xff);}
         };
 
+        static const uint32_t MAX_PARTITIONS = 0xfff; //so that partition IDs, including the unmanaged region, fit in 12 bits
+        static const uint32_t AGING_PERIOD = 1 << 30; //timestamps between ageLines() calls
+        static const uint32_t MAX_AGE = 1u << 31; //ages after ageLines(); MAX_AGE + AGING_PERIOD must not wrap
+
         LineInfo* array;
+#if !VANTAGE_8BIT_BTS
+        uint64_t* wideBts; //full coarse-grain timestamps, do not fit in LineInfo
+#endif
 
         Counter profPromotions;
         Counter profUpdateCycles;
@@ -286,10 +304,10 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
         //Repl process stuff
         uint32_t* candList;
         uint32_t candIdx;
-        Address incomingLineAddr;
+        uint64_t* candKeys; //eviction priorities of candList's lines, sized like it
 
         //Globally incremented, but bears little significance per se
-        uint64_t timestamp;
+        uint32_t timestamp;
 
         double partPortion; //how much of the cache do we devote to the partition's target sizes?
         double partSlack; //how much the aperture curve reacts to "cushion" the load. partSlack+targetSize sets aperture to 1.0
@@ -307,6 +325,7 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
                 : PartReplPolicy(_monitor, _mapper), totalSize(_lines), assoc(_assoc), rng(0xABCDE563F), smoothTransients(_smoothTransients)
         {
             partitions = mapper->getNumPartitions();
+            if (partitions >= MAX_PARTITIONS) panic("Vantage supports up to %d partitions, %d requested", MAX_PARTITIONS - 1, partitions);
 
             assert(partPortionPct <= 100);
             assert(partSlackPct <= 100);
@@ -347,12 +366,16 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
             partInfo[partitions].size = totalSize;
             partInfo[partitions].extendedSize = totalSize;
             for (uint32_t i = 0; i < totalSize; i++) {
-                array[i].p = partitions;
-                array[i].op = partitions;
+                array[i].setP(partitions);
+                array[i].setOp(partitions);
             }
+#if !VANTAGE_8BIT_BTS
+            wideBts = gm_calloc<uint64_t>(totalSize);
+#endif
 
             candList = gm_calloc<uint32_t>(assoc);
             candIdx = 0;
+            candKeys = gm_calloc<uint64_t>(assoc);
             timestamp = 1;
 
             lastUpdateCycle = 0;
@@ -406,50 +429,54 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
             }
 
             LineInfo* e = &array[id];
+            uint32_t p = e->p();
             if (e->ts > 0) {
-                if (e->p == partitions) { //this is an unmanaged region promotion
-                    e->p = mapper->getPartition(*req);
+                if (p == partitions) { //this is an unmanaged region promotion
+                    p = mapper->getPartition(*req);
+                    e->setP(p);
                     profPromotions.inc();
-                    partInfo[e->p].curIntervalIns++;
-                    partInfo[e->p].size++;
+                    partInfo[p].curIntervalIns++;
+                    partInfo[p].size++;
                     partInfo[partitions].size--;
                 }
-                e->ts = timestamp++;
-                partInfo[e->p].profHits.inc();
+                e->ts = nextTimestamp();
+                partInfo[p].profHits.inc();
             } else { //post-miss update, old one has been removed, this is empty
-                e->ts = timestamp++;
-                partInfo[e->p].size--;
-                partInfo[e->p].profEvictions.inc();
-                partInfo[e->op].extendedSize--;
-                e->p = mapper->getPartition(*req);
-                e->op = e->p;
-                partInfo[e->p].curIntervalIns++;
-                partInfo[e->p].size++;
-                partInfo[e->op].extendedSize++;
-                partInfo[e->p].profMisses.inc();
-
-                if (partInfo[e->p].targetSize < partInfo[e->p].longTermTargetSize) {
+                e->ts = nextTimestamp();
+                partInfo[p].size--;
+                partInfo[p].profEvictions.inc();
+                partInfo[e->op()].extendedSize--;
+                p = mapper->getPartition(*req);
+                e->setP(p);
+                e->setOp(p);
+                partInfo[p].curIntervalIns++;
+                partInfo[p].size++;
+                partInfo[p].extendedSize++;
+                partInfo[p].profMisses.inc();
+
+                if (partInfo[p].targetSize < partInfo[p].longTermTargetSize) {
                     assert(smoothTransients);
-                    partInfo[e->p].targetSize++;
+                    partInfo[p].targetSize++;
                     takeOneLine();
                 }
             }
 
             //Profile the access
-            monitor->access(e->p, e->addr);
+            monitor->access(p, req->lineAddr, req->srcId);
 
             //Adjust coarse-grain timestamp
-            e->bts = partInfo[e->p].curBts;
-            if (++partInfo[e->p].curBtsHits >= (uint32_t) partInfo[e->p].size/16) {
-                partInfo[e->p].curBts++;
-                partInfo[e->p].setpointBts++;
-                partInfo[e->p].curBtsHits = 0;
+            e->setBts(partInfo[p].curBts);
+#if !VANTAGE_8BIT_BTS
+            wideBts[id] = partInfo[p].curBts;
+#endif
+            if (++partInfo[p].curBtsHits >= (uint32_t) partInfo[p].size/16) {
+                partInfo[p].curBts++;
+                partInfo[p].setpointBts++;
+                partInfo[p].curBtsHits = 0;
             }
         }
 
-        void startReplacement(const MemReq* req) {
-            incomingLineAddr = req->lineAddr;
-        }
+        void startReplacement(const MemReq* req) {}
 
         void recordCandidate(uint32_t id) {
             assert(candIdx < assoc);
@@ -465,7 +492,7 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
                 LineInfo* e = &array[candList[i]];
                 if (e->ts == 0) continue; //empty, bypass
 
-                uint32_t p = e->p;
+                uint32_t p = e->p();
                 if (p == partitions) continue; //bypass unmanaged region entries
 
                 uint32_t size = partInfo[p].size;
@@ -475,9 +502,9 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
 #if VANTAGE_8BIT_BTS
                 //Must do mod 256 arithmetic. This will do generally worse because of wrap-arounds, but wrapping around is pretty rare
                 //TODO: Doing things this way, we can profile the difference between this and using larger coarse-grain timestamps
-                if (((partInfo[p].curBts - e->bts) % 256) /*8-bit distance to current TS*/ >= ((partInfo[p].curBts - partInfo[p].setpointBts) % 256)) {
+                if (((partInfo[p].curBts - e->bts()) % 256) /*8-bit distance to current TS*/ >= ((partInfo[p].curBts - partInfo[p].setpointBts) % 256)) {
 #else
-                if (e->bts <= partInfo[p].setpointBts) {
+                if (wideBts[candList[i]] <= partInfo[p].setpointBts) {
 #endif
                     // Demote!
                     // Out of p
@@ -485,7 +512,7 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
                     partInfo[p].size--;
 
                     // Into unmanaged
-                    e->p = partitions;
+                    e->setP(partitions);
                     partInfo[partitions].size++;
 
                     partInfo[p].curIntervalDems++;
@@ -545,36 +572,23 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
                 }
             } //for
 
-            //Get best candidate for eviction
-            int32_t bestId = candList[0];
-
-            for (uint32_t i = 0; i < candIdx; i++) { //note we include 0; 0 compares with itself, see shortcut to understand why
-                uint32_t id = candList[i];
-                LineInfo* e = &array[id];
-                LineInfo* best = &array[bestId];
-
-                if (e->ts == 0) {
-                    //shortcut for empty positions
-                    bestId = id;
-                    break;
-                }
-
-                uint32_t p = e->p;
+            //Get best candidate for eviction: the first empty line; otherwise, the oldest unmanaged line (prioritize
+            //umgd); otherwise, the oldest managed line. Just do LRU there; with correctly-sized partitions, this is VERY rare
+            //NOTE: If we were to study really small unmanaged regions, we can always get fancier and prioritize by aperture, bts, etc.
+            //Candidates are reduced to a single key each in a branch-free pass, then the first max key wins
+            for (uint32_t i = 0; i < candIdx; i++) {
+                LineInfo e = array[candList[i]];
+                uint64_t age = (uint32_t)(timestamp - e.ts);
+                uint64_t umgd = (e.p() == partitions);
+                candKeys[i] = (e.ts == 0)? ~0ULL : ((umgd << 32) | age);
+            }
 
-                if (p == partitions && best->p != partitions) { //prioritize umgd
-                    bestId = id;
-                } else if (p == partitions && best->p == partitions) {
-                    if (e->ts < best->ts) bestId = id;
-                } else if (p != partitions && best->p == partitions) {
-                    //best wins, prioritize unmanaged
-                } else {
-                    assert(p != partitions && best->p != partitions);
-                    //Just do LRU; with correctly-sized partitions, this is VERY rare
-                    //NOTE: If we were to study really small unmanaged regions, we can always get fancier and prioritize by aperture, bts, etc.
-                    if (e->ts < best->ts) bestId = id;
-                }
+            uint32_t bestIdx = 0;
+            for (uint32_t i = 1; i < candIdx; i++) {
+                if (candKeys[i] > candKeys[bestIdx]) bestIdx = i;
             }
-            assert(bestId >= 0 && (uint32_t)bestId < totalSize);
+            uint32_t bestId = candList[bestIdx];
+            assert(bestId < totalSize);
             return bestId;
         }
 
@@ -583,8 +597,10 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
 
             LineInfo* e = &array[id];
             e->ts = 0;
-            e->bts = 0;
-            e->addr = incomingLineAddr;
+            e->setBts(0);
+#if !VANTAGE_8BIT_BTS
+            wideBts[id] = 0;
+#endif
         }
 
     private:
@@ -618,6 +634,26 @@ class VantageReplPolicy : public PartReplPolicy, public LegacyReplPolicy {
 #endif
         }
 
+        uint32_t nextTimestamp() {
+            uint32_t ts = timestamp++;
+            if (unlikely((timestamp & (AGING_PERIOD - 1)) == 0)) {
+                ageLines();
+                if (timestamp == 0) timestamp = 1; //0 marks empty lines
+            }
+            return ts;
+        }
+
+        //Clamps the ages of lines untouched for over MAX_AGE accesses, so that 32-bit ages never wrap. Lines this old
+        //tie in LRU order, but otherwise order is exact
+        void ageLines() {
+            uint32_t oldestTs = timestamp - MAX_AGE;
+            if (oldestTs == 0) oldestTs = 1;
+            for (uint32_t i = 0; i < totalSize; i++) {
+                LineInfo* e = &array[i];
+                if (e->ts != 0 && (uint32_t)(timestamp - e->ts) > MAX_AGE) e->ts = oldestTs;
+            }
+        }
+
         void takeOneLine() {
             assert(smoothTransients);
             uint32_t linesLeft = 0;
@@ -0,0 +1,116 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compares the UCP lookahead partitioner against peekahead (see partitioner.h) on synthetic miss curves: checks that
+ * both produce the same allocations, and reports the time per repartition of each. Curves are non-increasing, like
+ * UMON miss curves, and mix smooth decays, cliffs (working sets that fit at some size) and flat stretches, which are
+ * the cases where the convex hulls matter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "galloc.h"
+#include "log.h"
+#include "mtrand.h"
+#include "partitioner.h"
+#include "profile_stats.h"
+
+using namespace std;
+
+class CurveMonitor : public PartitionMonitor {
+    private:
+        uint32_t numPartitions;
+        vector<uint32_t> misses;  // (buckets + 1) points per partition
+
+    public:
+        CurveMonitor(uint32_t _numPartitions, uint32_t _buckets, MTRand& rnd)
+            : PartitionMonitor(_buckets), numPartitions(_numPartitions), misses(_numPartitions*(_buckets + 1))
+        {
+            for (uint32_t p = 0; p < numPartitions; p++) {
+                uint32_t* curve = &misses[p*(buckets + 1)];
+                double m = 1e6*(1 + rnd.randInt() % 100);
+                double decay = 1.0 - (1 + rnd.randInt() % 100)/(10.0*buckets);
+                uint32_t cliff = rnd.randInt() % (buckets + 1);
+                for (uint32_t b = 0; b <= buckets; b++) {
+                    if (b == cliff) m *= 0.3;
+                    if (rnd.randInt() % 4) m *= decay;  // flat stretches
+                    curve[b] = (uint32_t)m;
+                }
+            }
+        }
+
+        uint32_t getNumPartitions() const { return numPartitions; }
+        void access(uint32_t partition, Address lineAddr, uint32_t srcId) {}
+        uint32_t get(uint32_t partition, uint32_t bucket) const { return misses[partition*(buckets + 1) + bucket]; }
+        uint32_t getNumAccesses(uint32_t partition) const { return get(partition, 0); }
+        void reset() {}
+};
+
+// Returns ms per repartition
+static double bench(bool hulls, uint32_t parts, uint32_t buckets, const vector<CurveMonitor*>& monitors, vector<uint32_t>& allocs) {
+    uint64_t startNs = getNs();
+    for (uint32_t m = 0; m < monitors.size(); m++) {
+        if (hulls) peekahead::computeBestPartitioning(parts, buckets, 1, nullptr, &allocs[m*parts], *monitors[m]);
+        else lookahead::computeBestPartitioning(parts, buckets, 1, nullptr, &allocs[m*parts], *monitors[m]);
+    }
+    return (getNs() - startNs)/1e6/monitors.size();
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc > 2) {
+        info("Checks and benchmarks peekahead against lookahead partitioning");
+        info("Usage: %s [<curve sets per size, default 4>]", argv[0]);
+        exit(1);
+    }
+    uint32_t sets = (argc == 2)? strtoul(argv[1], nullptr, 0) : 4;
+
+    gm_init(64<<20 /*64 MB*/);
+
+    struct Size {uint32_t parts, buckets;};
+    const Size sizes[] = {{4, 256}, {16, 1024}, {16, 4096}, {64, 1024}, {64, 4096}, {256, 1024}, {256, 4096}};
+
+    MTRand rnd(42);
+    info("%6s %8s %14s %14s %9s", "Parts", "Buckets", "Lookahead ms", "Peekahead ms", "Speedup");
+    for (const Size& s : sizes) {
+        vector<CurveMonitor*> monitors;
+        for (uint32_t i = 0; i < sets; i++) monitors.push_back(new CurveMonitor(s.parts, s.buckets, rnd));
+        vector<uint32_t> lookaheadAllocs(sets*s.parts), peekaheadAllocs(sets*s.parts);
+        double lookaheadMs = bench(false, s.parts, s.buckets, monitors, lookaheadAllocs);
+        double peekaheadMs = bench(true, s.parts, s.buckets, monitors, peekaheadAllocs);
+        for (uint32_t i = 0; i < sets*s.parts; i++) {
+            if (lookaheadAllocs[i] != peekaheadAllocs[i]) {
+                panic("%d parts, %d buckets: set %d partition %d gets %d buckets with lookahead, %d with peekahead",
+                        s.parts, s.buckets, i/s.parts, i % s.parts, lookaheadAllocs[i], peekaheadAllocs[i]);
+            }
+        }
+        info("%6d %8d %14.3f %14.3f %9.2f", s.parts, s.buckets, lookaheadMs, peekaheadMs, lookaheadMs/peekaheadMs);
+        for (CurveMonitor* m : monitors) delete m;
+    }
+    info("All allocations match");
+    return 0;
+}
@@ -56,23 +56,34 @@ class Partitioner : public GlobAlloc {
         bool* forbidden;
 };
 
+class PartitionMonitor;
+
 // Gives best partition sizes as estimated with the greedy lookahead
 // algorithm proposed in the UCP paper (Qureshi and Patt, ISCA 2006)
 namespace lookahead {
-    uint64_t computePartitioningTotalUtility(uint32_t numPartitions, const uint32_t* parts, const uint32_t* missCurves);
-    void computeBestPartitioning(uint32_t numPartitions, uint32_t* allocs, uint32_t* missCurves);
+    uint64_t computePartitioningTotalUtility(uint32_t numPartitions, const uint32_t* parts, const PartitionMonitor& monitor);
+    void computeBestPartitioning(uint32_t numPartitions, uint32_t buckets, uint32_t minAlloc, bool* forbidden,
+                                 uint32_t* allocs, const PartitionMonitor& monitor);
+}
+
+// Same results as lookahead, using convex hulls of the miss curves (Peekahead, from Jigsaw, PACT 2013)
+namespace peekahead {
+    void computeBestPartitioning(uint32_t numPartitions, uint32_t buckets, uint32_t minAlloc, bool* forbidden,
+                                 uint32_t* allocs, const PartitionMonitor& monitor);
 }
 
 class LookaheadPartitioner : public Partitioner {
     public:
         LookaheadPartitioner(PartReplPolicy* _repl, uint32_t _numPartitions, uint32_t _buckets,
-                             uint32_t _minAlloc = 1, double _allocPortion = 1.0, bool* _forbidden = nullptr);
+                             uint32_t _minAlloc = 1, double _allocPortion = 1.0, bool* _forbidden = nullptr,
+                             bool _useHulls = true);
         void partition();
 
     private:
         PartReplPolicy* repl;
         uint32_t numPartitions;
         uint32_t buckets;
+        bool useHulls;  // peekahead instead of lookahead
         uint32_t* curAllocs;
 };
 
@@ -85,8 +96,8 @@ class PartitionMonitor : public GlobAlloc {
 
         virtual uint32_t getNumPartitions() const = 0;
 
-        // called by PartReplPolicy on a memory reference
-        virtual void access(uint32_t partition, Address lineAddr) = 0;
+        // called by PartReplPolicy on a memory reference, with the cache lock held
+        virtual void access(uint32_t partition, Address lineAddr, uint32_t srcId) = 0;
 
         // called by Partitioner to get misses
         virtual uint32_t get(uint32_t partition, uint32_t bucket) const = 0;
@@ -104,24 +115,42 @@ class PartitionMonitor : public GlobAlloc {
 
 // Maintains UMONs for each partition as in (Qureshi and Patt, ISCA 2006).
 // Stupid name...but what do you call it? -nzb
+// Accesses only run the sampling filter; sampled addresses are buffered per
+// core and partition, and fed to the UMONs at the end of each phase, one
+// partition per host thread.
 class UMonMonitor : public PartitionMonitor {
     public:
         UMonMonitor(uint32_t _numLines, uint32_t _umonLines, uint32_t _umonBuckets, uint32_t _numPartitions, uint32_t _buckets);
         ~UMonMonitor();
 
         uint32_t getNumPartitions() const { return monitors.size(); }
-        void access(uint32_t partition, Address lineAddr);
+        void access(uint32_t partition, Address lineAddr, uint32_t srcId);
         uint32_t get(uint32_t partition, uint32_t bucket) const;
         uint32_t getNumAccesses(uint32_t partition) const;
         void reset();
 
+        // Feeds all buffered samples to the UMONs. Called at the end of every
+        // phase, and before reading or resetting the monitors.
+        void drain() const;
+
     private:
+        class DrainTask;
+
         void getMissCurves() const;
         void getMissCurve(uint32_t* misses, uint32_t partition) const;
+        void drainPartition(uint32_t partition) const;
 
         mutable uint32_t* missCache;
         mutable bool missCacheValid;
         g_vector<UMon*> monitors;       // individual monitors per partition
+
+        // Sample buffers, indexed by [srcId % numSlots][partition]. Accesses
+        // are serialized by the cache lock, and drains happen outside the
+        // bound phase, so they need no locking of their own.
+        mutable g_vector< g_vector< g_vector<Address> > > samples;
+        uint32_t numSlots;
+        mutable uint64_t pendingSamples;
+        DrainTask* drainTask;
 };
 
 #endif  // PARTITIONER_H_
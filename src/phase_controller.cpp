@@ -0,0 +1,142 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "phase_controller.h"
+#include "contention_sim.h"
+#include "log.h"
+#include "zsim.h"
+
+PhaseLengthController::PhaseLengthController(uint32_t _minLength, uint32_t _maxLength, double _growSkew, double _shrinkSkew,
+                                             double _shrinkRetries, double _shrinkQueueDelay, uint32_t _growHysteresis)
+    : minLength(_minLength), maxLength(_maxLength), growSkew(_growSkew), shrinkSkew(_shrinkSkew),
+      shrinkRetries(_shrinkRetries), shrinkQueueDelay(_shrinkQueueDelay), growHysteresis(_growHysteresis), quietPhases(0),
+      lastCrossings(0), lastRetries(0), lastQueuedRequests(0), lastQueueDelayCycles(0)
+{
+    assert(minLength > 0 && minLength <= maxLength);
+    assert(growSkew <= shrinkSkew);
+    decidedLength = zinfo->phaseLength;
+    info("Adaptive phase length: %d-%d cycles, grow below %.3f skew, shrink above %.3f skew, %.2f crossing retries or %.0f queueing delay cycles",
+         minLength, maxLength, growSkew, shrinkSkew, shrinkRetries, shrinkQueueDelay);
+}
+
+void PhaseLengthController::initStats(AggregateStat* parentStat) {
+    AggregateStat* plStat = new AggregateStat();
+    plStat->init("phaseLen", "Adaptive phase length stats");
+    auto lenStat = makeLambdaStat([]() { return zinfo->phaseLength; });
+    lenStat->init("len", "Current phase length");
+    plStat->append(lenStat);
+    auto cyclesStat = makeLambdaStat([]() { return zinfo->globPhaseCycles; });
+    cyclesStat->init("cycles", "Cycles at the start of the current phase");
+    plStat->append(cyclesStat);
+    profGrows.init("grows", "Phase length increases"); plStat->append(&profGrows);
+    profShrinks.init("shrinks", "Phase length decreases"); plStat->append(&profShrinks);
+    profSkewCycles.init("skewCycles", "Sum of the per-phase largest weave-phase delay on a core"); plStat->append(&profSkewCycles);
+    profCrossings.init("xings", "Domain crossings simulated"); plStat->append(&profCrossings);
+    profCrossingRetries.init("xingRetries", "Crossing simulation retries due to lagging source domains"); plStat->append(&profCrossingRetries);
+    profQueuedRequests.init("queuedReqs", "Requests to components that model queues"); plStat->append(&profQueuedRequests);
+    profQueueDelayCycles.init("queueDelay", "Cycles those requests spent beyond their zero-load latency"); plStat->append(&profQueueDelayCycles);
+    parentStat->append(plStat);
+}
+
+void PhaseLengthController::endOfPhase() {
+    ContentionSim* csim = zinfo->contentionSim;
+    uint64_t skewCycles = csim->getLastPhaseMaxSkew();
+    uint64_t crossings = csim->getCrossings();
+    uint64_t retries = csim->getCrossingRetries();
+    uint64_t phaseCrossings = crossings - lastCrossings;
+    uint64_t phaseRetries = retries - lastRetries;
+    lastCrossings = crossings;
+    lastRetries = retries;
+
+    uint64_t queuedRequests = csim->getQueuedRequests();
+    uint64_t queueDelayCycles = csim->getQueueDelayCycles();
+    uint64_t phaseQueuedRequests = queuedRequests - lastQueuedRequests;
+    uint64_t phaseQueueDelayCycles = queueDelayCycles - lastQueueDelayCycles;
+    lastQueuedRequests = queuedRequests;
+    lastQueueDelayCycles = queueDelayCycles;
+
+    profSkewCycles.inc(skewCycles);
+    profCrossings.inc(phaseCrossings);
+    profCrossingRetries.inc(phaseRetries);
+    profQueuedRequests.inc(phaseQueuedRequests);
+    profQueueDelayCycles.inc(phaseQueueDelayCycles);
+
+    double skew = ((double)skewCycles)/zinfo->phaseLength;
+    double retryRatio = phaseCrossings? ((double)phaseRetries)/phaseCrossings : 0.0;
+    double queueDelay = phaseQueuedRequests? ((double)phaseQueueDelayCycles)/phaseQueuedRequests : 0.0;
+
+    if (skew > shrinkSkew || retryRatio > shrinkRetries || queueDelay > shrinkQueueDelay) {
+        quietPhases = 0;
+        uint32_t len = MAX(decidedLength/2, minLength);
+        if (len != decidedLength) {
+            decidedLength = len;
+            profShrinks.inc();
+        }
+    } else if (skew < growSkew && retryRatio < shrinkRetries/4 && queueDelay < shrinkQueueDelay/4) {
+        if (++quietPhases >= growHysteresis) {
+            quietPhases = 0;
+            uint32_t len = MIN((uint64_t)decidedLength*2, (uint64_t)maxLength);
+            if (len != decidedLength) {
+                decidedLength = len;
+                profGrows.inc();
+            }
+        }
+    } else {
+        quietPhases = 0;
+    }
+}
+
+void PhaseLengthController::advance() {
+    zinfo->phaseLength = zinfo->nextPhaseLength;
+    zinfo->nextPhaseLength = decidedLength;
+}
+
+// Lengths of the phases from the current one on
+static inline uint32_t PhaseLengthAt(uint64_t phase) {
+    if (phase == 0) return zinfo->phaseLength;
+    if (phase == 1 || !zinfo->phaseController) return zinfo->nextPhaseLength;
+    return zinfo->phaseController->getDecidedLength();
+}
+
+uint64_t PhasesToCycles(uint64_t phases) {
+    uint64_t cycles = 0;
+    for (uint64_t p = 0; p < 2 && p < phases; p++) cycles += PhaseLengthAt(p);
+    if (phases > 2) cycles += (phases - 2)*PhaseLengthAt(2);
+    return cycles;
+}
+
+uint64_t CyclesToPhases(uint64_t cycles) {
+    uint64_t phases = 0;
+    for (; phases < 2; phases++) {
+        uint32_t len = PhaseLengthAt(phases);
+        if (cycles < len) return phases;
+        cycles -= len;
+    }
+    return phases + cycles/PhaseLengthAt(2);
+}
+
+uint32_t MaxPhaseLength() {
+    return zinfo->phaseController? zinfo->phaseController->getMaxLength() : zinfo->phaseLength;
+}
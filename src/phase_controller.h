@@ -0,0 +1,100 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHASE_CONTROLLER_H_
+#define PHASE_CONTROLLER_H_
+
+#include <stdint.h>
+#include "galloc.h"
+#include "stats.h"
+
+/* Adaptive phase length (sim.adaptivePhaseLength). Long phases cut barrier and weave overheads, but let
+ * bound-phase timings drift further from contended timings. At the end of each weave phase, this samples:
+ *  - skew: the largest delay that the weave phase added to any core, as a fraction of the phase. This is
+ *    how far off the bound phase was for the worst core.
+ *  - crossing retries per crossing: how often a weave domain had to wait on another one because it had
+ *    run out of slack.
+ *  - queueing delay: the mean cycles that requests to components that model queues (DDRMemory) spent
+ *    beyond their zero-load latency, which the bound phase does not see.
+ * and halves the phase length (down to sim.minPhaseLength) when any is high, or doubles it (up to
+ * sim.maxPhaseLength) after several quiet phases in a row.
+ *
+ * Cores compute their next phase end before they reach the barrier, so decisions are made one phase
+ * ahead: zinfo->phaseLength is the length of the current phase, zinfo->nextPhaseLength that of the
+ * next one, and the decision taken at the end of phase N applies to phase N+2.
+ */
+class PhaseLengthController : public GlobAlloc {
+    private:
+        uint32_t minLength;
+        uint32_t maxLength;
+        double growSkew; //grow when skew is below this...
+        double shrinkSkew; //...and shrink when above this
+        double shrinkRetries; //shrink when crossing retries per crossing exceed this
+        double shrinkQueueDelay; //shrink when the mean queueing delay (cycles/request) exceeds this
+        uint32_t growHysteresis; //quiet phases needed to grow
+
+        uint32_t decidedLength;
+        uint32_t quietPhases;
+
+        uint64_t lastCrossings;
+        uint64_t lastRetries;
+        uint64_t lastQueuedRequests;
+        uint64_t lastQueueDelayCycles;
+
+        Counter profGrows;
+        Counter profShrinks;
+        Counter profSkewCycles;
+        Counter profCrossings;
+        Counter profCrossingRetries;
+        Counter profQueuedRequests;
+        Counter profQueueDelayCycles;
+
+    public:
+        PhaseLengthController(uint32_t _minLength, uint32_t _maxLength, double _growSkew, double _shrinkSkew,
+                              double _shrinkRetries, double _shrinkQueueDelay, uint32_t _growHysteresis);
+
+        void initStats(AggregateStat* parentStat);
+
+        // Called at the end of each weave phase, samples it and decides on the length of the phase after next
+        void endOfPhase();
+
+        // Called right after zinfo->globPhaseCycles moves past the phase that just ended
+        void advance();
+
+        uint32_t getDecidedLength() const {return decidedLength;}
+        uint32_t getMaxLength() const {return maxLength;}
+};
+
+/* Conversions for code that schedules in whole phases (sleeps, timeouts, the scheduler's watchdog), counting from
+ * the current phase. The current and next phase lengths are known, and later phases are assumed to keep the
+ * controller's latest decision, so these are exact with a fixed phase length and estimates otherwise.
+ */
+uint64_t PhasesToCycles(uint64_t phases);
+uint64_t CyclesToPhases(uint64_t cycles); //whole phases that fit in cycles
+
+// Longest phase the simulation may run; bounds per-phase progress (e.g., AdaptiveEvent rates)
+uint32_t MaxPhaseLength();
+
+#endif  // PHASE_CONTROLLER_H_
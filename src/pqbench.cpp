@@ -0,0 +1,122 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Replays event queue streams recorded by the contention simulation (see
+ * RECORD_EVENT_STREAMS in contention_sim.h) through PrioQueue, with both the
+ * far-element map and the timing wheel, checks that both dequeue the recorded
+ * cycles, and reports their speed. Like the weave phase, it checks the first
+ * cycle after every dequeue.
+ */
+
+#include <stdio.h>
+#include <vector>
+
+#include "contention_sim.h"  // for PQ_BLOCKS
+#include "galloc.h"
+#include "log.h"
+#include "prio_queue.h"
+#include "profile_stats.h"
+
+using namespace std;
+
+struct StreamElem {
+    StreamElem* next;
+    uint64_t privCycle;
+};
+
+volatile uint64_t firstCycleSink;  // keeps firstCycle() calls from being optimized away
+
+// Returns the replay time in ns
+uint64_t replay(const vector<uint64_t>& stream, bool useWheel, uint64_t& maxSize) {
+    uint64_t enqueues = 0;
+    for (uint64_t rec : stream) if (!(rec & PQ_STREAM_DEQUEUE)) enqueues++;
+    vector<StreamElem> elems(enqueues);  // not reused, so each dequeued element is fresh in the queue
+    for (StreamElem& e : elems) e.next = nullptr;
+
+    PrioQueue<StreamElem, PQ_BLOCKS>* pq = new PrioQueue<StreamElem, PQ_BLOCKS>();
+    pq->setFarWheel(useWheel);
+
+    uint64_t curElem = 0;
+    maxSize = 0;
+    uint64_t startNs = getNs();
+    for (uint64_t i = 0; i < stream.size(); i++) {
+        uint64_t rec = stream[i];
+        if (rec & PQ_STREAM_DEQUEUE) {
+            uint64_t recCycle = rec & ~PQ_STREAM_DEQUEUE;
+            if (!pq->size()) panic("Record %ld: dequeue from an empty queue, is the stream complete?", i);
+            uint64_t cycle;
+            pq->dequeue(cycle);
+            if (cycle != recCycle) panic("Record %ld: dequeued cycle %ld, recorded %ld (%s)", i, cycle, recCycle, useWheel? "wheel" : "map");
+            if (pq->size()) firstCycleSink = pq->firstCycle();
+        } else {
+            pq->enqueue(&elems[curElem++], rec);
+            if (pq->size() > maxSize) maxSize = pq->size();
+        }
+    }
+    uint64_t ns = getNs() - startNs;
+
+    // The stream may end with events queued for future phases; drain them in order
+    uint64_t lastCycle = 0;
+    while (pq->size()) {
+        uint64_t cycle;
+        pq->dequeue(cycle);
+        if (cycle < lastCycle) panic("Drain: dequeued cycle %ld after %ld (%s)", cycle, lastCycle, useWheel? "wheel" : "map");
+        lastCycle = cycle;
+    }
+
+    delete pq;
+    return ns;
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc < 2) {
+        info("Replays recorded event queue streams through the map- and wheel-based PrioQueues");
+        info("Usage: %s <stream> [<stream> ...]", argv[0]);
+        exit(1);
+    }
+
+    gm_init(256<<20 /*256 MB, for the far-element map*/);
+
+    info("%30s %12s %10s %12s %12s %8s", "Stream", "Ops", "MaxSize", "Map ns/op", "Wheel ns/op", "Speedup");
+    for (int a = 1; a < argc; a++) {
+        FILE* f = fopen(argv[a], "r");
+        if (!f) panic("Could not open %s", argv[a]);
+        vector<uint64_t> stream;
+        uint64_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, sizeof(uint64_t), 4096, f))) stream.insert(stream.end(), buf, buf + n);
+        fclose(f);
+        if (stream.empty()) continue;
+
+        uint64_t maxSize;
+        uint64_t mapNs = replay(stream, false, maxSize);
+        uint64_t wheelNs = replay(stream, true, maxSize);
+        info("%30s %12ld %10ld %12.2f %12.2f %8.2f", argv[a], stream.size(), maxSize,
+                ((double)mapNs)/stream.size(), ((double)wheelNs)/stream.size(), ((double)mapNs)/wheelNs);
+    }
+
+    return 0;
+}
@@ -28,6 +28,22 @@
 
 #include "g_std/g_multimap.h"
 
+/* Priority queue of objects keyed by cycle. The near future (B blocks of 64
+ * cycles) is a ring of bitmap-indexed buckets. Far elements go either to a
+ * multimap (default), or, after setFarWheel(), to a hierarchical timing wheel
+ * with 64-slot levels over half-windows of B/2 blocks, which makes enqueues
+ * and dequeues O(1) amortized at any distance. Either way, far elements move
+ * to the ring as it advances every B/2 blocks.
+ *
+ * T must have a "T* next" field, and, for the wheel, a "uint64_t privCycle"
+ * field that the queue uses while the element is far.
+ */
+/* Recorded event streams (RECORD_EVENT_STREAMS in contention_sim.h) are
+ * sequences of uint64_t records, the cycle of each enqueue, or
+ * PQ_STREAM_DEQUEUE | cycle for each dequeue. pqbench replays them.
+ */
+#define PQ_STREAM_DEQUEUE (1UL << 63)
+
 template <typename T, uint32_t B>
 class PrioQueue {
     struct PQBlock {
@@ -67,6 +83,23 @@ class PrioQueue {
 
     FEMap feMap;
 
+    // Far element wheel. Half-window h is at the level of the highest base-64
+    // digit in which it differs from wheelBase, in the slot given by that digit.
+    static const uint32_t WHEEL_LEVELS = 10;  // 60 bits of half-windows
+    static const uint64_t HALF_WINDOW = B/2;  // in blocks
+
+    struct WheelLevel {
+        T* slots[64];
+        uint64_t occ;
+    };
+
+    WheelLevel wheel[WHEEL_LEVELS];
+    uint64_t wheelBase; // half-windows up to wheelBase are in blocks[]; always curBlock/HALF_WINDOW + 1
+    uint64_t farElems;
+    mutable uint64_t farMinCycle;
+    mutable bool farMinValid;
+    bool useWheel;
+
     uint64_t curBlock;
     uint64_t elems;
 
@@ -74,13 +107,39 @@ class PrioQueue {
         PrioQueue() {
             curBlock = 0;
             elems = 0;
+            for (uint32_t l = 0; l < WHEEL_LEVELS; l++) {
+                for (uint32_t s = 0; s < 64; s++) wheel[l].slots[s] = nullptr;
+                wheel[l].occ = 0;
+            }
+            wheelBase = 1;
+            farElems = 0;
+            farMinCycle = 0;
+            farMinValid = false;
+            useWheel = false;
+        }
+
+        // Use the timing wheel for far elements; must be called while empty
+        void setFarWheel(bool wheel) {
+            assert(!elems);
+            useWheel = wheel;
         }
 
         void enqueue(T* obj, uint64_t cycle) {
             uint64_t absBlock = cycle/64;
             assert(absBlock >= curBlock);
 
-            if (absBlock < curBlock + B) {
+            if (useWheel) {
+                uint64_t h = absBlock/HALF_WINDOW;
+                if (h <= wheelBase) {
+                    blocks[absBlock % B].enqueue(obj, cycle % 64);
+                } else {
+                    assert(!obj->next);
+                    obj->privCycle = cycle;
+                    wheelInsert(obj, h);
+                    farElems++;
+                    if (farMinValid && cycle < farMinCycle) farMinCycle = cycle;
+                }
+            } else if (absBlock < curBlock + B) {
                 uint32_t i = absBlock % B;
                 uint32_t offset = cycle % 64;
                 blocks[i].enqueue(obj, offset);
@@ -93,25 +152,30 @@ class PrioQueue {
 
         T* dequeue(uint64_t& deqCycle) {
             assert(elems);
+            if (useWheel && elems == farElems) wheelJump();
             while (!blocks[curBlock % B].occ) {
                 curBlock++;
-                if ((curBlock % (B/2)) == 0 && !feMap.empty()) {
-                    uint64_t topCycle = (curBlock + B)*64;
-                    //Move every element with cycle < topCycle to blocks[]
-                    FEMapIterator it = feMap.begin();
-                    while (it != feMap.end() && it->first < topCycle) {
-                        uint64_t cycle = it->first;
-                        T* obj = it->second;
-
-                        uint64_t absBlock = cycle/64;
-                        assert(absBlock >= curBlock);
-                        assert(absBlock < curBlock + B);
-                        uint32_t i = absBlock % B;
-                        uint32_t offset = cycle % 64;
-                        blocks[i].enqueue(obj, offset);
-                        it++;
+                if ((curBlock % (B/2)) == 0) {
+                    if (useWheel) {
+                        wheelAdvance(curBlock/HALF_WINDOW + 1);
+                    } else if (!feMap.empty()) {
+                        uint64_t topCycle = (curBlock + B)*64;
+                        //Move every element with cycle < topCycle to blocks[]
+                        FEMapIterator it = feMap.begin();
+                        while (it != feMap.end() && it->first < topCycle) {
+                            uint64_t cycle = it->first;
+                            T* obj = it->second;
+
+                            uint64_t absBlock = cycle/64;
+                            assert(absBlock >= curBlock);
+                            assert(absBlock < curBlock + B);
+                            uint32_t i = absBlock % B;
+                            uint32_t offset = cycle % 64;
+                            blocks[i].enqueue(obj, offset);
+                            it++;
+                        }
+                        feMap.erase(feMap.begin(), it);
                     }
-                    feMap.erase(feMap.begin(), it);
                 }
             }
 
@@ -130,6 +194,16 @@ class PrioQueue {
 
         inline uint64_t firstCycle() const {
             assert(elems);
+            if (useWheel) {
+                // Near elements always precede far ones
+                if (elems == farElems) return wheelFirstCycle();
+                for (uint32_t i = 0; i < B; i++) {
+                    uint64_t occ = blocks[(curBlock + i) % B].occ;
+                    if (occ) return (curBlock + i)*64 + __builtin_ctzl(occ);
+                }
+                panic("PrioQueue: near elements not found");
+            }
+
             for (uint32_t i = 0; i < B/2; i++) {
                 uint64_t occ = blocks[(curBlock + i) % B].occ;
                 if (occ) {
@@ -148,7 +222,89 @@ class PrioQueue {
 
             return feMap.begin()->first;
         }
+
+    private:
+        void wheelInsert(T* obj, uint64_t h) {
+            uint64_t diff = h ^ wheelBase;
+            uint32_t l = diff? (63 - __builtin_clzl(diff))/6 : 0;
+            assert(l < WHEEL_LEVELS);
+            uint32_t s = (h >> (6*l)) & 63;
+            obj->next = wheel[l].slots[s];
+            wheel[l].slots[s] = obj;
+            wheel[l].occ |= 1L << s;
+        }
+
+        // Moves wheelBase to half-window t, cascading the slots that t enters
+        // from the top level down, then moves t's elements to blocks[]
+        void wheelAdvance(uint64_t t) {
+            assert(t > wheelBase);
+            wheelBase = t;
+            farMinValid = false;
+            for (uint32_t l = WHEEL_LEVELS - 1; l > 0; l--) {
+                if (t & ((1L << (6*l)) - 1)) continue;  // t does not start a level-l slot
+                uint32_t s = (t >> (6*l)) & 63;
+                if (!(wheel[l].occ & (1L << s))) continue;
+                T* obj = wheel[l].slots[s];
+                wheel[l].slots[s] = nullptr;
+                wheel[l].occ ^= 1L << s;
+                while (obj) {
+                    T* next = obj->next;
+                    wheelInsert(obj, obj->privCycle/64/HALF_WINDOW);
+                    obj = next;
+                }
+            }
+
+            uint32_t s = t & 63;
+            if (!(wheel[0].occ & (1L << s))) return;
+            T* obj = wheel[0].slots[s];
+            wheel[0].slots[s] = nullptr;
+            wheel[0].occ ^= 1L << s;
+            while (obj) {
+                T* next = obj->next;
+                obj->next = nullptr;
+                uint64_t cycle = obj->privCycle;
+                assert(cycle/64/HALF_WINDOW == t);
+                assert(cycle/64 >= curBlock && cycle/64 < curBlock + B);
+                blocks[(cycle/64) % B].enqueue(obj, cycle % 64);
+                farElems--;
+                obj = next;
+            }
+        }
+
+        // Start of the lowest occupied wheel slot, which holds the earliest far elements
+        uint64_t wheelFirstSlot(uint32_t& level, uint32_t& slot) const {
+            assert(farElems);
+            uint32_t l = 0;
+            while (!wheel[l].occ) l++;
+            uint32_t s = __builtin_ctzl(wheel[l].occ);
+            level = l;
+            slot = s;
+            uint64_t prefix = (l + 1 < WHEEL_LEVELS)? (wheelBase >> (6*(l + 1))) << (6*(l + 1)) : 0;
+            return prefix | (((uint64_t)s) << (6*l));
+        }
+
+        // Only called with no near elements: skips to the earliest far elements
+        void wheelJump() {
+            while (elems == farElems) {
+                uint32_t l, s;
+                uint64_t t = wheelFirstSlot(l, s);
+                assert(t > wheelBase);
+                curBlock = (t - 1)*HALF_WINDOW;  // blocks[] is empty, so this just skips it forward
+                wheelAdvance(t);
+            }
+        }
+
+        uint64_t wheelFirstCycle() const {
+            if (!farMinValid) {
+                uint32_t l, s;
+                wheelFirstSlot(l, s);
+                uint64_t minCycle = -1L;
+                for (T* obj = wheel[l].slots[s]; obj; obj = obj->next) minCycle = MIN(minCycle, obj->privCycle);
+                farMinCycle = minCycle;
+                farMinValid = true;
+            }
+            return farMinCycle;
+        }
 };
 
 #endif  // PRIO_QUEUE_H_
-
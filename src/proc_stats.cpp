@@ -24,11 +24,14 @@
  */
 
 #include "proc_stats.h"
+#include "contention_sim.h"
 #include "process_tree.h"
 #include "scheduler.h"
 #include "str.h"
 #include "zsim.h"
 
+#define UPDATE_CORES_PER_ITEM 16
+
 class ProcStats::ProcessCounter : public Counter {
     private:
         ProcStats* ps;
@@ -55,6 +58,25 @@ class ProcStats::ProcessVectorCounter : public VectorCounter {
         }
 };
 
+class ProcStats::DumpTask : public ParallelTask {
+    private:
+        ProcStats* ps;
+    public:
+        explicit DumpTask(ProcStats* _ps) : ps(_ps) {}
+        void run(uint32_t item) {
+            uint32_t firstCore = item*UPDATE_CORES_PER_ITEM;
+            ps->dumpCores(firstCore, MIN(firstCore + UPDATE_CORES_PER_ITEM, zinfo->numCores));
+        }
+};
+
+class ProcStats::IncTask : public ParallelTask {
+    private:
+        ProcStats* ps;
+    public:
+        explicit IncTask(ProcStats* _ps) : ps(_ps) {}
+        void run(uint32_t item) { ps->incStat(item); }
+};
+
 static uint64_t StatSize(Stat* s) {
     uint64_t sz = 0;
      if (AggregateStat* as = dynamic_cast<AggregateStat*>(s)) {
@@ -151,6 +173,23 @@ ProcStats::ProcStats(AggregateStat* parentStat, AggregateStat* _coreStats) : cor
     buf = gm_calloc<uint64_t>(bufSize);
     lastBuf = gm_calloc<uint64_t>(bufSize);
 
+    uint32_t numCores = zinfo->numCores;
+    offsets = gm_calloc<uint64_t>(coreStats->size()*numCores + 1);
+    uint64_t start = 0;
+    for (uint32_t i = 0; i < coreStats->size(); i++) {
+        AggregateStat* as = dynamic_cast<AggregateStat*>(coreStats->get(i));
+        for (uint32_t c = 0; c < numCores; c++) {
+            offsets[i*numCores + c] = start;
+            start += StatSize(as->get(c));
+        }
+    }
+    assert(start == bufSize);
+    offsets[coreStats->size()*numCores] = bufSize;
+    coreGroups = gm_calloc<uint32_t>(numCores);
+
+    dumpTask = new DumpTask(this);
+    incTask = new IncTask(this);
+
     // Create the procStats
     procStats = new AggregateStat(true);
     procStats->init("procStats", "Per-process stats");
@@ -172,33 +211,48 @@ void ProcStats::update() {
     if (likely(lastUpdatePhase == zinfo->numPhases)) return;
     assert(lastUpdatePhase < zinfo->numPhases);
 
-    uint64_t* endBuf = DumpWalk(coreStats, buf);
-    assert(buf + bufSize == endBuf);
-
-    for (uint64_t i = 0; i < bufSize; i++) {
-        lastBuf[i] = buf[i] - lastBuf[i];
-    }
+    // Every core's stats are dumped and diffed into buf, then accumulated into the stats of the
+    // process that ran on it. Each step is split in items that touch disjoint parts of buf and of
+    // procStats, so the idle sim threads can do them in parallel. Callers are either end-of-phase
+    // events or descheduling, both serialized by the scheduler and outside the weave phase.
+    uint32_t numCoreItems = (zinfo->numCores + UPDATE_CORES_PER_ITEM - 1)/UPDATE_CORES_PER_ITEM;
+    zinfo->contentionSim->runParallel(dumpTask, numCoreItems);
     std::swap(lastBuf, buf);
 
     // Now lastBuf has been updated and buf has the differences of all the counters
-    uint64_t start = 0;
-    for (uint32_t i = 0; i < coreStats->size(); i++) {
-        AggregateStat* as = dynamic_cast<AggregateStat*>(coreStats->get(i));
+    zinfo->contentionSim->runParallel(incTask, coreStats->size());
 
-        for (uint32_t c = 0; c < as->size(); c++) {
-            AggregateStat* cs = dynamic_cast<AggregateStat*>(as->get(c));
-            uint32_t p = zinfo->sched->getScheduledPid(c);
-            if (p == (uint32_t)-1) p = zinfo->lineSize - 1;  // FIXME
-            else p = zinfo->procArray[p]->getGroupIdx();
-            Stat* ps = dynamic_cast<AggregateStat*>(procStats->get(p))->get(i);
-            assert(StatSize(cs) == StatSize(ps));
-            IncWalk(ps, buf + start);
-            start += StatSize(cs);
+    lastUpdatePhase = zinfo->numPhases;
+}
+
+void ProcStats::dumpCores(uint32_t firstCore, uint32_t lastCore) {
+    uint32_t numCores = zinfo->numCores;
+    for (uint32_t c = firstCore; c < lastCore; c++) {
+        uint32_t p = zinfo->sched->getScheduledPid(c);
+        if (p == (uint32_t)-1) p = zinfo->lineSize - 1;  // FIXME
+        else p = zinfo->procArray[p]->getGroupIdx();
+        coreGroups[c] = p;
+
+        for (uint32_t i = 0; i < coreStats->size(); i++) {
+            AggregateStat* as = dynamic_cast<AggregateStat*>(coreStats->get(i));
+            uint64_t start = offsets[i*numCores + c];
+            uint64_t end = offsets[i*numCores + c + 1];
+            uint64_t* endBuf = DumpWalk(as->get(c), buf + start);
+            assert(buf + end == endBuf);
+            for (uint64_t j = start; j < end; j++) {
+                lastBuf[j] = buf[j] - lastBuf[j];
+            }
         }
     }
-    assert(start == bufSize);
+}
 
-    lastUpdatePhase = zinfo->numPhases;
+void ProcStats::incStat(uint32_t i) {
+    uint32_t numCores = zinfo->numCores;
+    for (uint32_t c = 0; c < numCores; c++) {
+        Stat* ps = dynamic_cast<AggregateStat*>(procStats->get(coreGroups[c]))->get(i);
+        assert(StatSize(ps) == offsets[i*numCores + c + 1] - offsets[i*numCores + c]);
+        IncWalk(ps, buf + offsets[i*numCores + c]);
+    }
 }
 
 void ProcStats::notifyDeschedule() {
@@ -34,6 +34,8 @@ class ProcStats : public GlobAlloc {
 
         class ProcessCounter;
         class ProcessVectorCounter;
+        class DumpTask;
+        class IncTask;
 
         uint64_t lastUpdatePhase;
 
@@ -44,6 +46,14 @@ class ProcStats : public GlobAlloc {
         uint64_t* lastBuf;
         uint64_t bufSize;
 
+        // Start of each (coreStats member i, core c) in buf, at [i*numCores + c]; last elem is bufSize
+        uint64_t* offsets;
+        uint32_t* coreGroups;  // process group each core's deltas go to, filled in by update()
+
+        // update() walks every core's stats; these split the walk across the contention sim threads
+        DumpTask* dumpTask;  // items are chunks of cores
+        IncTask* incTask;  // items are coreStats members, each with its own subtree of every process's stats
+
     public:
         explicit ProcStats(AggregateStat* parentStat, AggregateStat* _coreStats); //includes initStats, called post-system init
 
@@ -54,6 +64,9 @@ class ProcStats : public GlobAlloc {
         Stat* replStat(Stat* s, const char* name = nullptr, const char* desc = nullptr);
 
         void update();  // transparent
+
+        void dumpCores(uint32_t firstCore, uint32_t lastCore);
+        void incStat(uint32_t i);
 };
 
 #endif  // PROCESS_STATS_H_
@@ -24,10 +24,24 @@
  */
 
 #include "process_stats.h"
+#include "contention_sim.h"
 #include "process_tree.h"
 #include "scheduler.h"
 #include "zsim.h"
 
+#define UPDATE_CORES_PER_ITEM 256  // reading a core's counters is cheap, so only split large systems
+
+class ProcessStats::UpdateTask : public ParallelTask {
+    private:
+        ProcessStats* ps;
+    public:
+        explicit UpdateTask(ProcessStats* _ps) : ps(_ps) {}
+        void run(uint32_t item) {
+            uint32_t firstCore = item*UPDATE_CORES_PER_ITEM;
+            ps->readCores(firstCore, MIN(firstCore + UPDATE_CORES_PER_ITEM, zinfo->numCores));
+        }
+};
+
 ProcessStats::ProcessStats(AggregateStat* parentStat) {
     uint32_t maxProcs = zinfo->lineSize;
     processCycles.resize(maxProcs, 0);
@@ -36,6 +50,11 @@ ProcessStats::ProcessStats(AggregateStat* parentStat) {
     lastCoreInstrs.resize(zinfo->numCores, 0);
     lastUpdatePhase = 0;
 
+    updateTask = new UpdateTask(this);
+    coreGroups.resize(zinfo->numCores, -1);
+    coreCyclesDelta.resize(zinfo->numCores, 0);
+    coreInstrsDelta.resize(zinfo->numCores, 0);
+
     auto procCyclesLambda = [this](uint32_t p) { return getProcessCycles(p); };
     auto procCyclesStat = makeLambdaVectorStat(procCyclesLambda, maxProcs);
     procCyclesStat->init("procCycles", "Per-process unhalted core cycles");
@@ -84,12 +103,49 @@ void ProcessStats::updateCore(uint32_t cid, uint32_t p) {
 
 void ProcessStats::update() {
     assert(lastUpdatePhase < zinfo->numPhases);
-    for (uint32_t cid = 0; cid < lastCoreCycles.size(); cid++) {
-        uint32_t p = zinfo->sched->getScheduledPid(cid);
+    uint32_t numItems = (zinfo->numCores + UPDATE_CORES_PER_ITEM - 1)/UPDATE_CORES_PER_ITEM;
+    if (numItems == 1) {
+        for (uint32_t cid = 0; cid < lastCoreCycles.size(); cid++) {
+            uint32_t p = zinfo->sched->getScheduledPid(cid);
+            if (p == (uint32_t)-1) continue;
+            assert(p < processCycles.size());
+            updateCore(cid, p);
+        }
+        lastUpdatePhase = zinfo->numPhases;
+        return;
+    }
+
+    zinfo->contentionSim->runParallel(updateTask, numItems);
+
+    for (uint32_t cid = 0; cid < coreGroups.size(); cid++) {
+        uint32_t p = coreGroups[cid];
         if (p == (uint32_t)-1) continue;
-        assert(p < processCycles.size());
-        updateCore(cid, p);
+        processCycles[p] += coreCyclesDelta[cid];
+        processInstrs[p] += coreInstrsDelta[cid];
     }
     lastUpdatePhase = zinfo->numPhases;
 }
 
+// Same as updateCore() on every scheduled core in [firstCore, lastCore), but leaves the deltas for
+// update() to add, as several cores may share a process
+void ProcessStats::readCores(uint32_t firstCore, uint32_t lastCore) {
+    for (uint32_t cid = firstCore; cid < lastCore; cid++) {
+        uint32_t p = zinfo->sched->getScheduledPid(cid);
+        if (p == (uint32_t)-1) {
+            coreGroups[cid] = -1;
+            continue;
+        }
+        assert(p < processCycles.size());
+        coreGroups[cid] = zinfo->procArray[p]->getGroupIdx();
+
+        uint64_t cCycles = zinfo->cores[cid]->getCycles();
+        uint64_t cInstrs = zinfo->cores[cid]->getInstrs();
+
+        assert(cCycles >= lastCoreCycles[cid] && cInstrs >= lastCoreInstrs[cid]);
+        coreCyclesDelta[cid] = cCycles - lastCoreCycles[cid];
+        coreInstrsDelta[cid] = cInstrs - lastCoreInstrs[cid];
+
+        lastCoreCycles[cid] = cCycles;
+        lastCoreInstrs[cid] = cInstrs;
+    }
+}
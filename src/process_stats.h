@@ -39,6 +39,13 @@ class ProcessStats : public GlobAlloc {
         g_vector<uint64_t> lastCoreCycles, lastCoreInstrs;
         uint64_t lastUpdatePhase;
 
+        // On large systems, update() reads every core's counters in parallel (in chunks of cores, see
+        // UpdateTask), and then adds each core's deltas to its process
+        class UpdateTask;
+        UpdateTask* updateTask;
+        g_vector<uint32_t> coreGroups;  // process group of each core, or -1 if none is scheduled
+        g_vector<uint64_t> coreCyclesDelta, coreInstrsDelta;
+
     public:
         explicit ProcessStats(AggregateStat* parentStat); //includes initStats, called post-system init
 
@@ -51,6 +58,7 @@ class ProcessStats : public GlobAlloc {
 
     private:
         void updateCore(uint32_t cid, uint32_t p);
+        void readCores(uint32_t firstCore, uint32_t lastCore);
         void update(); //transparent
 };
 
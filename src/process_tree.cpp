@@ -31,6 +31,7 @@
 #include "config.h"
 #include "constants.h"
 #include "event_queue.h"
+#include "phase_controller.h"
 #include "process_stats.h"
 #include "stats.h"
 #include "zsim.h"
@@ -191,7 +192,7 @@ static void PopulateLevel(Config& config, const std::string& prefix, std::vector
             if (dumpHeartbeats) warn("Dumping eventual stats on both heartbeats AND instructions; you won't be able to distinguish both!");
             auto getInstrs = [procIdx]() { return zinfo->processStats->getProcessInstrs(procIdx); };
             auto dumpStats = [procIdx]() { DumpEventualStats(procIdx, "instructions"); };
-            zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, dumpStats, 0, dumpInstrs, MAX_IPC*zinfo->phaseLength*zinfo->numCores /*all cores can be on*/));
+            zinfo->eventQueue->insert(makeAdaptiveEvent(getInstrs, dumpStats, 0, dumpInstrs, MAX_IPC*MaxPhaseLength()*zinfo->numCores /*all cores can be on*/));
         } //NOTE: trivial to do the same with cycles
 
         if (clockDomain >= MAX_CLOCK_DOMAINS) panic("Invalid clock domain %d", clockDomain);
@@ -0,0 +1,218 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks and benchmarks the Scheduler's queue structures with thousands of threads, against the structures they
+ * replaced. The Scheduler itself needs Pin, so this drives copies of its policies on stand-in threads:
+ * - Sleeps: every thread sleeps for 1-2000 phases and sleeps again when woken. Checks that the SleepWheel wakes the
+ *   same threads in the same order as the old ordered sleep queue, and that next() is the ordered queue's head.
+ * - Placement: contexts free up at random and take a queued thread (schedContext()), which then queues in the run
+ *   queue of its new context. Compares the per-context run queues with stealing against a global run queue, and
+ *   checks that both find a runnable thread in the same cases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "galloc.h"
+#include "intrusive_list.h"
+#include "log.h"
+#include "mtrand.h"
+#include "profile_stats.h"
+#include "sleep_wheel.h"
+
+using namespace std;
+
+struct BenchThread : InListNode<BenchThread> {
+    uint32_t gid;
+    uint32_t cid;  // last context
+    uint64_t wakeupPhase;
+    vector<bool> mask;
+};
+
+// The pre-SleepWheel sleep queue: sorted by wakeupPhase, each insert walks all earlier sleepers
+struct OrderedSleepQueue {
+    InList<BenchThread> list;
+
+    void insert(BenchThread* th) {
+        if (list.empty() || list.front()->wakeupPhase > th->wakeupPhase) {
+            list.push_front(th);
+        } else {
+            BenchThread* cur = list.front();
+            while (cur->next && cur->next->wakeupPhase <= th->wakeupPhase) cur = cur->next;
+            list.insertAfter(cur, th);
+        }
+    }
+
+    template <typename F> void advance(uint64_t phase, F wake) {
+        while (!list.empty() && list.front()->wakeupPhase <= phase) {
+            BenchThread* th = list.front();
+            list.pop_front();
+            wake(th);
+        }
+    }
+};
+
+static void resetThreads(vector<BenchThread>& threads) {
+    for (BenchThread& th : threads) {
+        th.next = th.prev = nullptr;
+        th.owner = nullptr;
+    }
+}
+
+static BenchThread* queueNext(OrderedSleepQueue& q) {return q.list.front();}
+static BenchThread* queueNext(SleepWheel<BenchThread>& q) {return q.next();}
+
+// Returns the time per sleep in ns; fills in the gids woken at each phase, in order
+template <typename Q>
+double benchSleeps(Q& queue, vector<BenchThread>& threads, uint64_t phases, vector<uint32_t>& wakes, vector<uint32_t>& nexts) {
+    resetThreads(threads);
+    MTRand rnd(42);
+    for (BenchThread& th : threads) {
+        th.wakeupPhase = 1 + rnd.randInt(1999);
+        queue.insert(&th);
+    }
+
+    vector<BenchThread*> woken;
+    uint64_t startNs = getNs();
+    for (uint64_t p = 1; p <= phases; p++) {
+        woken.clear();
+        queue.advance(p, [&](BenchThread* th) { woken.push_back(th); });
+        for (BenchThread* th : woken) {
+            th->wakeupPhase = p + 1 + rnd.randInt(1999);
+            queue.insert(th);
+            wakes.push_back(th->gid);
+        }
+    }
+    uint64_t ns = getNs() - startNs;
+    for (uint64_t p = phases + 1; p <= phases + 10; p++) {
+        // Drain a few more phases, recording the earliest sleeper before each
+        BenchThread* next = queueNext(queue);
+        nexts.push_back(next->wakeupPhase);
+        queue.advance(p, [&](BenchThread* th) { wakes.push_back(th->gid); });
+    }
+    return ((double)ns)/wakes.size();
+}
+
+// Returns the time per placement in ns; counts the placements where no queued thread could run
+double benchPlacement(bool perContext, vector<BenchThread>& threads, uint32_t numContexts, uint64_t ops, uint64_t& misses) {
+    resetThreads(threads);
+    InList<BenchThread> globalQueue;
+    vector< InList<BenchThread> > runQueues(numContexts);
+    uint32_t queuedThreads = 0;
+
+    auto push = [&](BenchThread* th) {
+        if (perContext) runQueues[th->cid].push_back(th);
+        else globalQueue.push_back(th);
+        queuedThreads++;
+    };
+
+    for (BenchThread& th : threads) {
+        // Home context, as for never-run threads: spread by gid within the mask
+        th.cid = th.gid % numContexts;
+        while (!th.mask[th.cid]) th.cid = (th.cid + 1) % numContexts;
+        push(&th);
+    }
+
+    MTRand rnd(43);
+    misses = 0;
+    uint64_t startNs = getNs();
+    for (uint64_t o = 0; o < ops; o++) {
+        uint32_t cid = rnd.randInt(numContexts - 1);
+        BenchThread* th;
+        if (perContext) {
+            // As in Scheduler::schedContext()
+            th = runQueues[cid].front();
+            for (uint32_t i = 1; !th && queuedThreads && i < numContexts; i++) {
+                BenchThread* blockedTh = runQueues[(cid + i) % numContexts].front();
+                while (blockedTh && !blockedTh->mask[cid]) blockedTh = blockedTh->next;
+                th = blockedTh;
+            }
+        } else {
+            th = globalQueue.front();
+            while (th && !th->mask[cid]) th = th->next;
+        }
+
+        if (!th) {
+            misses++;
+            continue;
+        }
+        if (!th->mask[cid]) panic("Placed thread %d on context %d, outside its mask", th->gid, cid);
+        th->owner->remove(th);
+        queuedThreads--;
+        th->cid = cid;
+        push(th);
+    }
+    return ((double)(getNs() - startNs))/ops;
+}
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc > 3) {
+        info("Checks and benchmarks the scheduler's sleep wheel and per-context run queues");
+        info("Usage: %s [<threads, default 4096> [<contexts, default 64>]]", argv[0]);
+        exit(1);
+    }
+    uint32_t numThreads = (argc > 1)? strtoul(argv[1], nullptr, 0) : 4096;
+    uint32_t numContexts = (argc > 2)? strtoul(argv[2], nullptr, 0) : 64;
+    if (!numThreads || !numContexts) panic("Need at least one thread and context");
+
+    gm_init(32<<20 /*32 MB*/);
+
+    vector<BenchThread> threads(numThreads);
+    for (uint32_t i = 0; i < numThreads; i++) threads[i].gid = i;
+
+    uint64_t phases = 20000;
+    vector<uint32_t> orderedWakes, wheelWakes, orderedNexts, wheelNexts;
+    OrderedSleepQueue ordered;
+    double orderedNs = benchSleeps(ordered, threads, phases, orderedWakes, orderedNexts);
+    SleepWheel<BenchThread> wheel;
+    double wheelNs = benchSleeps(wheel, threads, phases, wheelWakes, wheelNexts);
+    if (orderedWakes != wheelWakes) panic("Sleep wheel and ordered queue woke threads in different orders");
+    if (orderedNexts != wheelNexts) panic("Sleep wheel next() does not match the ordered queue's head");
+    info("%d threads, %ld phases: %ld wakeups, ordered queue %.1f ns/sleep, wheel %.1f ns/sleep, speedup %.2f",
+            numThreads, phases, orderedWakes.size(), orderedNs, wheelNs, orderedNs/wheelNs);
+
+    uint64_t ops = 200000;
+    info("%8s %16s %16s %9s", "Mask", "Global ns/op", "PerCtx ns/op", "Speedup");
+    const uint32_t widths[] = {1, 8, numContexts};
+    for (uint32_t width : widths) {
+        if (width > numContexts) continue;
+        for (uint32_t i = 0; i < numThreads; i++) {
+            threads[i].mask.assign(numContexts, false);
+            for (uint32_t j = 0; j < width; j++) threads[i].mask[(i*width + j) % numContexts] = true;
+        }
+        uint64_t globalMisses, perContextMisses;
+        double globalNs = benchPlacement(false, threads, numContexts, ops, globalMisses);
+        double perContextNs = benchPlacement(true, threads, numContexts, ops, perContextMisses);
+        if (globalMisses != perContextMisses) {
+            panic("Mask width %d: %ld placements found no thread with the global queue, %ld with per-context queues",
+                    width, globalMisses, perContextMisses);
+        }
+        info("%8d %16.1f %16.1f %9.2f", width, globalNs, perContextNs, globalNs/perContextNs);
+    }
+    info("All wakeups and placements match");
+    return 0;
+}
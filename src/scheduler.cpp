@@ -37,9 +37,9 @@
 
 //The scheduler class started simple, but at some point having it all in the header is too ridiculous. Migrate non perf-intensive calls here! (all but sync, really)
 
-#define WATCHDOG_INTERVAL_USEC (50)
-#define WATCHDOG_MAX_MULTIPLER (40) //50us-2ms waits
-#define WATCHDOG_STALL_THRESHOLD (100)
+#define WATCHDOG_INTERVAL_USEC (50) //slack added to the real-time wait before driving time forward on sleep
+#define WATCHDOG_STALL_USEC (100*1000) //fake leaves with no phase progress for this long are a possible stall
+#define WATCHDOG_CLEANUP_USEC (1000) //polling period for pending process cleanups
 
 //#define DEBUG_FL(args...) info(args)
 #define DEBUG_FL(args...)
@@ -64,6 +64,18 @@ static void TrueSleep(uint32_t usecs) {
     }
 }
 
+// Waits until *word != val, a wakeup, or the timeout (if usecs >= 0) expires; may return spuriously
+static void FutexWaitUsec(volatile uint32_t* word, uint32_t val, int64_t usecs) {
+    if (usecs < 0) {
+        syscall(SYS_futex, word, FUTEX_WAIT, val, nullptr, nullptr, 0);
+    } else {
+        struct timespec timeout;
+        timeout.tv_sec = usecs/1000000;
+        timeout.tv_nsec = (usecs % 1000000)*1000;
+        syscall(SYS_futex, word, FUTEX_WAIT, val, &timeout, nullptr, 0);
+    }
+}
+
 /* Hacky way to figure out if a thread is sleeping on a certain futex.
  *
  * Uses /proc/<pid>/task/<tid>/syscall, which is only set when the process is
@@ -94,107 +106,108 @@ bool IsSleepingInFutex(uint32_t linuxPid, uint32_t linuxTid, uintptr_t futexAddr
 void Scheduler::watchdogThreadFunc() {
     info("Started scheduler watchdog thread");
     uint64_t lastPhase = 0;
-    int multiplier = 1;
+    uint64_t lastProgressNs = getNs(); //when we first saw lastPhase
+    uint64_t idleDeadlineNs = 0; //if set, the system is idle with sleepers, and we drive time forward if it still is by then
     uint64_t lastMs = 0;
-    uint64_t fakeLeaveStalls = 0;
+    futex_lock(&schedLock);
     while (true) {
-        TrueSleep(multiplier*WATCHDOG_INTERVAL_USEC);
-
+        // Read the futex word with schedLock held, and only then check the exit conditions. Every
+        // signal is raised after its condition is set, so if we miss a condition here, its signal
+        // changes the word and the wait below returns immediately.
+        uint32_t seq = watchdogSeq;
         if (zinfo->terminationConditionMet) {
-            // Synchronize to avoid racing with EndOfPhaseActions code
-            // (zinfo->terminationConditionMet is set on EndOfPhaseActions,
-            // which has schedLock held, we must let it finish)
-            futex_lock(&schedLock);
+            // zinfo->terminationConditionMet is set on EndOfPhaseActions, which has schedLock held,
+            // so holding it here ensures it has finished
             info("Terminating scheduler watchdog thread");
             futex_unlock(&schedLock);
             SimEnd();
         }
+        if (terminateWatchdogThread) {
+            futex_unlock(&schedLock);
+            break;
+        }
 
-        //Fastpath (unlocked, benign read races, only modifies local state)
-        if (lastPhase != curPhase && pendingPidCleanups.size() == 0) {
+        int64_t timeoutUsec = getWatchdogTimeout(lastProgressNs, idleDeadlineNs);
+        futex_unlock(&schedLock);
+        FutexWaitUsec(&watchdogSeq, seq, timeoutUsec);
+        watchdogWakeups.inc();
+        futex_lock(&schedLock);
+        if (zinfo->terminationConditionMet || terminateWatchdogThread) continue;  // exit above
+
+        uint64_t curNs = getNs();
+        if (lastPhase != curPhase) {
             lastPhase = curPhase;
-            fakeLeaveStalls = 0;
-            if (multiplier < WATCHDOG_MAX_MULTIPLER) multiplier++;
-            continue;
+            lastProgressNs = curNs;
+            idleDeadlineNs = 0;
         }
 
-        //if (lastPhase == curPhase && scheduledThreads == outQueue.size() && !sleepQueue.empty()) info("Mult %d curPhase %ld", multiplier, curPhase);
-
-        futex_lock(&schedLock);
+        if (!fakeLeaves.empty() && (fakeLeaves.front()->th->futexJoin.action != FJA_WAKE) && curNs - lastProgressNs >= WATCHDOG_STALL_USEC*1000) {
+            info("Detected possible stall due to fake leaves (%ld current)", fakeLeaves.size());
+            // Uncomment to print all leaves
+            FakeLeaveInfo* pfl = fakeLeaves.front();
+            while (pfl) {
+                info(" [%d/%d] %s (%d) @ 0x%lx", getPid(pfl->th->gid), getTid(pfl->th->gid), GetSyscallName(pfl->syscallNumber), pfl->syscallNumber, pfl->pc);
+                pfl = pfl->next;
+            }
 
-        if (lastPhase == curPhase && !fakeLeaves.empty() && (fakeLeaves.front()->th->futexJoin.action != FJA_WAKE)) {
-            if (++fakeLeaveStalls >= WATCHDOG_STALL_THRESHOLD) {
-                info("Detected possible stall due to fake leaves (%ld current)", fakeLeaves.size());
-                // Uncomment to print all leaves
-                FakeLeaveInfo* pfl = fakeLeaves.front();
-                while (pfl) {
-                    info(" [%d/%d] %s (%d) @ 0x%lx", getPid(pfl->th->gid), getTid(pfl->th->gid), GetSyscallName(pfl->syscallNumber), pfl->syscallNumber, pfl->pc);
-                    pfl = pfl->next;
+            // Trigger a leave() on the first process, if the process's blacklist regex allows it
+            FakeLeaveInfo* fl = fakeLeaves.front();
+            ThreadInfo* th = fl->th;
+            uint32_t pid = getPid(th->gid);
+            uint32_t tid = getTid(th->gid);
+            uint32_t cid = th->cid;
+
+            const g_string& sbRegexStr = zinfo->procArray[pid]->getSyscallBlacklistRegex();
+            std::regex sbRegex(sbRegexStr.c_str());
+            if (std::regex_match(GetSyscallName(fl->syscallNumber), sbRegex)) {
+                // If this is the last leave we catch, it is the culprit for sure -> blacklist it
+                // Over time, this will blacklist every blocking syscall
+                // The root reason for being conservative though is that we don't have a sure-fire
+                // way to distinguish IO waits from truly blocking syscalls (TODO)
+                if (fakeLeaves.size() == 1) {
+                    info("Blacklisting from future fake leaves: [%d] %s @ 0x%lx | arg0 0x%lx arg1 0x%lx", pid, GetSyscallName(fl->syscallNumber), fl->pc, fl->arg0, fl->arg1);
+                    blockingSyscalls[pid].insert(fl->pc);
                 }
 
-                // Trigger a leave() on the first process, if the process's blacklist regex allows it
-                FakeLeaveInfo* fl = fakeLeaves.front();
-                ThreadInfo* th = fl->th;
-                uint32_t pid = getPid(th->gid);
-                uint32_t tid = getTid(th->gid);
-                uint32_t cid = th->cid;
-
-                const g_string& sbRegexStr = zinfo->procArray[pid]->getSyscallBlacklistRegex();
-                std::regex sbRegex(sbRegexStr.c_str());
-                if (std::regex_match(GetSyscallName(fl->syscallNumber), sbRegex)) {
-                    // If this is the last leave we catch, it is the culprit for sure -> blacklist it
-                    // Over time, this will blacklist every blocking syscall
-                    // The root reason for being conservative though is that we don't have a sure-fire
-                    // way to distinguish IO waits from truly blocking syscalls (TODO)
-                    if (fakeLeaves.size() == 1) {
-                        info("Blacklisting from future fake leaves: [%d] %s @ 0x%lx | arg0 0x%lx arg1 0x%lx", pid, GetSyscallName(fl->syscallNumber), fl->pc, fl->arg0, fl->arg1);
-                        blockingSyscalls[pid].insert(fl->pc);
-                    }
+                uint64_t pc = fl->pc;
+                do {
+                    finishFakeLeave(th);
 
-                    uint64_t pc = fl->pc;
-                    do {
-                        finishFakeLeave(th);
-
-                        futex_unlock(&schedLock);
-                        leave(pid, tid, cid);
-                        futex_lock(&schedLock);
-
-                        // also do real leave for other threads blocked at the same pc ...
-                        fl = fakeLeaves.front();
-                        if (fl == nullptr || getPid(th->gid) != pid || fl->pc != pc)
-                            break;
-                        th = fl->th;
-                        tid = getTid(th->gid);
-                        cid = th->cid;
-                        // ... until a lower bound on queue size, in order to make blacklist work
-                    } while (fakeLeaves.size() > 8);
-                } else {
-                    info("Skipping, [%d] %s @ 0x%lx | arg0 0x%lx arg1 0x%lx does not match blacklist regex (%s)",
-                            pid, GetSyscallName(fl->syscallNumber), fl->pc, fl->arg0, fl->arg1, sbRegexStr.c_str());
-                }
-                fakeLeaveStalls = 0;
+                    futex_unlock(&schedLock);
+                    leave(pid, tid, cid);
+                    futex_lock(&schedLock);
+
+                    // also do real leave for other threads blocked at the same pc ...
+                    fl = fakeLeaves.front();
+                    if (fl == nullptr || getPid(th->gid) != pid || fl->pc != pc)
+                        break;
+                    th = fl->th;
+                    tid = getTid(th->gid);
+                    cid = th->cid;
+                    // ... until a lower bound on queue size, in order to make blacklist work
+                } while (fakeLeaves.size() > 8);
+            } else {
+                info("Skipping, [%d] %s @ 0x%lx | arg0 0x%lx arg1 0x%lx does not match blacklist regex (%s)",
+                        pid, GetSyscallName(fl->syscallNumber), fl->pc, fl->arg0, fl->arg1, sbRegexStr.c_str());
             }
-        } else {
-            fakeLeaveStalls = 0;
+            lastProgressNs = getNs(); //restart the stall window
         }
 
         if (lastPhase == curPhase && scheduledThreads == outQueue.size() && !sleepQueue.empty()) {
-            //info("Watchdog Thread: Sleep dep detected...")
-            int64_t wakeupPhase = sleepQueue.front()->wakeupPhase;
-            int64_t wakeupCycles = (wakeupPhase - curPhase)*zinfo->phaseLength;
-            int64_t wakeupUsec = (wakeupCycles > 0)? wakeupCycles/zinfo->freqMHz : 0;
-
-            //info("Additional usecs of sleep %ld", wakeupUsec);
-            if (wakeupUsec > 10*1000*1000) warn("Watchdog sleeping for a long time due to long sleep, %ld secs", wakeupUsec/1000/1000);
-
-            futex_unlock(&schedLock);
-            TrueSleep(WATCHDOG_INTERVAL_USEC + wakeupUsec);
-            futex_lock(&schedLock);
-
-            if (lastPhase == curPhase && scheduledThreads == outQueue.size() && !sleepQueue.empty()) {
-                ThreadInfo* sth = sleepQueue.front();
-                uint64_t curMs = curPhase*zinfo->phaseLength/zinfo->freqMHz/1000;
-                uint64_t endMs = sth->wakeupPhase*zinfo->phaseLength/zinfo->freqMHz/1000;
+            if (!idleDeadlineNs) {
+                //info("Watchdog Thread: Sleep dep detected...")
+                int64_t wakeupPhase = sleepQueue.next()->wakeupPhase;
+                int64_t wakeupCycles = (wakeupPhase > (int64_t)curPhase)? PhasesToCycles(wakeupPhase - curPhase) : 0;
+                int64_t wakeupUsec = (wakeupCycles > 0)? wakeupCycles/zinfo->freqMHz : 0;
+
+                //info("Additional usecs of sleep %ld", wakeupUsec);
+                if (wakeupUsec > 10*1000*1000) warn("Watchdog sleeping for a long time due to long sleep, %ld secs", wakeupUsec/1000/1000);
+                idleDeadlineNs = curNs + (WATCHDOG_INTERVAL_USEC + wakeupUsec)*1000;
+            } else if (curNs >= idleDeadlineNs) {
+                ThreadInfo* sth = sleepQueue.next();
+                uint64_t sleepCycles = (sth->wakeupPhase > curPhase)? PhasesToCycles(sth->wakeupPhase - curPhase) : 0;
+                uint64_t curMs = zinfo->globPhaseCycles/zinfo->freqMHz/1000;
+                uint64_t endMs = (zinfo->globPhaseCycles + sleepCycles)/zinfo->freqMHz/1000;
                 (void)curMs; (void)endMs; //make gcc happy
                 if (curMs > lastMs + 1000) {
                     info("Watchdog Thread: Driving time forward to avoid deadlock on sleep (%ld -> %ld ms)", curMs, endMs);
@@ -216,16 +229,14 @@ void Scheduler::watchdogThreadFunc() {
                     }
                 }
                 idlePeriods.inc();
-                multiplier = 0;
+                lastPhase = curPhase;
+                lastProgressNs = getNs();
+                idleDeadlineNs = 0;
             }
+        } else {
+            idleDeadlineNs = 0;
         }
 
-        if (multiplier < WATCHDOG_MAX_MULTIPLER) {
-            multiplier++;
-        }
-
-        lastPhase = curPhase;
-
         //Lazily clean state of processes that terminated abruptly
         //NOTE: For now, we rely on the process explicitly telling us that it's going to terminate.
         //We could make this self-checking by periodically checking for liveness of the processes we're supposedly running.
@@ -249,17 +260,34 @@ void Scheduler::watchdogThreadFunc() {
             processCleanup(pid);
             futex_lock(&schedLock);
         }
-
-        if (terminateWatchdogThread) {
-            futex_unlock(&schedLock);
-            break;
-        } else {
-            futex_unlock(&schedLock);
-        }
     }
     info("Finished scheduler watchdog thread");
 }
 
+// Called with schedLock held. Returns how long the watchdog can wait for a signal before it must
+// check on something by itself, or -1 if it has nothing to check until it is signaled.
+int64_t Scheduler::getWatchdogTimeout(uint64_t lastProgressNs, uint64_t idleDeadlineNs) const {
+    int64_t timeoutUsec = -1;
+    auto bound = [&timeoutUsec](int64_t usec) {
+        if (timeoutUsec < 0 || usec < timeoutUsec) timeoutUsec = usec;
+    };
+
+    uint64_t curNs = getNs();
+    if (!fakeLeaves.empty()) {
+        // Wake up when the stall window ends; if we could not act on a stall, wait for a full window again
+        int64_t leftUsec = WATCHDOG_STALL_USEC - (int64_t)(curNs - lastProgressNs)/1000;
+        bound((leftUsec > 0)? leftUsec : WATCHDOG_STALL_USEC);
+    }
+
+    if (idleDeadlineNs) {
+        bound((idleDeadlineNs > curNs)? (idleDeadlineNs - curNs)/1000 : 0);
+    } else if (scheduledThreads == outQueue.size() && !sleepQueue.empty()) {
+        bound(0); //became idle while we were busy, set the deadline right away
+    }
+
+    if (pendingPidCleanups.size()) bound(WATCHDOG_CLEANUP_USEC);
+    return timeoutUsec;
+}
 void Scheduler::threadTrampoline(void* arg) {
     Scheduler* sched = static_cast<Scheduler*>(arg);
     sched->watchdogThreadFunc();
@@ -289,6 +317,7 @@ void Scheduler::syscallLeave(uint32_t pid, uint32_t tid, uint32_t cid, uint64_t
         DEBUG_FL("%s @ 0x%lx skipping leave()", GetSyscallName(syscallNumber), pc);
         FakeLeaveInfo* si = new FakeLeaveInfo(pc, th, syscallNumber, arg0, arg1);
         fakeLeaves.push_back(si);
+        if (fakeLeaves.size() == 1) signalWatchdog(); //start timing a possible stall
         // FIXME(dsm): zsim.cpp's SyscallEnter may be checking whether we are in a syscall and not calling us.
         // If that's the case, this would be stale, which may lead to some false positives/negatives
         futex_unlock(&schedLock);
@@ -300,7 +329,7 @@ void Scheduler::syscallLeave(uint32_t pid, uint32_t tid, uint32_t cid, uint64_t
 // External interface, must be non-blocking
 void Scheduler::notifyFutexWakeStart(uint32_t pid, uint32_t tid, uint32_t maxWakes) {
     futex_lock(&schedLock);
-    ThreadInfo* th = gidMap[getGid(pid, tid)];
+    ThreadInfo* th = lookupThread(getGid(pid, tid));
     DEBUG_FUTEX("[%d/%d] wakeStart max %d", pid, tid, maxWakes);
     assert(th->futexJoin.action == FJA_NONE);
 
@@ -316,7 +345,7 @@ void Scheduler::notifyFutexWakeStart(uint32_t pid, uint32_t tid, uint32_t maxWak
 
 void Scheduler::notifyFutexWakeEnd(uint32_t pid, uint32_t tid, uint32_t wokenUp) {
     futex_lock(&schedLock);
-    ThreadInfo* th = gidMap[getGid(pid, tid)];
+    ThreadInfo* th = lookupThread(getGid(pid, tid));
     DEBUG_FUTEX("[%d/%d] wakeEnd woken %d", pid, tid, wokenUp);
     th->futexJoin.action = FJA_WAKE;
     th->futexJoin.wokenUp = wokenUp;
@@ -325,7 +354,7 @@ void Scheduler::notifyFutexWakeEnd(uint32_t pid, uint32_t tid, uint32_t wokenUp)
 
 void Scheduler::notifyFutexWaitWoken(uint32_t pid, uint32_t tid) {
     futex_lock(&schedLock);
-    ThreadInfo* th = gidMap[getGid(pid, tid)];
+    ThreadInfo* th = lookupThread(getGid(pid, tid));
     DEBUG_FUTEX("[%d/%d] waitWoken", pid, tid);
     th->futexJoin = {FJA_WAIT, 0, 0};
     futex_unlock(&schedLock);
@@ -39,8 +39,10 @@
 #include "g_std/g_unordered_set.h"
 #include "g_std/g_vector.h"
 #include "intrusive_list.h"
+#include "phase_controller.h"
 #include "proc_stats.h"
 #include "process_stats.h"
+#include "sleep_wheel.h"
 #include "stats.h"
 #include "zsim.h"
 
@@ -67,7 +69,7 @@ class Scheduler : public GlobAlloc, public Callee {
             OUT, //in leave() this phase, can rejoin immediately
             BLOCKED, //inside a system call, no cid assigned, not in the barrier or the runqueue
             SLEEPING, //inside a patched sleep syscall; no cid assigned, in sleepQueue; it is our responsibility to wake this thread up when its deadline arrives
-            QUEUED //in the runqueue
+            QUEUED //in the run queue of its last context
         };
 
         enum ContextState {
@@ -95,7 +97,7 @@ class Scheduler : public GlobAlloc, public Callee {
             const uint32_t linuxTid;
 
             ThreadState state;
-            uint32_t cid; //only current if RUNNING; otherwise, it's the last one used.
+            uint32_t cid; //only current if RUNNING; otherwise, it's the last one used (or, if never run, its home context). Always in mask.
 
             volatile ThreadInfo* handoffThread; //if at the end of a sync() this is not nullptr, we need to transfer our current context to the thread pointed here.
             volatile uint32_t futexWord;
@@ -123,6 +125,9 @@ class Scheduler : public GlobAlloc, public Callee {
                 uint32_t count = 0;
                 for (auto b : mask) if (b) count++;
                 if (count == 0) panic("Empty mask on gid %d!", gid);
+                //Spread never-run threads over their allowed contexts, so that they queue evenly
+                cid = gid % zinfo->numCores;
+                while (!mask[cid]) cid = (cid + 1) % zinfo->numCores;
                 fakeLeave = nullptr;
                 futexJoin.action = FJA_NONE;
             }
@@ -132,26 +137,35 @@ class Scheduler : public GlobAlloc, public Callee {
             uint32_t cid;
             ContextState state;
             ThreadInfo* curThread; //only current if used, otherwise nullptr
+            InList<ThreadInfo> runQueue; //QUEUED threads whose last (or home) context is this one
         };
 
+        /* Locking: gidMapLock protects only the thread table (gidMap). Calls that just look up or
+         * update their own ThreadInfo (start, markForSleep, futex notifications...) take it alone;
+         * everything that makes scheduling decisions takes schedLock, and may then take gidMapLock
+         * (never the other way around).
+         */
         g_unordered_map<uint32_t, ThreadInfo*> gidMap;
         g_vector<ContextInfo> contexts;
 
         InList<ContextInfo> freeList;
 
-        InList<ThreadInfo> runQueue;
+        uint32_t queuedThreads; //total over all per-context run queues
         InList<ThreadInfo> outQueue;
-        InList<ThreadInfo> sleepQueue; //contains all the sleeping threads, it is ORDERED by wakeup time
+        SleepWheel<ThreadInfo> sleepQueue; //contains all the sleeping threads, indexed by wakeup phase
 
         PAD();
         lock_t schedLock;
         PAD();
+        lock_t gidMapLock;
+        PAD();
 
         uint64_t curPhase;
         //uint32_t nextVictim;
         MTRand rnd;
 
         volatile bool terminateWatchdogThread;
+        volatile uint32_t watchdogSeq; //futex word the watchdog waits on; bumped by signalWatchdog()
 
         g_vector<std::pair<uint32_t, uint32_t>> pendingPidCleanups; //(pid, osPid) pairs of abruptly terminated processes
 
@@ -159,6 +173,7 @@ class Scheduler : public GlobAlloc, public Callee {
         Counter threadsCreated, threadsFinished;
         Counter scheduleEvents, waitEvents, handoffEvents, sleepEvents;
         Counter idlePhases, idlePeriods;
+        Counter watchdogWakeups;
         VectorCounter occHist, runQueueHist;
         uint32_t scheduledThreads;
 
@@ -168,8 +183,8 @@ class Scheduler : public GlobAlloc, public Callee {
         inline uint32_t getTid(uint32_t gid) const {return gid & 0x0FFFF;}
 
     public:
-        Scheduler(void (*_atSyncFunc)(void), uint32_t _parallelThreads, uint32_t _numCores, uint32_t _schedQuantum) :
-            atSyncFunc(_atSyncFunc), bar(_parallelThreads, this), numCores(_numCores), schedQuantum(_schedQuantum), rnd(0x5C73D9134)
+        Scheduler(void (*_atSyncFunc)(void), uint32_t _parallelThreads, uint32_t _barrierFanout, uint32_t _numCores, uint32_t _schedQuantum) :
+            atSyncFunc(_atSyncFunc), bar(_parallelThreads, _barrierFanout, this), numCores(_numCores), schedQuantum(_schedQuantum), rnd(0x5C73D9134)
         {
             contexts.resize(numCores);
             for (uint32_t i = 0; i < numCores; i++) {
@@ -179,6 +194,8 @@ class Scheduler : public GlobAlloc, public Callee {
                 freeList.push_back(&contexts[i]);
             }
             schedLock = 0;
+            gidMapLock = 0;
+            queuedThreads = 0;
             //nextVictim = 0; //only used when freeList is empty.
             curPhase = 0;
             scheduledThreads = 0;
@@ -190,6 +207,7 @@ class Scheduler : public GlobAlloc, public Callee {
 
             info("Started RR scheduler, quantum=%d phases", schedQuantum);
             terminateWatchdogThread = false;
+            watchdogSeq = 0;
             startWatchdogThread();
         }
 
@@ -206,6 +224,12 @@ class Scheduler : public GlobAlloc, public Callee {
             sleepEvents.init("sleepEvs", "Sleep events"); schedStats->append(&sleepEvents);
             idlePhases.init("idlePhases", "Phases with no thread active"); schedStats->append(&idlePhases);
             idlePeriods.init("idlePeriods", "Periods with no thread active"); schedStats->append(&idlePeriods);
+            watchdogWakeups.init("wdWakeups", "Watchdog thread wakeups"); schedStats->append(&watchdogWakeups);
+            auto wdRateStat = makeLambdaStat([this]() {
+                uint64_t cycles = zinfo->globPhaseCycles;
+                return cycles? watchdogWakeups.get()*zinfo->freqMHz*1000000/cycles : 0;
+            });
+            wdRateStat->init("wdWakeupsPerSec", "Watchdog thread wakeups per simulated second"); schedStats->append(wdRateStat);
             occHist.init("occHist", "Occupancy histogram", numCores+1); schedStats->append(&occHist);
             uint32_t runQueueHistSize = ((numCores > 16)? numCores : 16) + 1;
             runQueueHist.init("rqSzHist", "Run queue size histogram", runQueueHistSize); schedStats->append(&runQueueHist);
@@ -213,7 +237,7 @@ class Scheduler : public GlobAlloc, public Callee {
         }
 
         void start(uint32_t pid, uint32_t tid, const g_vector<bool>& mask) {
-            futex_lock(&schedLock);
+            futex_lock(&gidMapLock);
             uint32_t gid = getGid(pid, tid);
             //info("[G %d] Start", gid);
             assert((gidMap.find(gid) == gidMap.end()));
@@ -224,16 +248,18 @@ class Scheduler : public GlobAlloc, public Callee {
             //   guessing it hasn't flushed its cached pid at this point)
             gidMap[gid] = new ThreadInfo(gid, syscall(SYS_getpid), syscall(SYS_gettid), mask);
             threadsCreated.inc();
-            futex_unlock(&schedLock);
+            futex_unlock(&gidMapLock);
         }
 
         void finish(uint32_t pid, uint32_t tid) {
             futex_lock(&schedLock);
             uint32_t gid = getGid(pid, tid);
             //info("[G %d] Finish", gid);
+            futex_lock(&gidMapLock);
             assert((gidMap.find(gid) != gidMap.end()));
             ThreadInfo* th = gidMap[gid];
             gidMap.erase(gid);
+            futex_unlock(&gidMapLock);
 
             // Check for suppressed syscall leave(), execute it
             if (th->fakeLeave) {
@@ -259,8 +285,7 @@ class Scheduler : public GlobAlloc, public Callee {
 
             assert_msg(th->state == STARTED /*might be started but in fastFwd*/ ||th->state == OUT || th->state == BLOCKED || th->state == QUEUED, "gid %d finish with state %d", gid, th->state);
             if (th->state == QUEUED) {
-                assert(th->owner == &runQueue);
-                runQueue.remove(th);
+                runQueueRemove(th);
             } else if (th->owner) {
                 assert(th->owner == &outQueue);
                 outQueue.remove(th);
@@ -282,7 +307,7 @@ class Scheduler : public GlobAlloc, public Callee {
             //If leave was in this phase, call bar.join()
             //Otherwise, try to grab a free context; if all are taken, queue up
             uint32_t gid = getGid(pid, tid);
-            ThreadInfo* th = gidMap[gid];
+            ThreadInfo* th = lookupThread(gid);
 
             //dsm 25 Oct 2012: Failed this assertion right after a fork when trying to simulate gedit. Very weird, cannot replicate.
             //dsm 10 Apr 2013: I think I got it. We were calling sched->finish() too early when following exec.
@@ -325,7 +350,7 @@ class Scheduler : public GlobAlloc, public Callee {
                     bar.join(th->cid, &schedLock); //releases lock
                 } else {
                     th->state = QUEUED;
-                    runQueue.push_back(th);
+                    runQueuePush(th);
                     waitForContext(th); //releases lock, might join
                 }
             }
@@ -348,17 +373,8 @@ class Scheduler : public GlobAlloc, public Callee {
                 ContextInfo* ctx = &contexts[cid];
                 deschedule(th, ctx, SLEEPING);
 
-                //Ordered insert into sleepQueue
-                if (sleepQueue.empty() || sleepQueue.front()->wakeupPhase > th->wakeupPhase) {
-                    sleepQueue.push_front(th);
-                } else {
-                    ThreadInfo* cur = sleepQueue.front();
-                    while (cur->next && cur->next->wakeupPhase <= th->wakeupPhase) {
-                        cur = cur->next;
-                    }
-                    trace(Sched, "Put %d in sleepQueue (deadline %ld), after %d (deadline %ld)", gid, th->wakeupPhase, cur->gid, cur->wakeupPhase);
-                    sleepQueue.insertAfter(cur, th);
-                }
+                trace(Sched, "Put %d in sleepQueue (deadline %ld)", gid, th->wakeupPhase);
+                sleepQueue.insert(th);
                 sleepEvents.inc();
 
                 ThreadInfo* inTh = schedContext(ctx);
@@ -385,6 +401,9 @@ class Scheduler : public GlobAlloc, public Callee {
                 }
             }
 
+            //If no thread is running now, only the watchdog can wake up the sleepers
+            if (scheduledThreads == outQueue.size() && !sleepQueue.empty()) signalWatchdog();
+
             futex_unlock(&schedLock);
         }
 
@@ -416,7 +435,7 @@ class Scheduler : public GlobAlloc, public Callee {
                     zinfo->cores[ctx->cid]->join();
                     bar.join(ctx->cid, &schedLock); //releases lock
                 } else {
-                    runQueue.push_back(th);
+                    runQueuePush(th);
                     waitForContext(th); //releases lock, might join
                 }
             }
@@ -430,68 +449,60 @@ class Scheduler : public GlobAlloc, public Callee {
             //End of phase stats
             assert(scheduledThreads <= numCores);
             occHist.inc(scheduledThreads);
-            uint32_t rqPos = (runQueue.size() < (runQueueHist.size()-1))? runQueue.size() : (runQueueHist.size()-1);
+            uint32_t rqPos = (queuedThreads < (runQueueHist.size()-1))? queuedThreads : (runQueueHist.size()-1);
             runQueueHist.inc(rqPos);
 
             if (atSyncFunc) atSyncFunc(); //call the simulator-defined actions external to the scheduler
+            if (zinfo->terminationConditionMet) signalWatchdog();
 
             /* End of phase accounting */
             zinfo->numPhases++;
             zinfo->globPhaseCycles += zinfo->phaseLength;
+            if (zinfo->phaseController) zinfo->phaseController->advance();
             curPhase++;
 
             assert(curPhase == zinfo->numPhases); //check they don't skew
 
             //Wake up all sleeping threads where deadline is met
-            if (!sleepQueue.empty()) {
-                ThreadInfo* th = sleepQueue.front();
-                while (th && th->wakeupPhase <= curPhase) {
-                    assert(th->wakeupPhase == curPhase);
-                    trace(Sched, "%d SLEEPING -> BLOCKED, waking up from timeout syscall (curPhase %ld, wakeupPhase %ld)", th->gid, curPhase, th->wakeupPhase);
-
-                    // Try to deschedule ourselves
-                    th->state = BLOCKED;
-                    wakeup(th, false /*no join, this is sleeping out of the scheduler*/);
-
-                    sleepQueue.pop_front();
-                    th = sleepQueue.front();
-                }
-            }
+            sleepQueue.advance(curPhase, [this](ThreadInfo* th) {
+                trace(Sched, "%d SLEEPING -> BLOCKED, waking up from timeout syscall (curPhase %ld, wakeupPhase %ld)", th->gid, curPhase, th->wakeupPhase);
+
+                // Try to deschedule ourselves
+                th->state = BLOCKED;
+                wakeup(th, false /*no join, this is sleeping out of the scheduler*/);
+            });
 
             //Handle rescheduling
-            if (runQueue.empty()) return;
+            if (!queuedThreads) return;
 
             if ((curPhase % schedQuantum) == 0) {
                 schedTick();
             }
         }
 
+        //Only touches the calling thread's own ThreadInfo, which leave() reads later, so it needs no schedLock
         volatile uint32_t* markForSleep(uint32_t pid, uint32_t tid, uint64_t wakeupPhase) {
-            futex_lock(&schedLock);
             uint32_t gid = getGid(pid, tid);
             trace(Sched, "%d marking for sleep", gid);
-            ThreadInfo* th = gidMap[gid];
+            ThreadInfo* th = lookupThread(gid);
             assert(!th->markedForSleep);
             th->markedForSleep = true;
             th->wakeupPhase = wakeupPhase;
             th->futexWord = 1; //to avoid races, this must be set here.
-            futex_unlock(&schedLock);
             return &(th->futexWord);
         }
 
+        //Unlocked read of state; a racing wakeup is handled by notifySleepEnd()
         bool isSleeping(uint32_t pid, uint32_t tid) {
-            futex_lock(&schedLock);
             uint32_t gid = getGid(pid, tid);
-            ThreadInfo* th = gidMap[gid];
-            bool res = th->state == SLEEPING;
-            futex_unlock(&schedLock);
-            return res;
+            ThreadInfo* th = lookupThread(gid);
+            return th->state == SLEEPING;
         }
 
         void notifySleepEnd(uint32_t pid, uint32_t tid) {
             futex_lock(&schedLock);
             uint32_t gid = getGid(pid, tid);
-            ThreadInfo* th = gidMap[gid];
+            ThreadInfo* th = lookupThread(gid);
             assert(th->markedForSleep == false);
             //Move to BLOCKED; thread will join pretty much immediately
             assert(th->state == SLEEPING || th->state == BLOCKED);
@@ -505,11 +516,9 @@ class Scheduler : public GlobAlloc, public Callee {
         }
 
         void printThreadState(uint32_t pid, uint32_t tid) {
-            futex_lock(&schedLock);
             uint32_t gid = getGid(pid, tid);
-            ThreadInfo* th = gidMap[gid];
+            ThreadInfo* th = lookupThread(gid);
             info("[%d] is in scheduling state %d", tid, th->state);
-            futex_unlock(&schedLock);
         }
 
         void notifyTermination() {
@@ -518,6 +527,7 @@ class Scheduler : public GlobAlloc, public Callee {
              */
             //futex_lock(&schedLock);
             terminateWatchdogThread = true;
+            signalWatchdog();
             //futex_unlock(&schedLock);
         }
 
@@ -527,14 +537,14 @@ class Scheduler : public GlobAlloc, public Callee {
         //if you call this and any other thread in the process is still alive, then there is a
         //much bigger problem.
         void processCleanup(uint32_t pid) {
-            futex_lock(&schedLock);
+            futex_lock(&gidMapLock);
             std::vector<uint32_t> doomedTids;
             g_unordered_map<uint32_t, ThreadInfo*>::iterator it;
             for (it = gidMap.begin(); it != gidMap.end(); it++) {
                 uint32_t gid = it->first;
                 if (getPid(gid) == pid) doomedTids.push_back(getTid(gid));
             }
-            futex_unlock(&schedLock);
+            futex_unlock(&gidMapLock);
 
             if (doomedTids.size()) {
                 for (uint32_t tid : doomedTids) {
@@ -552,12 +562,34 @@ class Scheduler : public GlobAlloc, public Callee {
         void queueProcessCleanup(uint32_t pid, uint32_t osPid) {
             futex_lock(&schedLock);
             pendingPidCleanups.push_back(std::make_pair(pid, osPid));
+            signalWatchdog();
             futex_unlock(&schedLock);
         }
 
         uint32_t getScheduledPid(uint32_t cid) const { return (contexts[cid].state == USED)? getPid(contexts[cid].curThread->gid) : (uint32_t)-1; }
 
     private:
+        ThreadInfo* lookupThread(uint32_t gid) {
+            futex_lock(&gidMapLock);
+            g_unordered_map<uint32_t, ThreadInfo*>::iterator it = gidMap.find(gid);
+            ThreadInfo* th = (it != gidMap.end())? it->second : nullptr;
+            futex_unlock(&gidMapLock);
+            return th;
+        }
+
+        //Queued threads wait in the run queue of their last context, so they tend to be rescheduled there
+        void runQueuePush(ThreadInfo* th) {
+            assert(th->mask[th->cid]);
+            contexts[th->cid].runQueue.push_back(th);
+            queuedThreads++;
+        }
+
+        void runQueueRemove(ThreadInfo* th) {
+            assert(th->owner);
+            th->owner->remove(th);
+            queuedThreads--;
+        }
+
         void schedule(ThreadInfo* th, ContextInfo* ctx) {
             assert(th->state == STARTED || th->state == BLOCKED || th->state == QUEUED);
             assert(ctx->state == IDLE);
@@ -639,7 +671,7 @@ class Scheduler : public GlobAlloc, public Callee {
          * - schedThread(): Here's a thread that just became available; return either a ContextInfo* where to schedule it, or nullptr if none are available
          * - schedContext(): Here's a context that just became available; return either a ThreadInfo* to schedule on it, or nullptr if none are available
          * - schedTick(): Current quantum is over, hand off contexts to other threads as you see fit
-         * These functions can REMOVE from runQueue, outQueue, and freeList, but do not INSERT. These are filled in elsewhere. They also have minimal concerns
+         * These functions can REMOVE from the run queues, outQueue, and freeList, but do not INSERT. These are filled in elsewhere. They also have minimal concerns
          * for thread and context states. Those state machines are implemented and handled elsewhere, except where strictly necessary.
          */
         ContextInfo* schedThread(ThreadInfo* th) {
@@ -689,18 +721,18 @@ class Scheduler : public GlobAlloc, public Callee {
         }
 
         ThreadInfo* schedContext(ContextInfo* ctx) {
-            ThreadInfo* th = nullptr;
-            ThreadInfo* blockedTh = runQueue.front();  // null if empty
-            while (blockedTh) {
-                if (blockedTh->mask[ctx->cid]) {
-                    th = blockedTh;
-                    runQueue.remove(blockedTh);
-                    break;
-                } else {
-                    blockedTh = blockedTh->next;
-                }
+            //First, take the oldest thread in our own run queue; all of them can run here
+            ThreadInfo* th = ctx->runQueue.front();
+
+            //Otherwise, steal from the other contexts' run queues, nearest first
+            for (uint32_t i = 1; !th && queuedThreads && i < numCores; i++) {
+                ThreadInfo* blockedTh = contexts[(ctx->cid + i) % numCores].runQueue.front();
+                while (blockedTh && !blockedTh->mask[ctx->cid]) blockedTh = blockedTh->next;
+                th = blockedTh;
             }
 
+            if (th) runQueueRemove(th);
+
             //info("schedContext done, cid %d, success %d (gid %d)", ctx->cid, th != nullptr, th? th->gid : 0);
             //printState();
             return th;
@@ -726,30 +758,38 @@ class Scheduler : public GlobAlloc, public Callee {
 
             uint32_t contextSwitches = 0;
 
-            ThreadInfo* th = runQueue.front();
-            while (th && !avail.empty()) {
-                bool scheduled = false;
-                for (std::list<uint32_t>::iterator it = avail.begin(); it != avail.end(); it++) {
-                    uint32_t cid = *it;
-                    if (th->mask[cid]) {
-                        ContextInfo* ctx = &contexts[cid];
-                        ThreadInfo* victimTh = ctx->curThread;
-                        assert(victimTh);
-                        victimTh->handoffThread = th;
-                        contextSwitches++;
-
-                        scheduled = true;
-                        avail.erase(it);
-                        break;
+            //Walk the run queues round-robin by position, so that every queue gets its oldest threads in first.
+            //Each pass looks at one more thread per queue, until all are walked or no contexts are left.
+            g_vector<ThreadInfo*> heads(numCores);
+            for (uint32_t c = 0; c < numCores; c++) heads[c] = contexts[c].runQueue.front();
+
+            bool progress = true;
+            while (progress && !avail.empty()) {
+                progress = false;
+                for (uint32_t c = 0; c < numCores && !avail.empty(); c++) {
+                    ThreadInfo* th = heads[c];
+                    if (!th) continue;
+                    heads[c] = th->next;
+                    progress = true;
+
+                    for (std::list<uint32_t>::iterator it = avail.begin(); it != avail.end(); it++) {
+                        uint32_t cid = *it;
+                        if (th->mask[cid]) {
+                            ContextInfo* ctx = &contexts[cid];
+                            ThreadInfo* victimTh = ctx->curThread;
+                            assert(victimTh);
+                            victimTh->handoffThread = th;
+                            contextSwitches++;
+
+                            avail.erase(it);
+                            runQueueRemove(th);
+                            break;
+                        }
                     }
                 }
-
-                ThreadInfo* pth = th;
-                th = th->next;
-                if (scheduled) runQueue.remove(pth);
             }
 
-            info("Time slice ended, context-switched %d threads, runQueue size %ld, available %ld", contextSwitches, runQueue.size(), avail.size());
+            info("Time slice ended, context-switched %d threads, runQueue size %d, available %ld", contextSwitches, queuedThreads, avail.size());
             printState();
         }
 
@@ -758,11 +798,18 @@ class Scheduler : public GlobAlloc, public Callee {
          * This initially was the responsibility of the last leaving thread, but led to horribly long syscalls being simulated. For example, if you
          * have 2 threads, 1 is sleeping and the other one goes on a syscall, it had to drive time fwd to wake the first thread up, on the off-chance
          * that the impending syscall was blocking, to avoid deadlock.
-         * Instead, we have an auxiliary thread check for this condition periodically, and if all threads are sleeping or blocked, we just drive time
-         * forward.
+         * Instead, we have an auxiliary thread check for this condition, and if all threads are sleeping or blocked, we just drive time
+         * forward. The watchdog does not poll: it sleeps on watchdogSeq until signaled (the system went idle with sleepers, the first fake
+         * leave, a pending process cleanup, or termination) or until the next deadline it tracks (a sleeper's wakeup, a fake-leave stall window).
          */
         void startWatchdogThread();
         void watchdogThreadFunc();
+        int64_t getWatchdogTimeout(uint64_t lastProgressNs, uint64_t idleDeadlineNs) const;
+
+        void signalWatchdog() {
+            __sync_fetch_and_add(&watchdogSeq, 1);
+            syscall(SYS_futex, &watchdogSeq, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+        }
 
         static void threadTrampoline(void* arg);
 
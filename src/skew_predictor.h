@@ -0,0 +1,80 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SKEW_PREDICTOR_H_
+#define SKEW_PREDICTOR_H_
+
+#include <stdint.h>
+
+/* Per-core model of the skew (contention delay) that the weave phase adds to a core, used when only
+ * some phases run the weave (sim.weaveSamplePeriod > 1). Sampled phases train an EWMA of skew cycles
+ * per bound-phase cycle; phases that skip the weave apply its prediction instead. Core recorders own
+ * one of these and call it from cSimEnd/cSimSkip, so it is always used fully synchronized.
+ */
+class SkewPredictor {
+    private:
+        double rate; //EWMA of skew cycles per bound-phase cycle
+        uint64_t phaseStartCycle; //bound-phase cycle at which the current phase started for this core
+        uint64_t unverifiedCycles; //skew predicted since the last sampled phase
+
+    public:
+        SkewPredictor() : rate(0.0), phaseStartCycle(0), unverifiedCycles(0) {}
+
+        // Core (re)joins: only cycles it runs for count towards the phase
+        void restart(uint64_t curCycle) {phaseStartCycle = curCycle;}
+
+        uint64_t getBoundCycles(uint64_t curCycle) const {
+            return (curCycle > phaseStartCycle)? curCycle - phaseStartCycle : 0;
+        }
+
+        uint64_t predict(uint64_t curCycle) const {
+            return (uint64_t)(rate*getBoundCycles(curCycle) + 0.5);
+        }
+
+        // Phase without weave: returns the skew to apply
+        uint64_t skip(uint64_t curCycle) {
+            uint64_t skew = predict(curCycle);
+            unverifiedCycles += skew;
+            phaseStartCycle = curCycle + skew;
+            return skew;
+        }
+
+        // Sampled phase: trains on the skew the weave phase measured
+        void train(uint64_t curCycle, uint64_t skew, double alpha) {
+            uint64_t boundCycles = getBoundCycles(curCycle);
+            if (boundCycles) rate = alpha*((double)skew)/boundCycles + (1.0 - alpha)*rate;
+            unverifiedCycles = 0;
+            phaseStartCycle = curCycle + skew;
+        }
+
+        // Sampled phase on which the core was not running, so there is nothing to train on
+        void verify() {unverifiedCycles = 0;}
+
+        // Predicted skew since the last sampled phase. The weave phase may find that some of it did not
+        // happen; then the core is already ahead, and the negative skew is absorbed rather than undone.
+        uint64_t getUnverifiedCycles() const {return unverifiedCycles;}
+};
+
+#endif  // SKEW_PREDICTOR_H_
@@ -29,22 +29,33 @@
 /* Slab allocator for timing events
  *
  * Each EventRecorder includes a slab allocator, and all timing events that are
- * in access paths, as well as TimingEventBlocks, are allocated there. Slabs
- * are garbage-collected once all their events are done. To do this without space
- * overheads, slabs are carefully aligned, so that objects inside the slab can
- * derive the pointer of their slab.
+ * in access paths, as well as TimingEventBlocks, are allocated there. Each
+ * slab holds elements of a single size class, and slabs are carefully aligned,
+ * so that objects inside the slab can derive the pointer of their slab (and
+ * thus their size and allocator) without space overheads.
+ *
+ * Dead elements are recycled individually, through per-size-class free lists,
+ * so a few long-lived events (e.g., crossings) cannot pin whole slabs. The
+ * allocator is only used by its owner (the bound-phase thread of its core, or
+ * the thread running the end of phase), but elements die in the weave threads.
+ * Those push them to a per-class lock-free list on the owner, which the owner
+ * takes over in one swap when its own free list runs dry. Slabs are never
+ * returned; the allocator's footprint is its peak.
  */
 
-#include <deque>
 #include <stddef.h>
 #include <stdint.h>
-#include "g_std/g_vector.h"
+#include <string.h>
+#include "galloc.h"
 #include "log.h"
-#include "mutex.h"
+#include "pad.h"
 
 #define SLAB_SIZE (1<<16)  // 64KB; must be a power of two
 #define SLAB_MASK (~(SLAB_SIZE - 1))
 
+#define SLAB_CLASS_BYTES 8  // size class granularity; objs are a multiple of 8 bytes
+#define SLAB_CLASSES 128  // largest size class is SLAB_CLASSES*SLAB_CLASS_BYTES bytes
+
 // Uncomment to immediately scrub slabs (to 0) and freed elems (to -1).
 // This makes use-after-free errors obvious.
 //#define DEBUG_SLAB_ALLOC
@@ -53,119 +64,131 @@ namespace slab {
 
 class SlabAlloc;
 
+struct FreeElem {
+    FreeElem* next;
+};
+
 struct Slab {  // POD type (no constructor)
     SlabAlloc* allocator;
-    volatile uint32_t liveElems;
+    uint32_t elemBytes;
     uint32_t usedBytes;
-    char buf[SLAB_SIZE - sizeof(SlabAlloc*) - sizeof(volatile uint32_t) - sizeof(uint32_t)];
+    char buf[SLAB_SIZE - sizeof(SlabAlloc*) - 2*sizeof(uint32_t)];
 
-    void init(SlabAlloc* _allocator) {
+    void init(SlabAlloc* _allocator, uint32_t _elemBytes) {
         allocator = _allocator;
-        clear();
-    }
-
-    void clear() {
-        liveElems = 0;
+        elemBytes = _elemBytes;
         usedBytes = 0;
+#ifdef DEBUG_SLAB_ALLOC
+        memset(buf, 0, sizeof(buf));
+#endif
     }
 
-    void* alloc(uint32_t bytes) {
-#if 1 //no effort to align, but objs are a multiple of 8 bytes, so all allocs are as well
+    // Carves a new element, or returns nullptr if the slab is full
+    void* alloc() {
+        if (usedBytes + elemBytes > sizeof(buf)) return nullptr;
         char* ptr = buf + usedBytes;
-        usedBytes += bytes;
-#else //align to some block size --- performs worse in my analysis, the loss in locality does not compensate
-#define ALIGN_SZ 64
-        char* base = buf+used;
-        char* ptr = static_cast<char*>(((uint64_t)(base+(ALIGN_SZ))) & (-ALIGN_SZ)); //aligned
-        used = (ptr-buf)+bytes;
-#endif
-        //info("Allocation starting at %p, %d bytes", ptr, bytes);
-        if (usedBytes < sizeof(buf)) {
-            liveElems++;  // allocation is unsynced, no need for atomic op
-            return ptr;
-        } else {
-            return nullptr;
-        }
+        usedBytes += elemBytes;
+        return ptr;
     }
-
-    inline void freeElem();
 };
 
 class SlabAlloc {
     private:
-        Slab* curSlab;
-        g_vector<Slab*> freeList;
-        uint32_t liveSlabs;
-        mutex freeLock;  // used because slab frees may be concurrent
+        // Owner-only
+        FreeElem* freeList[SLAB_CLASSES];
+        Slab* curSlab[SLAB_CLASSES];
+        uint64_t allocBytes;
+        uint64_t peakLiveBytes;
+        uint32_t slabs;
+
+        PAD();
+
+        // Written by the threads that free elements
+        FreeElem* volatile remoteFreeList[SLAB_CLASSES];
+        volatile uint64_t freedBytes;
+
+        PAD();
 
     public:
-        SlabAlloc() : curSlab(nullptr), liveSlabs(0) {
-            allocSlab();
+        SlabAlloc() : allocBytes(0), peakLiveBytes(0), slabs(0), freedBytes(0) {
+            for (uint32_t c = 0; c < SLAB_CLASSES; c++) {
+                freeList[c] = nullptr;
+                curSlab[c] = nullptr;
+                remoteFreeList[c] = nullptr;
+            }
         }
 
         void* alloc(size_t sz) {
-            assert(sz < SLAB_SIZE);
-            void* ptr = curSlab->alloc(sz);
-            if (unlikely(!ptr)) {
-                allocSlab();
-                ptr = curSlab->alloc(sz);
-                assert(ptr);
+            uint32_t c = (sz + SLAB_CLASS_BYTES - 1)/SLAB_CLASS_BYTES - 1;
+            assert_msg(sz && c < SLAB_CLASSES, "SlabAlloc: %ld-byte objects are not supported, max is %d", sz, SLAB_CLASSES*SLAB_CLASS_BYTES);
+            void* ptr = freeList[c];
+            if (likely(ptr != nullptr)) {
+                freeList[c] = freeList[c]->next;
+            } else {
+                ptr = refill(c);
             }
-            assert((((uintptr_t)ptr) & SLAB_MASK) == (uintptr_t)curSlab);
+
+            allocBytes += (c + 1)*SLAB_CLASS_BYTES;
+            uint64_t liveBytes = allocBytes - freedBytes;  // elements only die in the weave phase, so this is exact
+            if (unlikely(liveBytes > peakLiveBytes)) peakLiveBytes = liveBytes;
             return ptr;
         }
 
         template <typename T> T* alloc() { return (T*)alloc(sizeof(T)); }
 
+        // Thread-safe, lock-free
+        void freeElem(void* ptr, uint32_t elemBytes) {
+            FreeElem* elem = static_cast<FreeElem*>(ptr);
+            uint32_t c = elemBytes/SLAB_CLASS_BYTES - 1;
+            // Catches frees of objects embedded in an element, which would corrupt the free lists
+            assert_msg(((char*)ptr - ((Slab*)(((uintptr_t)ptr) & SLAB_MASK))->buf) % elemBytes == 0,
+                    "SlabAlloc: freeing %p, which is not at an element boundary", ptr);
+            FreeElem* head;
+            do {
+                head = remoteFreeList[c];
+                elem->next = head;
+            } while (!__sync_bool_compare_and_swap(&remoteFreeList[c], head, elem));
+            __sync_fetch_and_add(&freedBytes, elemBytes);
+        }
+
+        // Stats
+        uint32_t getSlabs() const {return slabs;}
+        uint64_t getLiveBytes() const {return allocBytes - freedBytes;}
+        uint64_t getPeakLiveBytes() const {return peakLiveBytes;}
+
     private:
-        void allocSlab() {
-            scoped_mutex sm(freeLock);
-            if (!freeList.empty()) {
-                curSlab = freeList.back();
-                freeList.pop_back();
-                assert(curSlab);
-            } else {
-                assert(sizeof(Slab) == SLAB_SIZE);
-                curSlab = gm_memalign<Slab>(sizeof(Slab));
-                assert((((uintptr_t)curSlab) & SLAB_MASK) == (uintptr_t)curSlab);
-                curSlab->init(this);  // NOTE: Slab is POD
+        void* refill(uint32_t c) {
+            // Take over all the elements freed by other threads at once. Other threads only push, so
+            // unlike a pop, this swap does not suffer from ABA.
+            FreeElem* elems = __sync_lock_test_and_set(&remoteFreeList[c], (FreeElem*)nullptr);
+            if (elems) {
+                freeList[c] = elems->next;
+                return elems;
             }
-            liveSlabs++;
-            //info("allocated slab %p, %d live, %ld in freeList", curSlab, liveSlabs, freeList.size());
-        }
 
-        void freeSlab(Slab* s) {
-            scoped_mutex sm(freeLock);
-            //info("freeing slab %p, %d live, %ld in freeList", s, liveSlabs, freeList.size());
-            s->clear();
-#ifdef DEBUG_SLAB_ALLOC
-            memset(s->buf, -1, sizeof(s->buf));
-#endif
-            if (s != curSlab) {
-                freeList.push_back(s);
-                liveSlabs--;
+            void* ptr = curSlab[c]? curSlab[c]->alloc() : nullptr;
+            if (!ptr) {
+                assert(sizeof(Slab) == SLAB_SIZE);
+                Slab* s = gm_memalign<Slab>(sizeof(Slab));
+                assert((((uintptr_t)s) & SLAB_MASK) == (uintptr_t)s);
+                s->init(this, (c + 1)*SLAB_CLASS_BYTES);  // NOTE: Slab is POD
+                curSlab[c] = s;
+                slabs++;
+                //info("allocated slab %p for %d-byte elems, %d slabs", s, s->elemBytes, slabs);
+                ptr = s->alloc();
+                assert(ptr);
             }
-            assert(liveSlabs);  // at least curSlab
+            return ptr;
         }
-
-        friend struct Slab;
 };
 
-inline void Slab::freeElem() {
-    uint32_t prevLiveElems = __sync_fetch_and_sub(&liveElems, 1);
-    assert(prevLiveElems && prevLiveElems < usedBytes /* >= 1 bytes/obj*/);
-    //info("[%p] Slab::freeElem %d prevLiveElems", this, prevLiveElems);
-    if (prevLiveElems == 1) {
-        allocator->freeSlab(this);
-    }
-}
-
 inline void freeElem(void* elem, size_t minSz) {
+    Slab* s = (Slab*)(((uintptr_t)elem) & SLAB_MASK);
+    assert(minSz <= s->elemBytes);
 #ifdef DEBUG_SLAB_ALLOC
-    memset(elem, 0, minSz);
+    memset(elem, -1, s->elemBytes);
 #endif
-    Slab* s = (Slab*)(((uintptr_t)elem) & SLAB_MASK);
-    s->freeElem();
+    s->allocator->freeElem(elem, s->elemBytes);
 }
 
 };  // namespace slab
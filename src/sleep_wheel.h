@@ -0,0 +1,107 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLEEP_WHEEL_H_
+#define SLEEP_WHEEL_H_
+
+#include <stdint.h>
+#include "intrusive_list.h"
+#include "log.h"
+
+/* Timer wheel of sleeping threads, indexed by wakeup phase. Replaces an
+ * ordered list, where each insertion walked all earlier sleepers. Inserts and
+ * removals are O(1); advance() only walks the slot of the phase that just
+ * started, so sleepers more than SLOTS phases away are revisited once per
+ * wheel turn. Only next(), which the scheduler watchdog calls when the system
+ * is idle, may scan the whole wheel.
+ *
+ * T must be an InListNode<T> with a "uint64_t wakeupPhase" field. Not
+ * thread-safe; the scheduler protects it with schedLock.
+ */
+template <typename T, uint32_t SLOTS = 1024>
+class SleepWheel {
+    private:
+        InList<T> slots[SLOTS];
+        uint64_t curPhase; //last phase passed to advance()
+        size_t elems;
+
+    public:
+        SleepWheel() : curPhase(0), elems(0) {}
+
+        bool empty() const {return elems == 0;}
+        size_t size() const {return elems;}
+
+        void insert(T* e) {
+            assert_msg(e->wakeupPhase > curPhase, "Sleeper with past deadline (wakeup %ld, cur %ld)", e->wakeupPhase, curPhase);
+            slots[e->wakeupPhase % SLOTS].push_back(e);
+            elems++;
+        }
+
+        void remove(T* e) {
+            slots[e->wakeupPhase % SLOTS].remove(e);
+            elems--;
+        }
+
+        // Called once per phase, in order. Removes every element whose
+        // deadline is phase and calls wake() on it, in insertion order.
+        template <typename F>
+        void advance(uint64_t phase, F wake) {
+            assert(phase == curPhase + 1);
+            curPhase = phase;
+            InList<T>& slot = slots[phase % SLOTS];
+            T* e = slot.front();
+            while (e) {
+                T* n = e->next;
+                if (e->wakeupPhase == phase) {
+                    slot.remove(e);
+                    elems--;
+                    wake(e);
+                } else {
+                    assert(e->wakeupPhase > phase);
+                }
+                e = n;
+            }
+        }
+
+        // Element with the earliest deadline, or nullptr if empty
+        T* next() const {
+            if (!elems) return nullptr;
+            for (uint64_t p = curPhase + 1; p <= curPhase + SLOTS; p++) {
+                for (T* e = slots[p % SLOTS].front(); e; e = e->next) {
+                    if (e->wakeupPhase == p) return e;
+                }
+            }
+            // All sleepers are at least a full turn away
+            T* min = nullptr;
+            for (uint32_t s = 0; s < SLOTS; s++) {
+                for (T* e = slots[s].front(); e; e = e->next) {
+                    if (!min || e->wakeupPhase < min->wakeupPhase) min = e;
+                }
+            }
+            return min;
+        }
+};
+
+#endif  // SLEEP_WHEEL_H_
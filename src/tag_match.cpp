@@ -0,0 +1,89 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tag_match.h"
+#include <immintrin.h>  // NOLINT
+
+__attribute__((target("avx2")))
+int32_t MatchTagAVX2(const Address* tags, uint32_t ways, Address tag) {
+    __m256i t = _mm256_set1_epi64x(tag);
+    for (uint32_t w = 0; w < ways; w += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&tags[w]));
+        uint32_t mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, t)));
+        if (mask) return w + __builtin_ctz(mask);
+    }
+    return -1;
+}
+
+/* Host feature detection. We can't use gcc's <cpuid.h> (it's shadowed by ours), and besides the CPUID feature bit,
+ * the OS must have enabled YMM state (XCR0), or AVX instructions fault.
+ */
+
+static inline void Cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* regs) {
+    __asm__ __volatile__("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t Xgetbv() {
+    uint32_t lo, hi;
+    __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" /*xgetbv*/ : "=a"(lo), "=d"(hi) : "c"(0));
+    return (((uint64_t)hi) << 32) | lo;
+}
+
+static bool HostHasAvx2() {
+    uint32_t r[4];
+    Cpuid(0, 0, r);
+    if (r[0] < 7) return false;
+
+    Cpuid(1, 0, r);
+    bool osxsave = r[2] & (1 << 27);
+    bool avx = r[2] & (1 << 28);
+    if (!osxsave || !avx) return false;
+    bool ymmState = (Xgetbv() & 0x6) == 0x6;  // SSE + AVX state
+
+    Cpuid(7, 0, r);
+    return ymmState && (r[1] & (1 << 5));
+}
+
+TagMatcher SelectTagMatcher(uint32_t ways, bool allowWide, const char** name) {
+    const char* n;
+    TagMatcher matcher;
+    if (allowWide && ways % 4 == 0 && HostHasAvx2()) {
+        n = "AVX2"; matcher = TM_AVX2;
+    } else if (ways == 2) {
+        n = "SSE2 2-way"; matcher = TM_SSE2_2;
+    } else if (ways == 4) {
+        n = "SSE2 4-way"; matcher = TM_SSE2_4;
+    } else if (ways == 8) {
+        n = "SSE2 8-way"; matcher = TM_SSE2_8;
+    } else if (ways == 16) {
+        n = "SSE2 16-way"; matcher = TM_SSE2_16;
+    } else if (ways == 32) {
+        n = "SSE2 32-way"; matcher = TM_SSE2_32;
+    } else {
+        n = "scalar"; matcher = TM_SCALAR;
+    }
+    if (name) *name = n;
+    return matcher;
+}
@@ -0,0 +1,89 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TAG_MATCH_H_
+#define TAG_MATCH_H_
+
+#include <emmintrin.h>  // NOLINT
+#include <stdint.h>
+#include "memory_hierarchy.h"
+
+/* Tag matching for set-associative lookups. Returns the index of the first way in tags[0..ways) that holds tag, or
+ * -1 if none does. This is the inner loop of every SetAssocArray and SparseTagArray lookup, so arrays pick a matcher
+ * for their associativity once, at construction, and MatchTag() dispatches on it with a switch that inlines the
+ * chosen matcher into the lookup:
+ *  - A branchless, fully unrolled SSE2 matcher per power-of-2 associativity (2-32 ways),
+ *  - A plain scalar loop otherwise,
+ *  - And, if the array allows wide vectors (array.wideTagMatch) and the host supports it, AVX2 for multiples of
+ *    4 ways. This one is not inlined, as it is compiled for a different target.
+ *
+ * NOTE: AVX2 is opt-in because it touches YMM upper state from within the Pin tool, whose analysis routines
+ * otherwise only use the SSE2 baseline the tool is compiled for. There is no AVX-512 version: besides the same
+ * concern, it lowers the host's clock frequency, and at cache associativities it does not beat AVX2.
+ */
+
+enum TagMatcher {TM_SCALAR, TM_SSE2_2, TM_SSE2_4, TM_SSE2_8, TM_SSE2_16, TM_SSE2_32, TM_AVX2};
+
+static inline int32_t MatchTagScalar(const Address* tags, uint32_t ways, Address tag) {
+    for (uint32_t w = 0; w < ways; w++) {
+        if (tags[w] == tag) return w;
+    }
+    return -1;
+}
+
+// Compares all W ways, then picks the first match, so the only branch is on hit/miss
+template <uint32_t W>
+static inline int32_t MatchTagSSE2(const Address* tags, Address tag) {
+    static_assert(W % 2 == 0 && W <= 32, "W must be even, and the mask is 32 bits");
+    __m128i t = _mm_set1_epi64x(tag);
+    uint32_t mask = 0;
+    for (uint32_t w = 0; w < W; w += 2) {
+        // SSE2 has no 64-bit compare: compare 32-bit halves, and AND each half with the other one
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&tags[w])), t);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        mask |= ((uint32_t)_mm_movemask_pd(_mm_castsi128_pd(eq))) << w;
+    }
+    return mask? __builtin_ctz(mask) : -1;
+}
+
+// ways must be a multiple of 4, and the host must support AVX2
+int32_t MatchTagAVX2(const Address* tags, uint32_t ways, Address tag);
+
+// Returns the matcher for this associativity; if name is non-null, it is set to a description
+TagMatcher SelectTagMatcher(uint32_t ways, bool allowWide, const char** name = nullptr);
+
+static inline int32_t MatchTag(TagMatcher matcher, const Address* tags, uint32_t ways, Address tag) {
+    switch (matcher) {
+        case TM_SSE2_2: return MatchTagSSE2<2>(tags, tag);
+        case TM_SSE2_4: return MatchTagSSE2<4>(tags, tag);
+        case TM_SSE2_8: return MatchTagSSE2<8>(tags, tag);
+        case TM_SSE2_16: return MatchTagSSE2<16>(tags, tag);
+        case TM_SSE2_32: return MatchTagSSE2<32>(tags, tag);
+        case TM_AVX2: return MatchTagAVX2(tags, ways, tag);
+        default: return MatchTagScalar(tags, ways, tag);
+    }
+}
+
+#endif  // TAG_MATCH_H_
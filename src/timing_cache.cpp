@@ -61,8 +61,7 @@ void TimingCache::initStats(AggregateStat* parentStat) {
 
 // TODO(dsm): This is copied verbatim from Cache. We should split Cache into different methods, then call those.
 uint64_t TimingCache::access(MemReq& req) {
-    EventRecorder* evRec = zinfo->eventRecorders[req.srcId];
-    assert_msg(evRec, "TimingCache is not connected to TimingCore");
+    EventRecorder* evRec = zinfo->eventRecorders[req.srcId]; //null in phases that skip the weave (sim.weaveSamplePeriod)
 
     TimingRecord writebackRecord, accessRecord;
     writebackRecord.clear();
@@ -95,7 +94,7 @@ uint64_t TimingCache::access(MemReq& req) {
 
                 array->postinsert(req.lineAddr, &req, lineId); //do the actual insertion. NOTE: Now we must split insert into a 2-phase thing because cc unlocks us.
 
-                if (evRec->hasRecord()) writebackRecord = evRec->popRecord();
+                if (evRec && evRec->hasRecord()) writebackRecord = evRec->popRecord();
             }
         }
 
@@ -107,6 +106,9 @@ uint64_t TimingCache::access(MemReq& req) {
             respCycle = cc->processAccess(req, lineId, respCycle, &getDoneCycle);
         }
 
+        // Phases that skip the weave only need the latency computed above
+        if (!evRec) return endAccess(req, respCycle, isMiss);
+
         if (evRec->hasRecord()) accessRecord = evRec->popRecord();
 
         // At this point we have all the info we need to hammer out the timing record
@@ -226,6 +228,10 @@ uint64_t TimingCache::access(MemReq& req) {
         evRec->pushRecord(tr);
     }
 
+    return endAccess(req, respCycle, isMiss);
+}
+
+uint64_t TimingCache::endAccess(MemReq& req, uint64_t respCycle, bool isMiss) {
     if (isMiss) {
         totalMissLat += respCycle - req.cycle;
         numMisses++;
@@ -122,6 +122,9 @@ class TimingCache : public Cache {
     protected:
         uint64_t highPrioAccess(uint64_t cycle);
         uint64_t tryLowPrioAccess(uint64_t cycle);
+
+    private:
+        uint64_t endAccess(MemReq& req, uint64_t respCycle, bool isMiss);  // common tail of access()
 };
 
 #endif  // TIMING_CACHE_H_
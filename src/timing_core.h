@@ -64,6 +64,7 @@ class TimingCore : public Core {
         inline EventRecorder* getEventRecorder() {return cRec.getEventRecorder();}
         void cSimStart() {curCycle = cRec.cSimStart(curCycle);}
         void cSimEnd() {curCycle = cRec.cSimEnd(curCycle);}
+        void cSimSkip() {curCycle = cRec.cSimSkip(curCycle);}
 
     private:
         inline void loadAndRecord(Address addr, Address pc, InsType type);
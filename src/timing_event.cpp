@@ -42,6 +42,13 @@ void TimingEvent::parentDone(uint64_t startCycle) {
     }
 }
 
+void TimingEvent::done(uint64_t doneCycle) {
+    assert(state == EV_RUNNING); //ContentionSim sets it when calling simulate()
+    state = EV_DONE;
+    if (numChildren) zinfo->contentionSim->wakeChildren(this, doneCycle+postDelay);
+    freeEvent();  // NOTE: immediately reclaimed!
+}
+
 void TimingEvent::queue(uint64_t nextCycle) {
     assert(state == EV_NONE && numParents == 0);
     state = EV_QUEUED;
@@ -95,6 +102,7 @@ CrossingEvent::CrossingEvent(TimingEvent* parent, TimingEvent* child, uint64_t _
     assert(srcDomain >= 0);
     simCount = 0;
     called = false;
+    setCustomParentDone();
     addChild(child, evRec);
     doneCycle = 0;
 
@@ -154,6 +162,7 @@ void CrossingEvent::simulate(uint64_t simCycle) {
 #if PROFILE_CROSSINGS
             simCount++;
 #endif
+            zinfo->contentionSim->recordCrossingRetry(domain);
             numParents = 0; //HACK
             requeue(nextCycle);
             return;
@@ -163,6 +172,7 @@ void CrossingEvent::simulate(uint64_t simCycle) {
     //Runs if called
     //assert_msg(simCycle <= doneCycle+preSlack+postSlack+1, "simCycle %ld doneCycle %ld, preSlack %d postSlack %d simCount %ld child %s", simCycle, doneCycle, preSlack, postSlack, simCount, typeid(*child).name());
     zinfo->contentionSim->setPrio(domain, 0);
+    zinfo->contentionSim->recordCrossing(srcDomain, domain);
 
 #if PROFILE_CROSSINGS
     zinfo->contentionSim->profileCrossing(srcDomain, domain, simCount);
@@ -33,7 +33,10 @@
 #include "event_recorder.h"
 #include "galloc.h"
 
-#define TIMING_BLOCK_EVENTS 3
+// The first children of an event are stored inline; wider fan-outs spill to
+// blocks (one cache line each) allocated from the event recorder
+#define TIMING_INLINE_CHILDREN 3
+#define TIMING_BLOCK_EVENTS 7
 struct TimingEventBlock {
     TimingEvent* events[TIMING_BLOCK_EVENTS];
     TimingEventBlock* next;
@@ -66,20 +69,19 @@ class CrossingEvent;
 
 class TimingEvent {
     private:
-        uint64_t privCycle; //only touched by ContentionSim
+        uint64_t privCycle; //only touched by ContentionSim and PrioQueue
 
     public:
         TimingEvent* next; //used by PrioQueue --- PRIVATE
 
     private:
         EventState state;
+        bool customParentDone; //parentDone() is overriden, so ContentionSim::wakeChildren() must call it
         uint64_t cycle;
 
         uint64_t minStartCycle;
-        union {
-            TimingEvent* child;
-            TimingEventBlock* children;
-        };
+        TimingEvent* inlineChildren[TIMING_INLINE_CHILDREN];
+        TimingEventBlock* children; //children beyond the inline ones, newest block first
         int32_t domain; //-1 if none; if none, it acquires it from the parent. Cannot be a starting event (no parents at enqueue time) and get -1 as domain
         uint32_t numChildren;
         uint32_t numParents;
@@ -87,10 +89,10 @@ class TimingEvent {
         uint32_t postDelay; //we could get by with one delay, but pre/post makes it easier to code
 
     public:
-        TimingEvent(uint32_t _preDelay, uint32_t _postDelay, int32_t _domain = -1) : next(nullptr), state(EV_NONE), cycle(0), minStartCycle(-1L), child(nullptr),
-                    domain(_domain), numChildren(0), numParents(0), preDelay(_preDelay), postDelay(_postDelay) {}
-        explicit TimingEvent(int32_t _domain = -1) : next(nullptr), state(EV_NONE), minStartCycle(-1L), child(nullptr),
-                    domain(_domain), numChildren(0), numParents(0), preDelay(0), postDelay(0) {} //no delegating constructors until gcc 4.7...
+        TimingEvent(uint32_t _preDelay, uint32_t _postDelay, int32_t _domain = -1) : next(nullptr), state(EV_NONE), customParentDone(false), cycle(0), minStartCycle(-1L),
+                    children(nullptr), domain(_domain), numChildren(0), numParents(0), preDelay(_preDelay), postDelay(_postDelay) {}
+        explicit TimingEvent(int32_t _domain = -1) : next(nullptr), state(EV_NONE), customParentDone(false), minStartCycle(-1L),
+                    children(nullptr), domain(_domain), numChildren(0), numParents(0), preDelay(0), postDelay(0) {} //no delegating constructors until gcc 4.7...
 
         inline uint32_t getDomain() const {return domain;}
         inline uint32_t getNumChildren() const {return numChildren;}
@@ -109,25 +111,18 @@ class TimingEvent {
 
             TimingEvent* res = childEv;
 
-            if (numChildren == 0) {
-                numChildren = 1;
-                child = childEv;
-            } else if (numChildren == 1) {
-                TimingEvent* firstChild = child;
-                children = new (evRec) TimingEventBlock();
-                children->events[0] = firstChild;
-                children->events[1] = childEv;
-                numChildren = 2;
+            if (numChildren < TIMING_INLINE_CHILDREN) {
+                inlineChildren[numChildren] = childEv;
             } else {
-                uint32_t idx = numChildren % TIMING_BLOCK_EVENTS;
+                uint32_t idx = (numChildren - TIMING_INLINE_CHILDREN) % TIMING_BLOCK_EVENTS;
                 if (idx == 0) {
                     TimingEventBlock* tmp = children;
                     children = new (evRec) TimingEventBlock();
                     children->next = tmp;
                 }
                 children->events[idx] = childEv;
-                numChildren++;
             }
+            numChildren++;
 
             if (domain != -1 && childEv->domain == -1) {
                 childEv->propagateDomain(domain);
@@ -141,6 +136,8 @@ class TimingEvent {
             return addChild(childEv, &evRec);
         }
 
+        // NOTE: Subclasses that override this must call setCustomParentDone(),
+        // because ContentionSim::wakeChildren() inlines the default version
         virtual void parentDone(uint64_t startCycle); // see cpp
 
         //queue for the first time
@@ -176,16 +173,7 @@ class TimingEvent {
             state = EV_RUNNING;
         }
 
-        void done(uint64_t doneCycle) {
-            assert(state == EV_RUNNING); //ContentionSim sets it when calling simulate()
-            state = EV_DONE;
-            auto vLambda = [this, doneCycle](TimingEvent** childPtr) {
-                checkDomain(*childPtr);
-                (*childPtr)->parentDone(doneCycle+postDelay);
-            };
-            visitChildren< decltype(vLambda) >(vLambda);
-            freeEvent();  // NOTE: immediately reclaimed!
-        }
+        void done(uint64_t doneCycle); //see cpp
 
         void produceCrossings(EventRecorder* evRec);
 
@@ -227,18 +215,16 @@ class TimingEvent {
 
         template <typename F> //F has to be decltype(f)
         inline void visitChildren(F f) {
-            if (numChildren == 0) return;
             //info("visit %p nc %d", this, numChildren);
-            if (numChildren == 1) {
-                f(&child);
-            } else {
+            uint32_t numInline = MIN(numChildren, (uint32_t)TIMING_INLINE_CHILDREN);
+            for (uint32_t i = 0; i < numInline; i++) f(&inlineChildren[i]);
+            if (numChildren > TIMING_INLINE_CHILDREN) {
                 TimingEventBlock* curBlock = children;
-                uint32_t visitedChildren = 0;
+                uint32_t visitedChildren = numInline;
                 while (curBlock) {
                     for (uint32_t i = 0; i < TIMING_BLOCK_EVENTS; i++) {
                         //info("visit %p i %d %p", this, i, curBlock->events[i]);
                         if (!curBlock->events[i]) {break;}
-                        //info("visit %p i %d %p PASS", this, i, curBlock->events[i]);
                         f(&(curBlock->events[i]));
                         visitedChildren++;
                     }
@@ -255,11 +241,11 @@ class TimingEvent {
 
         void freeEvent() {
             // Free timing event blocks and ourselves
-            if (numChildren > 1) {
+            if (numChildren > TIMING_INLINE_CHILDREN) {
                 TimingEventBlock* teb = children;
                 while (teb) {
                     TimingEventBlock* next = teb->next;
-                    slab::freeElem((void*)teb, sizeof(teb));
+                    slab::freeElem((void*)teb, sizeof(TimingEventBlock));
                     teb = next;
                 }
                 children = nullptr;
@@ -278,15 +264,22 @@ class TimingEvent {
             state = EV_RUNNING;
         }
 
+        void setCustomParentDone() {
+            customParentDone = true;
+        }
+
 
     friend class ContentionSim;
+    template <typename T, uint32_t B> friend class PrioQueue;
     friend class DelayEvent; //DelayEvent is, for now, the only child of TimingEvent that should do anything other than implement simulate
     friend class CrossingEvent;
 };
 
 class DelayEvent : public TimingEvent {
     public:
-        explicit DelayEvent(uint32_t delay) : TimingEvent(delay, 0) {}
+        explicit DelayEvent(uint32_t delay) : TimingEvent(delay, 0) {
+            setCustomParentDone();
+        }
 
         virtual void parentDone(uint64_t startCycle) {
             cycle = MAX(cycle, startCycle);
@@ -325,6 +318,7 @@ class CrossingEvent : public TimingEvent {
                     //numParents incremented, but we set it to 1 to maintain semantics in case we have a walk
                     assert(numParents == 0);
                     numParents = 1;
+                    setCustomParentDone();
                 }
 
                 virtual void parentDone(uint64_t startCycle) {
@@ -333,8 +327,8 @@ class CrossingEvent : public TimingEvent {
                     assert(numChildren == 0);
                     ce->markSrcEventDone(startCycle);
                     assert(state == EV_NONE);
-                    state = EV_RUNNING;
-                    done(startCycle);  // does RUNNING -> DONE and frees event
+                    // Not done(): we are embedded in ce, which frees us with itself, and have no children to wake
+                    state = EV_DONE;
                 }
 
                 virtual void simulate(uint64_t simCycle) {
@@ -65,17 +65,17 @@ void UMon::initStats(AggregateStat* parentStat) {
 }
 
 
-void UMon::access(Address lineAddr) {
+bool UMon::isSampled(Address lineAddr) const {
     //1. Hash to decide if it should go in the cache
     uint64_t sampleMask = ~(((uint64_t)-1LL) << samplingFactorBits);
     uint64_t sampleSel = (hf->hash(0, lineAddr)) & sampleMask;
 
     //info("0x%lx 0x%lx", sampleMask, sampleSel);
 
-    if (sampleSel != 0) {
-        return;
-    }
+    return sampleSel == 0;
+}
 
+void UMon::accessSampled(Address lineAddr) {
     //2. Insert; hit or miss?
     uint64_t setMask = ~(((uint64_t)-1LL) << setsBits);
     uint64_t set = (hf->hash(1, lineAddr)) & setMask;
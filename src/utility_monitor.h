@@ -68,7 +68,14 @@ class UMon : public GlobAlloc {
         UMon(uint32_t _bankLines, uint32_t _umonLines, uint32_t _buckets);
         void initStats(AggregateStat* parentStat);
 
-        void access(Address lineAddr);
+        void access(Address lineAddr) {
+            if (isSampled(lineAddr)) accessSampled(lineAddr);
+        }
+
+        // access() split in its sampling filter and its update, so that the
+        // update can be deferred
+        bool isSampled(Address lineAddr) const;
+        void accessSampled(Address lineAddr);
 
         uint64_t getNumAccesses() const;
         void getMisses(uint64_t* misses);
@@ -26,6 +26,7 @@
 
 #include <unistd.h>
 #include "log.h"
+#include "phase_controller.h"
 #include "process_tree.h"
 #include "rdtsc.h"
 #include "scheduler.h"
@@ -204,7 +205,7 @@ PostPatchFn PatchNanosleep(PrePatchArgs args) {
     else waitNsec = 0;
 
     uint64_t waitCycles = nsToCycles(waitNsec);
-    uint64_t waitPhases = waitCycles/zinfo->phaseLength + 1; //wait at least 1 phase
+    uint64_t waitPhases = CyclesToPhases(waitCycles) + 1; //wait at least 1 phase
     uint64_t wakeupPhase = zinfo->numPhases + waitPhases;
 
     volatile uint32_t* futexWord = zinfo->sched->markForSleep(procIdx, args.tid, wakeupPhase);
@@ -254,7 +255,7 @@ PostPatchFn PatchNanosleep(PrePatchArgs args) {
         if (rem) {
             if (res == EINTR) {
                 assert(wakeupPhase >= zinfo->numPhases);  // o/w why is this EINTR...
-                uint64_t remainingCycles = wakeupPhase - zinfo->numPhases;
+                uint64_t remainingCycles = PhasesToCycles(wakeupPhase - zinfo->numPhases);
                 uint64_t remainingNsecs = remainingCycles*1000/zinfo->freqMHz;
                 rem->tv_sec = remainingNsecs/1000000000;
                 rem->tv_nsec = remainingNsecs % 1000000000;
@@ -25,6 +25,7 @@
 
 #include "constants.h"
 #include "log.h"
+#include "phase_controller.h"
 #include "scheduler.h"
 #include "process_tree.h"
 #include "virt/common.h"
@@ -117,7 +118,7 @@ static bool PrePatchTimeoutSyscall(uint32_t tid, CONTEXT* ctxt, SYSCALL_STANDARD
     //info("[%d] pre-patch %s (%d) waitNsec = %ld", tid, GetSyscallName(syscall), syscall, waitNsec);
 
     uint64_t waitCycles = waitNsec*zinfo->freqMHz/1000;
-    uint64_t waitPhases = waitCycles/zinfo->phaseLength;
+    uint64_t waitPhases = CyclesToPhases(waitCycles);
     if (waitPhases < 2) waitPhases = 2;  // at least wait 2 phases; this should basically eliminate the chance that we get a SIGSYS before we start executing the syscal instruction
     uint64_t wakeupPhase = zinfo->numPhases + waitPhases;
 
@@ -49,10 +49,12 @@
 #include "cpuenum.h"
 #include "cpuid.h"
 #include "debug_zsim.h"
+#include "decode_cache.h"
 #include "event_queue.h"
 #include "galloc.h"
 #include "init.h"
 #include "log.h"
+#include "phase_controller.h"
 #include "pin.H"
 #include "pin_cmd.h"
 #include "process_tree.h"
@@ -352,7 +354,7 @@ VOID FFITrackNFFInterval() {
         *_ffiPrevFFStartInstrs = *_ffiFFStartInstrs;
         *_ffiFFStartInstrs = zinfo->processStats->getProcessInstrs(p);
     };
-    zinfo->eventQueue->insert(makeAdaptiveEvent(ffiGet, ffiFire, 0, ffiInstrsLimit - ffiInstrsDone, MAX_IPC*zinfo->phaseLength));
+    zinfo->eventQueue->insert(makeAdaptiveEvent(ffiGet, ffiFire, 0, ffiInstrsLimit - ffiInstrsDone, MAX_IPC*MaxPhaseLength()));
 
     ffiNFF = true;
 }
@@ -543,6 +545,7 @@ VOID CheckForTermination() {
  */
 VOID EndOfPhaseActions() {
     zinfo->profSimTime->transition(PROF_WEAVE);
+    zinfo->profEndOfPhase->transition(EOP_PAUSE);
     if (zinfo->globalPauseFlag) {
         info("Simulation entering global pause");
         zinfo->profSimTime->transition(PROF_FF);
@@ -560,9 +563,15 @@ VOID EndOfPhaseActions() {
         info("Synced fast-forwarding done, resuming simulation");
     }
 
+    zinfo->profEndOfPhase->transition(EOP_TERMINATION);
     CheckForTermination();
+    zinfo->profEndOfPhase->transition(EOP_WEAVE);
     zinfo->contentionSim->simulatePhase(zinfo->globPhaseCycles + zinfo->phaseLength);
-    zinfo->eventQueue->tick();
+    zinfo->profEndOfPhase->transition(EOP_PHASECTRL);
+    if (zinfo->phaseController) zinfo->phaseController->endOfPhase();
+    zinfo->profEndOfPhase->transition(EOP_EVENTS);
+    zinfo->eventQueue->tick(); //includes periodic stats dumps, and with them the per-process stats updates
+    zinfo->profEndOfPhase->transition(EOP_NONE);
     zinfo->profSimTime->transition(PROF_BOUND);
 }
 
@@ -830,7 +839,7 @@ VOID Trace(TRACE trace, VOID *v) {
         if (!procTreeNode->isInFastForward() || !zinfo->ffReinstrument) {
             // Visit every basic block in the trace
             for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
-                BblInfo* bblInfo = Decoder::decodeBbl(bbl, zinfo->oooDecode);
+                BblInfo* bblInfo = zinfo->decodeCache? zinfo->decodeCache->get(bbl) : Decoder::decodeBbl(bbl, zinfo->oooDecode);
                 BBL_InsertCall(bbl, IPOINT_BEFORE /*could do IPOINT_ANYWHERE if we redid load and store simulation in OOO*/, 
                     (AFUNPTR)IndirectBasicBlock, 
                     IARG_FAST_ANALYSIS_CALL,
@@ -1350,10 +1359,13 @@ VOID SimEnd() {
             info("All other processes done, terminating");
         }
 
+        if (zinfo->decodeCache) zinfo->decodeCache->save();
+
         info("Dumping termination stats");
         zinfo->trigger = 20000;
         for (StatsBackend* backend : *(zinfo->statsBackends)) backend->dump(false /*unbuffered, write out*/);
         for (AccessTraceWriter* t : *(zinfo->traceWriters)) t->dump(false);  // flushes trace writer
+        zinfo->contentionSim->proposeDomainMap();
 
         if (zinfo->sched) zinfo->sched->notifyTermination();
     }
@@ -1770,6 +1782,10 @@ int main(int argc, char *argv[]) {
 
     //Register instrumentation
     TRACE_AddInstrumentFunction(Trace, 0);
+    if (zinfo->decodeCache) {
+        IMG_AddInstrumentFunction(DecodeCache::imageLoad, 0);
+        IMG_AddUnloadFunction(DecodeCache::imageUnload, 0);
+    }
     VdsoInit(); //initialized vDSO patching information (e.g., where all the possible vDSO entry points are)
 
     RTN_AddInstrumentFunction(RoutineCallback, 0);
@@ -1801,6 +1817,7 @@ int main(int argc, char *argv[]) {
             EndOfPhaseActions();
             zinfo->numPhases++;
             zinfo->globPhaseCycles += zinfo->phaseLength;
+            if (zinfo->phaseController) zinfo->phaseController->advance();
         }
         info("Finished trace-driven simulation");
         SimEnd();
@@ -49,6 +49,8 @@ class ProcessStats;
 class ProcStats;
 class EventQueue;
 class ContentionSim;
+class PhaseLengthController;
+class DecodeCache;
 class EventRecorder;
 class PinCmd;
 class PortVirtualizer;
@@ -73,6 +75,16 @@ enum ProfileStates {
     PROF_FF = 3,
 };
 
+//Breakdown of the end-of-phase actions (profEndOfPhase); EOP_NONE accounts for time outside them
+enum EndOfPhaseStates {
+    EOP_NONE = 0,
+    EOP_PAUSE = 1,
+    EOP_TERMINATION = 2,
+    EOP_WEAVE = 3,
+    EOP_PHASECTRL = 4,
+    EOP_EVENTS = 5,
+};
+
 enum ProcExitStatus {
     PROC_RUNNING = 0,
     PROC_EXITED = 1,
@@ -101,7 +113,9 @@ struct GlobSimInfo {
     PAD();
 
     //World-readable
-    uint32_t phaseLength;
+    uint32_t phaseLength; //length of the current phase; fixed unless sim.adaptivePhaseLength is set
+    uint32_t nextPhaseLength; //length of the next phase, used by cores to compute their next phase end before the barrier
+    PhaseLengthController* phaseController; //nullptr unless sim.adaptivePhaseLength is set
     uint32_t statsPhaseInterval;
     uint32_t freqMHz;
 
@@ -116,6 +130,7 @@ struct GlobSimInfo {
     bool blockingSyscalls;
     bool perProcessCpuEnum; //if true, cpus are enumerated according to per-process masks (e.g., a 16-core mask in a 64-core sim sees 16 cores)
     bool oooDecode; //if true, Decoder does OOO (instr->uop) decoding
+    DecodeCache* decodeCache; //if non-null, decoded BBLs are looked up and shared through here
 
     PAD();
 
@@ -157,6 +172,7 @@ struct GlobSimInfo {
     ProcStats* procStats;
 
     TimeBreakdownStat* profSimTime;
+    TimeBreakdownStat* profEndOfPhase;
     VectorCounter* profHeartbeats; //global b/c number of processes cannot be inferred at init time; we just size to max
 
     uint64_t trigger; //code with what triggered the current stats dump
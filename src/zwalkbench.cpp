@@ -0,0 +1,155 @@
+/** $lic$
+ * Copyright (C) 2012-2015 by Massachusetts Institute of Technology
+ * Copyright (C) 2010-2013 by The Board of Trustees of Stanford University
+ *
+ * This file is part of zsim.
+ *
+ * zsim is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 2.
+ *
+ * If you use this software in your research, we request that you reference
+ * the zsim paper ("ZSim: Fast and Accurate Microarchitectural Simulation of
+ * Thousand-Core Systems", Sanchez and Kozyrakis, ISCA-40, June 2013) as the
+ * source of the simulator in any publications that use this software, and that
+ * you send us a citation of your work.
+ *
+ * zsim is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the zcache replacement walk with the three ways to compute the H3 hashes of each visited address: the
+ * bit-matrix reference one way at a time (as the walk did originally), the table-driven hash() one way at a time, and
+ * a single hashAll() call per address (what ZArray does now). The walk mirrors ZArray::preinsert() and postinsert()
+ * (ZArray itself can't be linked outside the Pin tool), on a full array of random lines, with a random victim among
+ * the candidates. All modes replay the same inserts, so they must visit the same candidates; we check that too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "bithacks.h"
+#include "cache_arrays.h"  // for ZWalkInfo
+#include "galloc.h"
+#include "hash.h"
+#include "log.h"
+#include "mtrand.h"
+#include "profile_stats.h"
+
+using namespace std;
+
+enum HashMode {MATRIX, HASH, HASH_ALL};
+static const char* modeNames[] = {"matrix", "hash()", "hashAll()"};
+
+struct ZWalk {
+    uint32_t numLines, numSets, ways, cands, setMask;
+    vector<Address> array;
+    vector<uint32_t> lookupArray;
+
+    ZWalk(uint32_t _numLines, uint32_t _ways, uint32_t _cands, uint64_t seed)
+        : numLines(_numLines), numSets(_numLines/_ways), ways(_ways), cands(_cands), setMask(_numLines/_ways - 1),
+          array(_numLines), lookupArray(_numLines)
+    {
+        MTRand rnd(seed);
+        for (uint32_t i = 0; i < numLines; i++) {
+            array[i] = ((((uint64_t)rnd.randInt()) << 32) | rnd.randInt()) | 1;  // full cache, nonzero lines
+            lookupArray[i] = i;
+        }
+    }
+
+    // Returns a checksum of the candidates visited
+    uint64_t insert(HashFamily* hf, H3HashFamily* h3, HashMode mode, Address lineAddr, uint32_t victimRnd) {
+        ZWalkInfo candidates[cands + ways];
+        uint64_t hashes[ways];
+        auto hashLine = [&](Address addr) {
+            switch (mode) {
+                case MATRIX: for (uint32_t w = 0; w < ways; w++) hashes[w] = h3->matrixHash(w, addr); break;
+                case HASH: for (uint32_t w = 0; w < ways; w++) hashes[w] = hf->hash(w, addr); break;
+                case HASH_ALL: hf->hashAll(addr, ways, hashes); break;
+            }
+        };
+
+        // Seeds and BFS expansion, as in ZArray::preinsert() (always all-valid here)
+        hashLine(lineAddr);
+        for (uint32_t w = 0; w < ways; w++) {
+            uint32_t pos = w*numSets + (hashes[w] & setMask);
+            candidates[w].set(pos, lookupArray[pos], -1);
+        }
+        uint32_t numCandidates = ways;
+        uint32_t fringeStart = 0;
+        while (numCandidates < cands) {
+            uint32_t fringeId = candidates[fringeStart].lineId;
+            hashLine(array[fringeId]);
+            for (uint32_t w = 0; w < ways; w++) {
+                uint32_t pos = w*numSets + (hashes[w] & setMask);
+                uint32_t lineId = lookupArray[pos];
+                candidates[numCandidates].set(pos, lineId, (int32_t)fringeStart);
+                numCandidates += (lineId != fringeId);
+            }
+            fringeStart++;
+        }
+        numCandidates = cands;
+
+        uint64_t checksum = 0;
+        for (uint32_t i = 0; i < numCandidates; i++) checksum = checksum*31 + candidates[i].lineId;
+
+        // Victim and swaps, as in ZArray::postinsert()
+        uint32_t victimIdx = victimRnd % numCandidates;
+        uint32_t victim = candidates[victimIdx].lineId;
+        for (uint32_t i = 0; i < victimIdx; i++) {
+            if (candidates[i].lineId == victim) {victimIdx = i; break;}  // minimum index, in case of loops
+        }
+        uint32_t swapArray[cands];
+        uint32_t swapLen = 0;
+        for (int32_t idx = victimIdx; idx >= 0; idx = candidates[idx].parentIdx) swapArray[swapLen++] = candidates[idx].pos;
+        for (uint32_t i = 0; i < swapLen - 1; i++) lookupArray[swapArray[i]] = lookupArray[swapArray[i+1]];
+        lookupArray[swapArray[swapLen - 1]] = victim;
+        array[victim] = lineAddr;
+        return checksum;
+    }
+};
+
+int main(int argc, const char* argv[]) {
+    InitLog(""); //no log header
+    if (argc > 2) {
+        info("Measures zcache replacement walks/s with per-way and batched H3 hashing");
+        info("Usage: %s [<walks per geometry, default 1M>]", argv[0]);
+        exit(1);
+    }
+    uint64_t walks = (argc == 2)? strtoull(argv[1], nullptr, 0) : 1000000;
+
+    gm_init(64<<20 /*64 MB*/);
+
+    struct Geometry {uint32_t lines, ways, cands;};
+    const Geometry geometries[] = {{32768, 4, 16}, {32768, 4, 52}, {32768, 8, 64}, {262144, 4, 52}, {262144, 8, 64}};
+
+    info("%8s %5s %6s %14s %14s %14s %9s", "Lines", "Ways", "Cands", "matrix walks/s", "hash() walks/s", "hashAll walks/s", "Speedup");
+    for (const Geometry& g : geometries) {
+        H3HashFamily* h3 = new H3HashFamily(g.ways, ilog2(g.lines/g.ways));  // as in init.cpp
+        double walksPerSec[3];
+        uint64_t checksums[3];
+        for (uint32_t m = MATRIX; m <= HASH_ALL; m++) {
+            ZWalk zw(g.lines, g.ways, g.cands, 1234);
+            MTRand rnd(5678);
+            uint64_t checksum = 0;
+            uint64_t startNs = getNs();
+            for (uint64_t i = 0; i < walks; i++) {
+                Address lineAddr = ((((uint64_t)rnd.randInt()) << 32) | rnd.randInt()) | 1;
+                checksum = checksum*7 + zw.insert(h3, h3, (HashMode)m, lineAddr, rnd.randInt());
+            }
+            walksPerSec[m] = walks*1e9/(getNs() - startNs);
+            checksums[m] = checksum;
+            if (checksums[m] != checksums[MATRIX]) panic("%s walks visited different candidates than the reference", modeNames[m]);
+        }
+        info("%8d %5d %6d %14.0f %14.0f %14.0f %9.2f", g.lines, g.ways, g.cands,
+                walksPerSec[MATRIX], walksPerSec[HASH], walksPerSec[HASH_ALL], walksPerSec[HASH_ALL]/walksPerSec[MATRIX]);
+        delete h3;
+    }
+    return 0;
+}